@@ -0,0 +1,109 @@
+"""Load test of the evaluation daemon
+
+Starts tools/vectfit_daemon.py on a set of random models, for each
+coalescing window, and has client processes send small evaluation requests
+for a fixed time. Prints the throughput, the latency percentiles and the
+mean number of requests per evaluated batch.
+
+    python benchmarks/daemon_load.py --clients 8 --windows 0 20 100
+
+"""
+import argparse
+import multiprocessing
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'tools'))
+from vectfit_daemon import Client  # noqa: E402
+from random_models import random_pairs  # noqa: E402
+
+
+def write_models(directory, n_models, n_poles, n_rows):
+    paths = {}
+    rng = np.random.default_rng(0)
+    for k in range(n_models):
+        poles, residues = random_pairs(rng, n_poles, n_rows, 1.0, 10.0,
+                                       (0.01, 0.1))
+        paths['model{}'.format(k)] = os.path.join(directory,
+                                                  'model{}.npz'.format(k))
+        np.savez(paths['model{}'.format(k)], poles=poles, residues=residues)
+    return paths
+
+
+def client(args):
+    path, keys, points, seconds, seed = args
+    rng = np.random.default_rng(seed)
+    latencies = []
+    with Client(path) as c:
+        end = time.perf_counter() + seconds
+        while time.perf_counter() < end:
+            key = keys[rng.integers(len(keys))]
+            s = rng.uniform(1.0, 10.0, points)
+            t0 = time.perf_counter()
+            c.evaluate(key, s)
+            latencies.append(time.perf_counter() - t0)
+    return latencies
+
+
+def wait_for(path, timeout=10.0):
+    end = time.time() + timeout
+    while not os.path.exists(path):
+        if time.time() > end:
+            raise RuntimeError('daemon did not start')
+        time.sleep(0.05)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--models', type=int, default=8)
+    parser.add_argument('--poles', type=int, default=40)
+    parser.add_argument('--rows', type=int, default=3)
+    parser.add_argument('--points', type=int, default=4)
+    parser.add_argument('--clients', type=int, default=8)
+    parser.add_argument('--seconds', type=float, default=3.0)
+    parser.add_argument('--windows', type=float, nargs='+',
+                        default=[0.0, 20.0, 100.0],
+                        help='coalescing windows in microseconds')
+    args = parser.parse_args()
+
+    daemon = os.path.join(os.path.dirname(__file__), '..', 'tools',
+                          'vectfit_daemon.py')
+    with tempfile.TemporaryDirectory() as directory:
+        paths = write_models(directory, args.models, args.poles, args.rows)
+        keys = sorted(paths)
+        sock = os.path.join(directory, 'vectfit.sock')
+
+        print('{:>10} {:>10} {:>12} {:>10} {:>10} {:>10}'.format(
+            'window', 'clients', 'requests/s', 'p50 [us]', 'p99 [us]',
+            'per batch'))
+        for window in args.windows:
+            proc = subprocess.Popen(
+                [sys.executable, daemon, sock, '--window', str(window)] +
+                ['{}={}'.format(k, p) for k, p in paths.items()])
+            try:
+                wait_for(sock)
+                with multiprocessing.Pool(args.clients) as pool:
+                    results = pool.map(client, [
+                        (sock, keys, args.points, args.seconds, i)
+                        for i in range(args.clients)])
+                with Client(sock) as c:
+                    stats = c.stats()
+            finally:
+                proc.terminate()
+                proc.wait()
+                if os.path.exists(sock):
+                    os.unlink(sock)
+            lat = 1e6*np.concatenate([np.array(r) for r in results])
+            print('{:>10.1f} {:>10} {:>12.0f} {:>10.1f} {:>10.1f} {:>10.2f}'
+                  .format(window, args.clients, lat.size/args.seconds,
+                          np.percentile(lat, 50), np.percentile(lat, 99),
+                          stats['requests']/max(stats['batches'], 1)))
+
+
+if __name__ == '__main__':
+    main()
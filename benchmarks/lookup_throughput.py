@@ -0,0 +1,79 @@
+"""Throughput of batched (model, point) lookups
+
+Evaluates a batch of random (model, point) queries, as gathered by an event
+based transport step, three ways: one query at a time in the given order,
+with vectfit.lookup on the unordered batch, and with one Model.evaluate per
+model on presorted points (the reference the lookup should approach).
+
+    python benchmarks/lookup_throughput.py --models 100 --queries 1000000
+
+"""
+import argparse
+import time
+
+import numpy as np
+import vectfit as m
+
+from random_models import random_pairs
+
+
+def make_models(n_models, n_poles, n_rows):
+    rng = np.random.default_rng(0)
+    models = []
+    for k in range(n_models):
+        poles, residues = random_pairs(rng, n_poles, n_rows, k, k + 1.0,
+                                       (0.001, 0.01))
+        models.append(m.Model(poles, residues, np.ones((n_rows, 2))))
+    return models
+
+
+def timed(func, repeat):
+    best = np.inf
+    for i in range(repeat):
+        t0 = time.perf_counter()
+        func()
+        best = min(best, time.perf_counter() - t0)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--models', type=int, default=100)
+    parser.add_argument('--poles', type=int, default=40)
+    parser.add_argument('--rows', type=int, default=3)
+    parser.add_argument('--queries', type=int, default=200000)
+    parser.add_argument('--single', type=int, default=5000,
+                        help='queries timed one at a time')
+    parser.add_argument('--repeat', type=int, default=3)
+    args = parser.parse_args()
+
+    models = make_models(args.models, args.poles, args.rows)
+    rng = np.random.default_rng(1)
+    index = rng.integers(0, args.models, args.queries)
+    s = index + rng.uniform(0.0, 1.0, args.queries)
+
+    def single():
+        for k, x in zip(index[:args.single], s[:args.single]):
+            models[k].evaluate(np.array([x]))
+
+    def batched():
+        m.lookup(models, index, s)
+
+    order = np.lexsort((s, index))
+    bounds = np.searchsorted(index[order], np.arange(args.models + 1))
+    sorted_s = [s[order[bounds[k]:bounds[k + 1]]] for k in range(args.models)]
+
+    def presorted():
+        for model, x in zip(models, sorted_s):
+            model.evaluate(x)
+
+    rows = [('one by one', args.single, timed(single, 1)),
+            ('lookup', args.queries, timed(batched, args.repeat)),
+            ('presorted', args.queries, timed(presorted, args.repeat))]
+    print('{:>12} {:>12} {:>14}'.format('method', 'queries', 'queries/s'))
+    for name, n, t in rows:
+        print('{:>12} {:>12} {:>14.3e}'.format(name, n, n/t))
+
+
+if __name__ == '__main__':
+    main()
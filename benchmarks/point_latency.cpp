@@ -0,0 +1,95 @@
+// Latency of single-point model evaluation
+//
+// Times Model::evaluate(double, double *), the path behind
+// Model.evaluate_point, on windows of conjugate pairs, against the array
+// evaluation of one point. Built by CMake as point_latency:
+//
+//     point_latency [n_poles] [n_rows]
+//
+// The Python call overhead is not included, so that the times are those of
+// a C++ transport code querying one energy at a time.
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "vectfit_core.h"
+
+// Model of N/2 random conjugate pairs over [1, 1000] with Nv rows
+Model
+random_model(size_t N, size_t Nv, std::mt19937_64 &rng)
+{
+  std::uniform_real_distribution<double> x(1.0, 1000.0), y(0.01, 1.0);
+  std::normal_distribution<double> c(0.0, 1.0);
+  Model model;
+  model.poles = xt::zeros<std::complex<double>>({N});
+  model.residues = xt::zeros<std::complex<double>>({Nv, N});
+  model.polys = xt::zeros<double>({Nv, (size_t)2});
+  for (size_t m = 0; m + 1 < N; m += 2)
+  {
+    model.poles(m) = {x(rng), y(rng)};
+    model.poles(m + 1) = std::conj(model.poles(m));
+    for (size_t n = 0; n < Nv; n++)
+    {
+      model.residues(n, m) = {c(rng), c(rng)};
+      model.residues(n, m + 1) = std::conj(model.residues(n, m));
+    }
+  }
+  for (auto &p : model.polys) p = c(rng);
+  return model;
+}
+
+// Best time per query over repeats of the queries, in ns
+template <class F>
+double
+time_per_query(const std::vector<double> &queries, F query)
+{
+  double best = 1e300;
+  for (int r = 0; r < 5; r++)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto s : queries) query(s);
+    auto t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0)
+                          .count() / queries.size());
+  }
+  return best;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t N = argc > 1 ? std::atoi(argv[1]) : 50;
+  size_t Nv = argc > 2 ? std::atoi(argv[2]) : 1;
+  std::mt19937_64 rng(0);
+  auto model = random_model(N, Nv, rng);
+
+  // Unordered queries, as in history-based transport
+  std::uniform_real_distribution<double> energy(1.0, 1000.0);
+  std::vector<double> queries(1000000);
+  for (auto &s : queries) s = energy(rng);
+
+  std::vector<double> f(Nv);
+  double sink = 0.0;
+  model.evaluate(queries[0], f.data()); // builds the terms
+  double point = time_per_query(queries, [&](double s) {
+    model.evaluate(s, f.data());
+    sink += f[0];
+  });
+
+  std::vector<double> few(queries.begin(), queries.begin() + 100000);
+  xt::xtensor<double, 1> one({1});
+  double array = time_per_query(few, [&](double s) {
+    one(0) = s;
+    sink += model.evaluate(one)(0, 0);
+  });
+
+  std::printf("%8s %8s %16s %16s\n", "poles", "rows", "point [ns]",
+              "array [ns]");
+  std::printf("%8zu %8zu %16.1f %16.1f\n", N, Nv, point, array);
+  // Use the results, so that the evaluations are not optimized out
+  return sink == 0.123 ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+"""Random pole-residue models shared by the benchmarks"""
+import numpy as np
+
+
+def random_pairs(rng, n_poles, n_rows, lo, hi, imag):
+    """Poles and residues of n_poles//2 random conjugate pairs
+
+    The real parts of the poles are uniform over [lo, hi], their imaginary
+    parts uniform over the interval imag, and the residues of the n_rows
+    rows are complex normal, with conjugate residues on each pair.
+    """
+    a = rng.uniform(lo, hi, n_poles//2)
+    b = rng.uniform(imag[0], imag[1], n_poles//2)
+    poles = np.empty(n_poles, dtype=complex)
+    poles[0::2] = a + 1j*b
+    poles[1::2] = a - 1j*b
+    shape = (n_rows, n_poles//2)
+    r = rng.normal(size=shape) + 1j*rng.normal(size=shape)
+    residues = np.empty((n_rows, n_poles), dtype=complex)
+    residues[:, 0::2] = r
+    residues[:, 1::2] = r.conj()
+    return poles, residues
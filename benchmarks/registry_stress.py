@@ -0,0 +1,90 @@
+"""Lookup latency of a Registry while its models are hot-swapped
+
+Reader threads evaluate random models of the registry in a loop and record
+the latency of every lookup, first with no writer and then with a writer
+republishing refitted (here: rescaled) models as fast as it can. With
+snapshot reads the two latency distributions should be nearly identical.
+
+    python benchmarks/registry_stress.py --readers 4 --seconds 5
+
+"""
+import argparse
+import threading
+import time
+
+import numpy as np
+import vectfit as m
+
+from random_models import random_pairs
+
+
+def make_model(k, n_poles, n_rows):
+    rng = np.random.default_rng(k)
+    poles, residues = random_pairs(rng, n_poles, n_rows, 1.0, 10.0,
+                                   (0.01, 0.1))
+    return m.Model(poles, residues)
+
+
+def run(registry, keys, s, n_readers, seconds, writer):
+    stop = threading.Event()
+    latencies = [[] for i in range(n_readers)]
+    updates = [0]
+
+    def read(out, seed):
+        rng = np.random.default_rng(seed)
+        while not stop.is_set():
+            key = keys[rng.integers(len(keys))]
+            t0 = time.perf_counter()
+            registry.evaluate(key, s)
+            out.append(time.perf_counter() - t0)
+
+    def write():
+        models = {key: registry.get(key) for key in keys}
+        while not stop.is_set():
+            key = keys[updates[0] % len(keys)]
+            models[key] = 1.0*models[key]
+            registry.publish(key, models[key])
+            updates[0] += 1
+
+    threads = [threading.Thread(target=read, args=(latencies[i], i))
+               for i in range(n_readers)]
+    if writer:
+        threads.append(threading.Thread(target=write))
+    for t in threads:
+        t.start()
+    time.sleep(seconds)
+    stop.set()
+    for t in threads:
+        t.join()
+    return 1e6*np.concatenate(latencies), updates[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--models', type=int, default=64)
+    parser.add_argument('--poles', type=int, default=40)
+    parser.add_argument('--rows', type=int, default=3)
+    parser.add_argument('--points', type=int, default=16)
+    parser.add_argument('--readers', type=int, default=4)
+    parser.add_argument('--seconds', type=float, default=3.0)
+    args = parser.parse_args()
+
+    registry = m.Registry()
+    keys = ['model{}'.format(k) for k in range(args.models)]
+    registry.update({key: make_model(k, args.poles, args.rows)
+                     for k, key in enumerate(keys)})
+    s = np.linspace(1.0, 10.0, args.points)
+
+    print('{:>10} {:>10} {:>10} {:>10} {:>10} {:>10}'.format(
+        'writer', 'lookups', 'updates', 'p50 [us]', 'p99 [us]', 'max [us]'))
+    for writer in (False, True):
+        lat, updates = run(registry, keys, s, args.readers, args.seconds,
+                           writer)
+        print('{:>10} {:>10} {:>10} {:>10.2f} {:>10.2f} {:>10.2f}'.format(
+            'yes' if writer else 'no', lat.size, updates,
+            np.percentile(lat, 50), np.percentile(lat, 99), lat.max()))
+    print('retired snapshots still in use: {}'.format(registry.retired))
+
+
+if __name__ == '__main__':
+    main()
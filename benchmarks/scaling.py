@@ -0,0 +1,182 @@
+"""Strong and weak scaling of the parallel paths
+
+Times each parallel path of the module at thread counts from 1 to all the
+cores, with a fixed problem (strong scaling) and with a problem growing with
+the number of threads (weak scaling). Every measurement runs in a fresh
+process with OMP_NUM_THREADS (and the BLAS thread counts) set, so that the
+peak memory is that of the measurement alone.
+
+Paths:
+    batch      vectfit_batch over resonance-generated windows
+    rows       vectfit with many rows (parallel row loops), test_large shape
+    qr         vectfit with one large row (BLAS-threaded QR), test_large shape
+    lookup     lookup of unordered queries (parallel chunked evaluation)
+    integrate  integrate over many groups (parallel group loop)
+
+    python benchmarks/scaling.py --output scaling.json
+
+"""
+import argparse
+import json
+import os
+import resource
+import subprocess
+import sys
+import time
+
+import numpy as np
+import vectfit as m
+
+PATHS = ['batch', 'rows', 'qr', 'lookup', 'integrate']
+
+
+def resonance_window(rng, n_res, Ns):
+    """Samples and initial poles of a window from random resonances"""
+    e = np.sort(rng.uniform(10.0, 1000.0, n_res))
+    g = rng.uniform(0.05, 1.0, n_res)
+    s = np.linspace(np.sqrt(5.0), np.sqrt(1005.0), Ns)
+    # the reference pairs of all the resonances, which resonance_poles would
+    # merge when close
+    upper = np.sqrt(e + 0.5j*g)
+    poles = np.empty(2*n_res, dtype=complex)
+    poles[0::2] = upper
+    poles[1::2] = upper.conj()
+    r = rng.normal(size=(1, n_res)) + 1j*rng.normal(size=(1, n_res))
+    residues = np.empty((1, poles.size), dtype=complex)
+    residues[:, 0::2] = r
+    residues[:, 1::2] = r.conj()
+    f = m.evaluate(s, poles, residues, [[1.0]])
+    init = m.resonance_poles(e*(1 + 1e-3), g, s[0], s[-1],
+                             sqrt_transform=True)
+    return f, s, init, 1.0/np.maximum(np.abs(f), 1e-3)
+
+
+def large_problem(Nv, Ns, N):
+    """The test_large problem family, with Nv scaled rows"""
+    s = np.linspace(1.0e-2, 5.e3, Ns)
+    poles = np.linspace(1.1e-2, 4.8e+3, N//2)
+    poles = poles + poles*0.01j
+    poles = np.sort(np.append(poles, np.conj(poles)))
+    residues = np.linspace(1e+2, 1e+6, N//2)
+    residues = residues + residues*0.5j
+    residues = np.sort(np.append(residues, np.conj(residues)))
+    residues = np.outer(np.linspace(1.0, 2.0, Nv), residues)
+    f = m.evaluate(s, poles, residues)
+    init = np.linspace(1.2e-2, 4.7e+3, N//2)
+    init = init + init*0.01j
+    init = np.sort(np.append(init, np.conj(init)))
+    return f, s, init, 1.0/f
+
+
+def setup(path, size):
+    """Callable running the path on a problem of relative size"""
+    rng = np.random.default_rng(0)
+    if path == 'batch':
+        windows = [resonance_window(rng, 20, 500) for i in range(16*size)]
+        f, s, p, w = (list(x) for x in zip(*windows))
+        return lambda: m.vectfit_batch(f, s, p, w, n_polys=1, n_iter=2)
+    if path == 'rows':
+        f, s, p, w = large_problem(8*size, 5000, 100)
+        return lambda: m.vectfit(f, s, p.copy(), w)
+    if path == 'qr':
+        f, s, p, w = large_problem(1, 5000*size, 400)
+        return lambda: m.vectfit(f, s, p.copy(), w)
+    if path == 'lookup':
+        f, s, p, w = large_problem(3, 10, 100)
+        models = [m.Model(p*(1 + 0.01*k), 1e3*np.ones((3, p.size)))
+                  for k in range(64)]
+        index = rng.integers(0, 64, 500000*size)
+        x = rng.uniform(1.0, 5.e3, index.size)
+        return lambda: m.lookup(models, index, x)
+    if path == 'integrate':
+        f, s, p, w = large_problem(3, 10, 400)
+        model = m.Model(p, 1e3*np.ones((3, p.size)))
+        edges = np.linspace(1.0, 5.e3, 20000*size + 1)
+        return lambda: m.integrate(model, edges)
+    raise ValueError('unknown path {}'.format(path))
+
+
+def worker(path, size, repeat):
+    run = setup(path, size)
+    best = np.inf
+    for i in range(repeat):
+        t0 = time.perf_counter()
+        run()
+        best = min(best, time.perf_counter() - t0)
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if sys.platform != 'darwin':
+        rss *= 1024
+    print(json.dumps({'time': best, 'max_rss': rss}))
+
+
+def measure(path, threads, size, repeat):
+    env = dict(os.environ)
+    for var in ('OMP_NUM_THREADS', 'OPENBLAS_NUM_THREADS', 'MKL_NUM_THREADS'):
+        env[var] = str(threads)
+    out = subprocess.check_output(
+        [sys.executable, __file__, '--worker', path, str(size), str(repeat)],
+        env=env)
+    return json.loads(out.decode().splitlines()[-1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--paths', nargs='+', default=PATHS, choices=PATHS)
+    parser.add_argument('--threads', type=int, nargs='+',
+                        help='thread counts (default: powers of 2 up to all '
+                        'the cores, and all the cores)')
+    parser.add_argument('--repeat', type=int, default=3)
+    parser.add_argument('--output', help='JSON file of the results')
+    parser.add_argument('--worker', nargs=3, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.worker:
+        worker(args.worker[0], int(args.worker[1]), int(args.worker[2]))
+        return
+
+    cores = os.cpu_count()
+    threads = args.threads
+    if threads is None:
+        threads = sorted({2**k for k in range(cores.bit_length())
+                          if 2**k <= cores} | {cores})
+
+    results = []
+    for path in args.paths:
+        # Both modes are relative to the serial run of the size 1 problem,
+        # measured even if 1 is not among the thread counts
+        runs = {(1, 1): measure(path, 1, 1, args.repeat)}
+        base = runs[1, 1]['time']
+        for mode in ('strong', 'weak'):
+            for t in threads:
+                size = 1 if mode == 'strong' else t
+                if (t, size) not in runs:
+                    runs[t, size] = measure(path, t, size, args.repeat)
+                r = runs[t, size]
+                if mode == 'strong':
+                    speedup = base/r['time']
+                    efficiency = speedup/t
+                else:
+                    speedup = base*size/r['time']
+                    efficiency = base/r['time']
+                results.append({
+                    'path': path, 'mode': mode, 'threads': t, 'size': size,
+                    'time': r['time'], 'speedup': speedup,
+                    'efficiency': efficiency, 'max_rss': r['max_rss'],
+                    'rss_per_thread': r['max_rss']/t})
+
+    if args.output:
+        with open(args.output, 'w') as fh:
+            json.dump({'cores': cores, 'results': results}, fh, indent=2)
+
+    print('{:>10} {:>7} {:>8} {:>11} {:>8} {:>10} {:>14}'.format(
+        'path', 'mode', 'threads', 'time [s]', 'speedup', 'efficiency',
+        'MB per thread'))
+    for r in results:
+        print('{:>10} {:>7} {:>8} {:>11.4f} {:>8.2f} {:>10.2f} {:>14.1f}'
+              .format(r['path'], r['mode'], r['threads'], r['time'],
+                      r['speedup'], r['efficiency'],
+                      r['rss_per_thread']/2**20))
+
+
+if __name__ == '__main__':
+    main()
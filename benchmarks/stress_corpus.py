@@ -0,0 +1,203 @@
+"""Pathological-input stress corpus and benchmark
+
+Generates (with fixed seeds) the kinds of windows which hurt in production
+and fits each one with successive vectfit calls until the RMS error stops
+improving. For every case it reports the time, the number of iterations to
+converge and the numerical safeguards triggered (vectfit.stats). Given a
+baseline JSON of an earlier run, the cases which got slower, need more
+iterations or now fail are reported and the exit status is 1.
+
+    python benchmarks/stress_corpus.py --output stress.json
+    python benchmarks/stress_corpus.py --baseline stress.json
+    python benchmarks/stress_corpus.py --save corpus/   # write the inputs
+
+"""
+import argparse
+import json
+import os
+import sys
+import time
+
+import numpy as np
+import vectfit as m
+
+
+def pairs(re, im):
+    p = np.empty(2*len(re), dtype=complex)
+    p[0::2] = np.asarray(re) + 1j*np.asarray(im)
+    p[1::2] = np.conj(p[0::2])
+    return p
+
+
+def conj_residues(r):
+    r = np.atleast_2d(r)
+    out = np.empty((r.shape[0], 2*r.shape[1]), dtype=complex)
+    out[:, 0::2] = r
+    out[:, 1::2] = np.conj(r)
+    return out
+
+
+def initial_poles(s, n_pairs):
+    re = np.linspace(s[0], s[-1], n_pairs + 2)[1:-1]
+    return pairs(re, 0.01*np.abs(re))
+
+
+def clustered():
+    """Ten resonances within 1e-4 relative of each other"""
+    rng = np.random.default_rng(11)
+    s = np.linspace(99.0, 101.0, 2000)
+    poles = pairs(100.0 + 1e-2*np.sort(rng.uniform(-1, 1, 10)),
+                  rng.uniform(1e-3, 5e-3, 10))
+    r = conj_residues(rng.normal(size=10) + 1j*rng.normal(size=10))
+    f = m.evaluate(s, poles, r, [[1.0]])
+    return f, s, initial_poles(s, 10), 1.0/np.abs(f), 1
+
+
+def dynamic_range():
+    """Residues, hence f, spanning 16 decades"""
+    rng = np.random.default_rng(12)
+    s = np.linspace(1.0, 1000.0, 3000)
+    poles = pairs(np.linspace(10.0, 990.0, 12), np.logspace(-3, 1, 12))
+    r = conj_residues(np.logspace(-8, 8, 12)*(1 + 1j*rng.normal(size=12)))
+    f = m.evaluate(s, poles, r, [[1.0]])
+    return f, s, initial_poles(s, 12), 1.0/np.abs(f), 1
+
+
+def near_axis():
+    """Poles almost on the sample axis"""
+    s = np.linspace(1.0, 100.0, 5000)
+    poles = pairs(np.linspace(5.0, 95.0, 8), 1e-9*np.linspace(5.0, 95.0, 8))
+    r = conj_residues(1e-6*np.ones(8))
+    f = m.evaluate(s, poles, r, [[1.0]])
+    return f, s, initial_poles(s, 8), 1.0/np.abs(f), 1
+
+
+def wide_weights():
+    """Weights spanning 30 decades"""
+    rng = np.random.default_rng(14)
+    s = np.linspace(1.0, 100.0, 2000)
+    poles = pairs(np.linspace(5.0, 95.0, 8), np.linspace(0.1, 2.0, 8))
+    r = conj_residues(rng.normal(size=(2, 8)) + 1j*rng.normal(size=(2, 8)))
+    f = m.evaluate(s, poles, r, [[1.0], [2.0]])
+    w = np.tile(np.logspace(-15, 15, s.size), (2, 1))
+    return f, s, initial_poles(s, 8), w, 1
+
+
+def pole_on_sample():
+    """Initial real pole exactly on a sample point (infinite basis values)"""
+    s = np.linspace(1.0, 10.0, 901)
+    poles = np.concatenate([pairs([3.0, 7.0], [0.1, 0.2]), [12.0]])
+    r = np.array([[1.0-2.0j, 1.0+2.0j, 2.0+1.0j, 2.0-1.0j, 5.0]])
+    f = m.evaluate(s, poles, r)
+    init = np.concatenate([initial_poles(s, 2), [s[450]]])
+    return f, s, init, np.ones_like(f), 0
+
+
+def tiny_signal():
+    """Signal near the underflow range (extreme D of sigma)"""
+    s = np.linspace(1.0, 10.0, 500)
+    poles = pairs([3.0, 7.0], [0.1, 0.2])
+    r = conj_residues([1e-290 + 2e-290j, 3e-290 - 1e-290j])
+    f = m.evaluate(s, poles, r)
+    return f, s, initial_poles(s, 2), np.ones_like(f), 0
+
+
+CASES = {func.__name__: func for func in
+         (clustered, dynamic_range, near_axis, wide_weights, pole_on_sample,
+          tiny_signal)}
+
+
+def run_case(name, max_iter, rtol, constrain=False):
+    f, s, poles, weight, n_polys = CASES[name]()
+    m.reset_stats()
+    result = {'case': name, 'converged': False, 'failed': None}
+    rms_prev = np.inf
+    t0 = time.perf_counter()
+    it = 0
+    try:
+        for it in range(1, max_iter + 1):
+            poles, residues, cf, fit, rms = m.vectfit(f, s, poles, weight,
+                                                      n_polys=n_polys,
+                                                      constrain=constrain)
+            if not np.isfinite(rms):
+                raise FloatingPointError('non-finite RMS error')
+            if it > 1 and abs(rms_prev - rms) <= rtol*rms_prev:
+                result['converged'] = True
+                break
+            rms_prev = rms
+        result['rmserr'] = float(rms)
+        result['relerr'] = float(np.max(np.abs(fit - f))/np.max(np.abs(f)))
+    except Exception as e:
+        result['failed'] = '{}: {}'.format(type(e).__name__, e)
+    result['time'] = time.perf_counter() - t0
+    result['iterations'] = it
+    result.update(m.stats())
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--cases', nargs='+', default=sorted(CASES),
+                        choices=sorted(CASES))
+    parser.add_argument('--max-iter', type=int, default=30)
+    parser.add_argument('--rtol', type=float, default=1e-3,
+                        help='relative RMS change of convergence')
+    parser.add_argument('--output', help='JSON file of the results')
+    parser.add_argument('--baseline', help='JSON file of an earlier run')
+    parser.add_argument('--slowdown', type=float, default=1.25,
+                        help='time ratio reported as a regression')
+    parser.add_argument('--constrain', action='store_true',
+                        help='constrain the relocated poles')
+    parser.add_argument('--save', help='directory to write the corpus to')
+    args = parser.parse_args()
+
+    if args.save:
+        os.makedirs(args.save, exist_ok=True)
+        for name in args.cases:
+            f, s, poles, weight, n_polys = CASES[name]()
+            np.savez(os.path.join(args.save, name + '.npz'), f=f, s=s,
+                     poles=poles, weight=weight, n_polys=n_polys)
+
+    results = [run_case(name, args.max_iter, args.rtol, args.constrain)
+               for name in args.cases]
+    if args.output:
+        with open(args.output, 'w') as fh:
+            json.dump(results, fh, indent=2)
+
+    print('{:>15} {:>9} {:>6} {:>10} {:>10} {:>7} {:>9} {:>9} {:>7} {:>7}'
+          .format('case', 'time [s]', 'iters', 'converged', 'rel. err',
+                  'clamps', 'fallback', 'rank def', 'lifted', 'moved'))
+    for r in results:
+        print('{:>15} {:>9.3f} {:>6} {:>10} {:>10} {:>7} {:>9} {:>9} {:>7} {:>7}'
+              .format(r['case'], r['time'], r['iterations'],
+                      'failed' if r['failed'] else str(r['converged']),
+                      '{:.2e}'.format(r['relerr']) if 'relerr' in r else '-',
+                      r['inf_clamps'], r['tol_fallbacks'],
+                      r['rank_deficient'], r['poles_lifted'],
+                      r['poles_relocated']))
+
+    if args.baseline:
+        with open(args.baseline) as fh:
+            baseline = {r['case']: r for r in json.load(fh)}
+        regressions = []
+        for r in results:
+            b = baseline.get(r['case'])
+            if b is None:
+                continue
+            if r['failed'] and not b['failed']:
+                regressions.append('{}: now fails ({})'.format(r['case'],
+                                                               r['failed']))
+            if r['time'] > args.slowdown*b['time']:
+                regressions.append('{}: {:.3f} s vs {:.3f} s'.format(
+                    r['case'], r['time'], b['time']))
+            if r['iterations'] > b['iterations']:
+                regressions.append('{}: {} iterations vs {}'.format(
+                    r['case'], r['iterations'], b['iterations']))
+        for line in regressions:
+            print('REGRESSION ' + line)
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
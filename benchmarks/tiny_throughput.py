@@ -0,0 +1,69 @@
+"""Throughput of vectfit_tiny on many tiny problems
+
+Fits a batch of tiny random windows (a few poles, tens of samples) with
+vectfit_tiny, which lays the problems out across the SIMD lanes, and with
+vectfit_batch, which fits one problem per thread, and reports the fits per
+second of both and the problems left to the scalar fallback.
+
+    python benchmarks/tiny_throughput.py --problems 100000 --poles 8
+
+"""
+import argparse
+import time
+
+import numpy as np
+import vectfit as m
+
+
+def make_problems(n_problems, n_poles, n_samples, n_rows):
+    rng = np.random.default_rng(0)
+    s = np.linspace(1.0, 2.0, n_samples)
+    f, poles = [], []
+    init = np.empty(n_poles, dtype=complex)
+    centers = np.linspace(1.1, 1.9, n_poles//2)
+    init[0::2] = centers + 0.02j
+    init[1::2] = centers - 0.02j
+    for k in range(n_problems):
+        p = np.empty(n_poles, dtype=complex)
+        a = np.sort(rng.uniform(1.05, 1.95, n_poles//2))
+        p[0::2] = a + 1j*rng.uniform(0.005, 0.05, n_poles//2)
+        p[1::2] = p[0::2].conj()
+        shape = (n_rows, n_poles//2)
+        r = np.empty((n_rows, n_poles), dtype=complex)
+        r[:, 0::2] = rng.normal(size=shape) + 1j*rng.normal(size=shape)
+        r[:, 1::2] = r[:, 0::2].conj()
+        f.append(m.evaluate(s, p, r, np.ones((n_rows, 1))))
+        poles.append(init)
+    return f, [s]*n_problems, poles, [np.ones_like(fk) for fk in f]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--problems', type=int, default=20000)
+    parser.add_argument('--poles', type=int, default=6)
+    parser.add_argument('--samples', type=int, default=60)
+    parser.add_argument('--rows', type=int, default=1)
+    parser.add_argument('--iter', type=int, default=3)
+    args = parser.parse_args()
+
+    f, s, poles, weight = make_problems(args.problems, args.poles,
+                                        args.samples, args.rows)
+    rows = []
+    for name, func in (('tiny', m.vectfit_tiny),
+                       ('batch', m.vectfit_batch)):
+        m.reset_stats()
+        t0 = time.perf_counter()
+        results = func(f, s, poles, weight, n_polys=1, n_iter=args.iter)
+        elapsed = time.perf_counter() - t0
+        rms = np.median([r[4] for r in results])
+        rows.append((name, elapsed, args.problems/elapsed, rms,
+                     m.stats()['tiny_fallbacks']))
+
+    print('{:>8} {:>10} {:>12} {:>12} {:>10}'.format(
+        'engine', 'time [s]', 'fits/s', 'median rms', 'fallbacks'))
+    for row in rows:
+        print('{:>8} {:>10.3f} {:>12.0f} {:>12.3e} {:>10}'.format(*row))
+
+
+if __name__ == '__main__':
+    main()
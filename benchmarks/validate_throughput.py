@@ -0,0 +1,78 @@
+"""Throughput of the validation of a library against dense reference data
+
+Compares vectfit.validate on a whole library of packed windows with the
+per-window loop of an evaluate call followed by numpy error passes.
+
+    python benchmarks/validate_throughput.py --windows 500 --points 50000
+
+"""
+import argparse
+import time
+
+import numpy as np
+import vectfit as m
+
+from random_models import random_pairs
+
+
+def make_library(n_windows, n_poles, n_rows, n_points):
+    rng = np.random.default_rng(0)
+    models, s, f = [], [], []
+    for k in range(n_windows):
+        poles, residues = random_pairs(rng, n_poles, n_rows, k, k + 1.0,
+                                       (0.001, 0.01))
+        model = m.Model(poles, residues, np.ones((n_rows, 2)))
+        x = np.linspace(k, k + 1.0, n_points)
+        y = model.evaluate(x)
+        y *= 1.0 + 1e-4*rng.normal(size=y.shape)
+        models.append(model)
+        s.append(x)
+        f.append(y)
+    return models, s, f
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--windows', type=int, default=200)
+    parser.add_argument('--poles', type=int, default=40)
+    parser.add_argument('--rows', type=int, default=3)
+    parser.add_argument('--points', type=int, default=20000)
+    parser.add_argument('--rtol', type=float, default=2e-4)
+    args = parser.parse_args()
+
+    models, s, f = make_library(args.windows, args.poles, args.rows,
+                                args.points)
+    offsets = np.concatenate([[0], np.cumsum([x.size for x in s])])
+    packed_s = np.concatenate(s)
+    packed_f = np.concatenate(f, axis=1)
+
+    t0 = time.perf_counter()
+    failures = []
+    for model, x, y in zip(models, s, f):
+        fit = model.evaluate(x)
+        err = np.abs(fit - y)
+        np.max(err)
+        np.sqrt(np.mean(err**2))
+        failures.append(np.count_nonzero(
+            np.any(err > args.rtol*np.abs(y), axis=0)))
+    t_loop = time.perf_counter() - t0
+
+    t0 = time.perf_counter()
+    result = m.validate(models, offsets, packed_s, packed_f, rtol=args.rtol)
+    t_engine = time.perf_counter() - t0
+    assert np.array_equal(result['failures'], failures)
+
+    n = packed_s.size
+    bytes_read = packed_s.nbytes + packed_f.nbytes
+    print('{:>10} {:>10} {:>14} {:>10}'.format('method', 'time [s]',
+                                                'points/s', 'GB/s'))
+    for name, t in (('loop', t_loop), ('validate', t_engine)):
+        print('{:>10} {:>10.3f} {:>14.3e} {:>10.2f}'.format(
+            name, t, n/t, bytes_read/t/1e9))
+    aggregate = result['aggregate']
+    print('{} of {} windows passed, {} failing points'.format(
+        aggregate['passed'], aggregate['windows'], aggregate['failures']))
+
+
+if __name__ == '__main__':
+    main()
@@ -37,6 +37,31 @@ class get_numpy_include(object):
         return np.get_include()
 
 
+def mpi_flags():
+    """Return the compile and link flags of the MPI C++ compiler wrapper when
+    the build with MPI is requested by the environment variable VECTFIT_MPI.
+    The wrapper can be chosen by the environment variable MPICXX. """
+    if os.environ.get('VECTFIT_MPI', '0') in ('0', ''):
+        return [], []
+    import subprocess
+    mpicxx = os.environ.get('MPICXX', 'mpicxx')
+    try:
+        # Open MPI
+        compile_flags = subprocess.check_output(
+            [mpicxx, '--showme:compile']).decode().split()
+        link_flags = subprocess.check_output(
+            [mpicxx, '--showme:link']).decode().split()
+    except (OSError, subprocess.CalledProcessError):
+        # MPICH
+        compile_flags = [f for f in subprocess.check_output(
+            [mpicxx, '-compile_info']).decode().split()[1:]
+            if f.startswith(('-I', '-D'))]
+        link_flags = [f for f in subprocess.check_output(
+            [mpicxx, '-link_info']).decode().split()[1:]
+            if f.startswith(('-L', '-l', '-Wl'))]
+    return ['-DVECTFIT_MPI'] + compile_flags, link_flags
+
+
 ext_modules = [
     Extension(
         'vectfit',
@@ -79,6 +104,18 @@ def cpp_flag(compiler):
         raise RuntimeError('C++14 support is required by xtensor!')
 
 
+def native_flags(compiler_type):
+    """Return the flags building for the instruction set of the build host
+    (e.g. AVX2/AVX-512 and FMA) when requested by the environment variable
+    VECTFIT_NATIVE. The default build only assumes the baseline instruction
+    set of the platform (SSE2 on x86-64). """
+    if os.environ.get('VECTFIT_NATIVE', '0') in ('0', ''):
+        return []
+    if compiler_type == 'msvc':
+        return ['/arch:AVX2']
+    return ['-march=native']
+
+
 class BuildExt(build_ext):
     """A custom build extension for adding compiler-specific options."""
     c_opts = {
@@ -92,16 +129,26 @@ class BuildExt(build_ext):
     def build_extensions(self):
         ct = self.compiler.compiler_type
         opts = self.c_opts.get(ct, [])
+        link_opts = []
         if ct == 'unix':
             opts.append('-DVERSION_INFO="%s"' % self.distribution.get_version())
             opts.append(cpp_flag(self.compiler))
             if has_flag(self.compiler, '-fvisibility=hidden'):
                 opts.append('-fvisibility=hidden')
+            if has_flag(self.compiler, '-fopenmp'):
+                opts.append('-fopenmp')
+                link_opts.append('-fopenmp')
         elif ct == 'msvc':
             opts.append('/DVERSION_INFO=\\"%s\\"' % self.distribution.get_version())
+            opts.append('/openmp')
         opts.append('-O2')
+        opts += native_flags(ct)
+        mpi_compile, mpi_link = mpi_flags()
+        opts += mpi_compile
+        link_opts += mpi_link
         for ext in self.extensions:
             ext.extra_compile_args = opts
+            ext.extra_link_args = link_opts
         build_ext.build_extensions(self)
 
 with open('README.md') as f:
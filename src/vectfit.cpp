@@ -5,18 +5,53 @@
 #include "xtensor/xnorm.hpp"
 #include "xtensor/xcomplex.hpp"
 #include "xtensor-blas/xlinalg.hpp"
+#ifndef VECTFIT_NO_PYTHON
 #define FORCE_IMPORT_ARRAY
 #include "xtensor-python/pyarray.hpp"
+#endif
 
 #include <iostream>
 #include <stdexcept>
+#include <exception>
 #include <vector>
 #include <tuple>
 #include <complex>
 #include <cmath>
+#include <algorithm>
+#include <string>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
 
+#ifndef VECTFIT_NO_PYTHON
 #include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef VECTFIT_MPI
+#include <mpi.h>
+#endif
+
+#ifdef VECTFIT_NO_PYTHON
+#include "vectfit_core.h"
+#else
+#include "vectfit.h"
 
+namespace py = pybind11;
+#endif
 using namespace std::complex_literals;
 
 // Complex number zero
@@ -26,11 +61,22 @@ constexpr std::complex<double> C_ZERO {0.0, 0.0};
 constexpr double TOLlow  = 1e-18;
 constexpr double TOLhigh = 1e+18;
 
-//! Multipole formalism evaluation function
+// Counters of the numerical safeguards, reported by stats()
+struct Counters
+{
+  std::atomic<long> inf_clamps {0};      // basis values clamped to TOLhigh
+  std::atomic<long> tol_fallbacks {0};   // non-relaxed re-solves of sigma
+  std::atomic<long> rank_deficient {0};  // rank deficient LS-problems
+  std::atomic<long> poles_lifted {0};    // poles moved away from the axis
+  std::atomic<long> poles_relocated {0}; // poles moved back into the band
+  std::atomic<long> tiny_fallbacks {0};  // tiny problems refitted scalar
+};
+Counters counters;
+
+//! Multipole formalism evaluation kernel
 //!
-//! f(s) = REAL[residues/(s - poles)] + Polynomials(s)
-//! Note the input variable s is real and only the real part of the
-//! result f is returned.
+//! f(s) = REAL[residues/(s - poles)] + Polynomials(s), evaluated in real
+//! arithmetic on arrays whose dimensions have already been checked.
 //!
 //! @param s          array of variables to be evaluated. dimension: (Ns)
 //! @param poles      poles. dimension: (N)
@@ -38,20 +84,64 @@ constexpr double TOLhigh = 1e+18;
 //! @param polys      curvefit (Polynomial) coefficients. dimension: (Nv, Nc)
 //! @return           f. dimension: (Nv, Ns)
 
-xt::pyarray<double>
-evaluate(xt::pyarray<double> s,
-         xt::pyarray<std::complex<double>> poles,
-         xt::pyarray<std::complex<double>> residues,
-         xt::pyarray<double> polys = (xt::pyarray<double>) {})
+template <class E1, class E2, class E3, class E4>
+xt::xtensor<double, 2>
+multipole(const E1 &s, const E2 &poles, const E3 &residues, const E4 &polys)
 {
-  // Check input arguments
-  // s
-  if (s.dimension() != 1)
+  auto Ns = s.size();
+  auto N = poles.size();
+  auto Nv = residues.shape()[0];
+  auto Nc = polys.shape()[1];
+  xt::xtensor<double, 2> f({Nv, Ns}, 0.0);
+
+  // REAL[r/(s - p)] = (Re(r)*(s - Re(p)) - Im(r)*Im(p)) / |s - p|^2
+  size_t m, n;
+  if (N > 0)
   {
-    throw std::invalid_argument("Error: input s is not 1-dimensional.");
+    xt::xtensor<double, 2> Dr({N, Ns}, 0.0);
+    xt::xtensor<double, 2> Di({N, Ns}, 0.0);
+    for (m = 0; m < N; m++)
+    {
+      auto a = std::real(poles(m));
+      auto b = std::imag(poles(m));
+      auto d = xt::eval(s - a);
+      auto den = xt::eval(d * d + b * b);
+      xt::view(Dr, m) = d / den;
+      xt::view(Di, m) = -b / den;
+    }
+    xt::xtensor<double, 2> Rr = xt::real(residues);
+    xt::xtensor<double, 2> Ri = xt::imag(residues);
+    f = xt::linalg::dot(Rr, Dr) + xt::linalg::dot(Ri, Di);
   }
-  auto Ns = s.size();
+  for (n = 0; n < Nv; n++)
+  {
+    for (m = 0; m < Nc; m++)
+    {
+      xt::view(f, n) += xt::pow(s, m) * polys(n, m);
+    }
+  }
+
+  return f;
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Pole-residue model from arrays
+//!
+//! Checks the dimensions of the arrays, converting one dimensional residues
+//! and polynomial coefficients of a single row to two dimensional ones.
+//!
+//! @param poles      poles. dimension: (N)
+//! @param residues   residues. dimension: (Nv, N)
+//! @param polys      curvefit (Polynomial) coefficients. dimension: (Nv, Nc)
+//! @return           model
 
+Model
+make_model(xt::pyarray<std::complex<double>> poles,
+           xt::pyarray<std::complex<double>> residues,
+           xt::pyarray<double> polys)
+{
+  // Check input arguments
   // poles
   if (poles.dimension() != 1)
   {
@@ -95,523 +185,6493 @@ evaluate(xt::pyarray<double> s,
     throw std::invalid_argument("Error: 1st dimension of polys does not "
                                 "match the 1st dimension of residues.");
   }
-  auto Nc = polys.shape()[1];
 
-  // Initialize results array
-  xt::pyarray<double> f({Nv, Ns}, 0.0);
+  Model model;
+  model.poles = poles;
+  model.residues = residues;
+  model.polys = polys;
+  return model;
+}
 
-  // Evaluate the multipole form
-  size_t m, n;
-  xt::xtensor<std::complex<double>, 2> Dk2({Ns, N}, C_ZERO);
-  for (m = 0; m < N; m++)
-  {
-    xt::view(Dk2, xt::all(), m) = 1.0 / (s - poles(m));
-  }
-  for (n = 0; n < Nv; n++)
-  {
-    xt::view(f, n) = xt::real(xt::linalg::dot(Dk2,
-                    xt::xarray<std::complex<double>>(xt::view(residues, n))));
-    for (m = 0; m < Nc; m++)
-    {
-      xt::view(f, n) += xt::pow(s, m) * polys(n, m);
-    }
-  }
 
-  // Return
-  return f;
-}
+#endif
 
 
-//! Fast Relaxed Vector Fitting function
+//! Evaluate the pole-residue model
 //!
-//! Approximate f(s) with a rational function:
-//!         f(s)=R*(s*I-A)^(-1) + Polynomials*s
-//! where f(s) is a vector of elements.
-//! When f(s) is a vector, all elements become fitted with a common pole set.
-//! The identification is done using the pole relocating method known as Vector
-//! Fitting [1] with relaxed non-triviality constraint for faster convergence
-//! and smaller fitting errors [2], and utilization of matrix structure for fast
-//! solution of the pole identifion step [3].
-//! [1] B. Gustavsen and A. Semlyen, "Rational approximation of frequency
-//!     domain responses by Vector Fitting", IEEE Trans. Power Delivery,
-//!     vol. 14, no. 3, pp. 1052-1061, July 1999.
-//! [2] B. Gustavsen, "Improving the pole relocating properties of vector
-//!     fitting", IEEE Trans. Power Delivery, vol. 21, no. 3, pp. 1587-1592,
-//!     July 2006.
-//! [3] D. Deschrijver, M. Mrozowski, T. Dhaene, and D. De Zutter,
-//!     "Macromodeling of Multiport Systems Using a Fast Implementation of
-//!     the Vector Fitting Method", IEEE Microwave and Wireless Components
-//!     Letters, vol. 18, no. 6, pp. 383-385, June 2008.
-//! All credit goes to Bjorn Gustavsen for his MATLAB implementation.
-//! (http://www.sintef.no/Projectweb/VECTFIT/)
+//! @param s          array of variables to be evaluated. dimension: (Ns)
+//! @return           f. dimension: (Nv, Ns)
+
+xt::xtensor<double, 2>
+Model::evaluate(const xt::xtensor<double, 1> &s) const
+{
+  return multipole(s, poles, residues, polys);
+}
+
+
+//! Per-pole layout of a model for single-point evaluation
 //!
-//! @param f          function (vector) to be fitted. dimension: (Nv, Ns)
-//! @param s          vector of sample points. dimension: (Ns)
-//! @param poles      vector of initial poles. dimension: (N)
-//! @param weight     the system matrix is weighted using this array
-//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
-//! @param skip_pole  if the pole identification part is skipped
-//! @param skip_res   if the residue identification part is skipped
-//! @return           Tuple(poles, residues, polys, fit, rmserr)
+//! One term per real pole or conjugate pair, the pair counted once with
+//! doubled residues: f_n(s) = sum_k (cr_nk (s-a_k) - ci_nk b_k) /
+//! ((s-a_k)^2 + b_k^2) + polynomials. The arrays are structures of arrays
+//! aligned to 64 bytes and padded to multiples of 8 terms with zero terms,
+//! the width of an AVX-512 register. How many lanes the loops over them
+//! actually use, and whether their multiply-adds are contracted into FMA,
+//! depends on the target: the default build only assumes SSE2 on x86-64
+//! (2 lanes, no FMA), VECTFIT_NATIVE=1 builds for the host (e.g. 4 lanes
+//! and FMA with AVX2).
 
-std::tuple<xt::pyarray<std::complex<double>>,
-           xt::pyarray<std::complex<double>>,
-           xt::pyarray<double>,
-           xt::pyarray<double>,
-           double>
-vectfit(xt::pyarray<double> &f,
-        xt::pyarray<double> &s,
-        xt::pyarray<std::complex<double>> &poles,
-        xt::pyarray<double> &weight,
-        int n_polys = 0,
-        bool skip_pole = false,
-        bool skip_res = false)
+struct Model::Terms
 {
-  // Check input arguments
-  if (f.dimension() != 2)
-  {
-    throw std::invalid_argument("Error: input f is not 2-dimensional.");
-  }
-  auto shape = f.shape();
-  auto Nv = shape[0];
-  auto Ns = shape[1];
-  if (s.dimension() != 1)
-  {
-    throw std::invalid_argument("Error: input s is not 1-dimensional.");
-  }
-  if (Ns != s.size())
-  {
-    throw std::invalid_argument("Error: 2nd dimension of f does not match the "
-                                "length of s.");
-  }
-  auto N = poles.size();
-  if (f.shape() != weight.shape())
-  {
-    throw std::invalid_argument("Error: shape of weight does not match shape of"
-                                " f.");
-  }
-  size_t Nc = (size_t)n_polys;
-  if (Nc < 0 || Nc > 11)
-  {
-    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
-  }
+  static constexpr size_t lanes = 8;
 
-  // Initialize arrays
-  xt::pyarray<std::complex<double>> residues({Nv, N}, C_ZERO); // residues (R)
-  xt::pyarray<double> polys({Nv, Nc}, 0.0); // polynomial coefficients (P)
-  xt::pyarray<double> fit({Nv, Ns}, 0.0); // fitted signals on s
-  double rmserr = 0.0; // RMS error between f and fit
+  size_t K = 0;                 // number of padded terms
+  size_t Nv = 0;                // number of rows
+  size_t Nc = 0;                // number of polynomial coefficients
+  std::vector<double> buffer;   // storage of the arrays below
+  double *a = nullptr;          // real parts of the poles. (K)
+  double *b = nullptr;          // imaginary parts of the poles. (K)
+  double *cr = nullptr;         // real parts of the residues. (Nv, K)
+  double *ci = nullptr;         // imaginary parts of the residues. (Nv, K)
+  std::vector<double> polys;    // polynomial coefficients. (Nv, Nc)
 
-  // If 0 poles and 0 cf order, return
-  if (N == 0 && Nc == 0)
-  {
-    rmserr = xt::linalg::norm(f) / std::sqrt(Nv * Ns);
-    return std::make_tuple(poles, residues, polys, fit, rmserr);
-  }
+  Terms(const Model &model);
+  Terms(const Terms &) = delete;
+  Terms &operator=(const Terms &) = delete;
+};
 
-  // Iteration variables
-  size_t m, n;
 
-  //============================================================================
-  // POLE IDENTIFICATION
-  //============================================================================
-  if (!skip_pole && N > 0)
+Model::Terms::Terms(const Model &model)
+{
+  auto N = model.poles.size();
+  Nv = model.residues.shape()[0];
+  Nc = model.polys.shape()[1];
+
+  // Terms: a conjugate pair with conjugate residues on all rows is merged
+  std::vector<size_t> first;
+  std::vector<double> factor;
+  for (size_t m = 0; m < N; m++)
   {
-    // Finding out which starting poles are complex
-    xt::xtensor<int, 1> cindex({N}, 0); // 0-real, 1-complex, 2-conjugate
-    for (m = 0; m < N; m++)
+    auto p = model.poles(m);
+    bool pair = std::imag(p) != 0.0 && m + 1 < N &&
+                model.poles(m + 1) == std::conj(p);
+    for (size_t n = 0; pair && n < Nv; n++)
     {
-      if (std::imag(poles(m)) != 0.0)
-      {
-        if ((m == 0) || ((m > 0) && (cindex(m - 1) == 0 || cindex(m - 1) == 2)))
-        {
-          if (m >= N - 1 || std::conj(poles(m)) != poles(m + 1))
-          {
-            throw std::invalid_argument("Error: complex poles are not conjugate"
-                                        " pairs.");
-          }
-          cindex(m) = 1;
-          cindex(m + 1) = 2;
-          m++;
-        }
-      }
+      pair = model.residues(n, m + 1) == std::conj(model.residues(n, m));
     }
+    first.push_back(m);
+    factor.push_back(pair ? 2.0 : 1.0);
+    if (pair) m++;
+  }
+  K = (first.size() + lanes - 1) / lanes * lanes;
 
-    // Building system - matrixes
-    xt::xtensor<std::complex<double>, 2> Dk({Ns, N + std::max(Nc, (size_t)1)},
-                                            C_ZERO);
-    for (m = 0; m < N; m++)
+  // Aligned arrays, zero terms as padding (b = 1 keeps them finite)
+  buffer.assign((2 + 2 * Nv) * K + lanes, 0.0);
+  auto offset = (64 - reinterpret_cast<uintptr_t>(buffer.data()) % 64) % 64;
+  a = buffer.data() + offset / sizeof(double);
+  b = a + K;
+  cr = b + K;
+  ci = cr + Nv * K;
+  std::fill(b, b + K, 1.0);
+  for (size_t k = 0; k < first.size(); k++)
+  {
+    auto m = first[k];
+    a[k] = std::real(model.poles(m));
+    b[k] = std::imag(model.poles(m));
+    for (size_t n = 0; n < Nv; n++)
     {
-      auto p = poles(m);
-      if (cindex(m) == 0) // real pole
-        xt::view(Dk, xt::all(), m) = 1. / (s - p);
-      else if (cindex(m) == 1) // complex pole, 1st
-        xt::view(Dk, xt::all(), m) = 1. / (s - p) + 1. / (s - std::conj(p));
-      else if (cindex(m) == 2) // complex pole, 2nd
-        xt::view(Dk, xt::all(), m) = 1i / (s -  std::conj(p)) - 1i / (s - p);
-      else
-        throw std::runtime_error("Error: unknown cindex value.");
+      cr[n * K + k] = factor[k] * std::real(model.residues(n, m));
+      ci[n * K + k] = factor[k] * std::imag(model.residues(n, m));
     }
+  }
+  polys.assign(model.polys.begin(), model.polys.end());
+}
 
-    // Check infinite values
-    xt::filter(Dk, xt::isinf(Dk)) = TOLhigh + 0.0i;
-
-    // Polynomial terms
-    xt::view(Dk, xt::all(), N) = std::complex<double>(1.0, 0.0);
-    for (m = 1; m < Nc; m++)
-    {
-      xt::view(Dk, xt::all(), N + m) = xt::pow(s, m) + 0.0i;
-    }
 
-    // Scaling for last row of LS-problem (pole identification)
-    double scale = 0.0;
-    for (m = 0; m < Nv; m++)
-    {
-      scale += std::pow(xt::linalg::norm(xt::view(weight, m) * xt::view(f, m)),
-                        2);
-    }
-    scale = std::sqrt(scale) / Ns;
+Model::TermsCache &
+Model::TermsCache::operator=(const TermsCache &)
+{
+  delete terms_.exchange(nullptr);
+  return *this;
+}
 
-    // A matrix
-    xt::xtensor<double, 2> AA({Nv * (N + 1), N + 1}, 0.0);
-    xt::xtensor<double, 1> bb({Nv * (N + 1)}, 0.0);
-    for (n = 0; n < Nv; n++)
-    {
-      xt::xtensor<std::complex<double>, 2> A1({Ns, N + Nc + N + 1}, C_ZERO);
-      // left block
-      for (m = 0; m < N + Nc; m++)
-      {
-        xt::view(A1, xt::all(), m) = xt::view(weight, n) *
-                                     xt::view(Dk, xt::all(), m);
-      }
-      // right block
-      for (m = 0; m < N + 1; m++)
-      {
-        xt::view(A1, xt::all(), N + Nc + m) = -xt::view(weight, n) *
-                                    xt::view(Dk, xt::all(), m) * xt::view(f, n);
-      }
 
-      xt::xtensor<double, 2> A({2 * Ns + 1, N + Nc + N + 1}, 0.0);
-      xt::view(A, xt::range(0, Ns)) = xt::real(A1);
-      xt::view(A, xt::range(Ns, 2 * Ns)) = xt::imag(A1);
+Model::TermsCache::~TermsCache()
+{
+  delete terms_.load();
+}
 
-      // Integral criterion for sigma
-      if (n == Nv - 1)
-      {
-        for (m = 0; m < N + 1; m++)
-        {
-          auto d = xt::sum(xt::view(Dk, xt::all(), m))();
-          A(2 * Ns, N + Nc + m) = std::real(scale * d);
-        }
-      }
 
-      // QR decomposition
-      // Hotspots of the algorithm
-      auto QR_tuple = xt::linalg::qr(A);
-      auto R = std::get<1>(QR_tuple);
-      xt::view(AA, xt::range(n*(N+1), (n+1)*(N+1))) =
-            xt::view(R, xt::range(N+Nc, N+Nc+N+1), xt::range(N+Nc, N+Nc+N+1));
-      if (n == Nv - 1)
-      {
-        auto Q = std::get<0>(QR_tuple);
-        xt::view(bb, xt::range(n*(N+1), (n+1)*(N+1))) = Ns * scale *
-              xt::view(Q, Q.shape()[0] - 1, xt::range(N+Nc, Q.shape()[1]));
-      }
-    }
+//! Terms of model, built by the first caller
+//!
+//! Concurrent first callers may each build the terms: the first to publish
+//! them wins and the others discard theirs. Every later call is a single
+//! acquire load, without locks or reference counts.
 
-    xt::xtensor<double, 1> Escale({N + 1}, 0.0);
-    for (m = 0; m < N + 1; m++)
+const Model::Terms &
+Model::TermsCache::get(const Model &model) const
+{
+  auto t = terms_.load(std::memory_order_acquire);
+  if (t == nullptr)
+  {
+    auto built = new Terms(model);
+    if (terms_.compare_exchange_strong(t, built, std::memory_order_acq_rel,
+                                       std::memory_order_acquire))
     {
-      Escale(m) = 1.0 / xt::linalg::norm(xt::view(AA, xt::all(), m));
-      xt::view(AA, xt::all(), m) *= Escale(m);
+      t = built;
     }
-
-    auto results = xt::linalg::lstsq(AA, bb);
-    auto x = std::get<0>(results);
-    x *= Escale;
-    auto C = xt::xarray<double>(xt::view(x, xt::range(0, x.size() - 1)));
-    auto D = x(x.size() - 1);
-
-    // Situation: produced D of sigma extremely is small or large
-    // Solve again, without relaxation
-    if (std::abs(D) < TOLlow || std::abs(D) > TOLhigh)
+    else
     {
-      xt::xtensor<double, 2> AA({Nv * N, N}, 0.0);
-      xt::xtensor<double, 1> bb({Nv * N}, 0.0);
-      if (x(x.size() - 1) == 0.0)
-      {
-        D = 1.0;
-      }
-      else if (std::abs(x(x.size() - 1)) < TOLlow)
-      {
-        D = x(x.size() - 1) > 0 ? TOLlow : -TOLlow;
-      }
-      else if (std::abs(x(x.size() - 1)) > TOLhigh)
-      {
-        D = x(x.size() - 1) > 0 ? TOLhigh : -TOLhigh;
-      }
-
-      for (n = 0; n < Nv; n++)
-      {
-        xt::xtensor<std::complex<double>, 2> A1({Ns, N + Nc + N}, C_ZERO);
-        for (m = 0; m < N + Nc; m++)
-        {
-          xt::view(A1, xt::all(), m) = xt::view(weight, n) *
-                                       xt::view(Dk, xt::all(), m);
-        }
-        for (m = 0; m < N; m++)
-        {
-          xt::view(A1, xt::all(), N + Nc + m) = -xt::view(weight, n) *
-                                    xt::view(Dk, xt::all(), m) * xt::view(f, n);
-        }
-        auto A = xt::xarray<double>(xt::concatenate(xt::xtuple(xt::real(A1),
-                                                    xt::imag(A1))));
-        auto b1 = D * xt::view(weight, n) * xt::view(f, n);
-        auto b = xt::xarray<double>(xt::concatenate(xt::xtuple(xt::real(b1),
-                                                    xt::imag(b1))));
+      delete built;
+    }
+  }
+  return *t;
+}
 
-        // QR decomposition
-        auto QR_tuple = xt::linalg::qr(A);
-        auto Q = std::get<0>(QR_tuple);
-        auto R = std::get<1>(QR_tuple);
-        xt::view(AA, xt::range(n*N, (n+1)*N)) =
-            xt::view(R, xt::range(N+Nc, N+Nc+N), xt::range(N+Nc, N+Nc+N));
-        xt::view(bb, xt::range(n*N, (n+1)*N)) = xt::linalg::dot(
-            xt::transpose(xt::view(Q, xt::all(), xt::range(N+Nc, N+Nc+N))), b);
-      }
 
-      xt::xtensor<double, 1> Escale ({N}, 0.0);
-      for (m = 0; m < N; m++)
-      {
-        xt::view(Escale, m) = 1.0 / xt::linalg::norm(xt::view(AA, xt::all(), m));
-        xt::view(AA, xt::all(), m) *= Escale(m);
-      }
+//! Evaluate the pole-residue model at a single point
+//!
+//! Vectorized across the poles rather than the points: the reciprocal
+//! denominators of a block of terms go to stack arrays, then each row is
+//! a dot product reduction over the block, so that the division is done
+//! once per term for all the rows. No heap memory is allocated once the
+//! terms are built.
+//!
+//! @param t          terms of the model
+//! @param s          variable to be evaluated
+//! @param f          [out] f. dimension: (Nv)
 
-      auto results = xt::linalg::lstsq(AA, bb);
-      auto C = std::get<0>(results);
-      C *= Escale;
-    }
+void
+Model::evaluate_terms(const Terms &t, double s, double *f)
+{
+  const double *a = t.a;
+  const double *b = t.b;
+  constexpr size_t block = 64;
+  alignas(64) double u[block];
+  alignas(64) double v[block];
 
-    // We now calculate the zeros for sigma
-    xt::xtensor<double, 2> LAMBD({N, N}, 0.0);
-    xt::xtensor<double, 2> SERB({N, (size_t)1}, 1.0);
-    for (m = 0; m < N; m++)
+  // Polynomial terms by Horner's rule
+  for (size_t n = 0; n < t.Nv; n++)
+  {
+    double sum = 0.0;
+    for (size_t c = t.Nc; c-- > 0;)
     {
-      if (cindex(m) == 0) // real pole
-      {
-        LAMBD(m, m) = std::real(poles(m));
-      }
-      else if (cindex(m) == 1)
-      {
-        auto x = std::real(poles(m));
-        auto y = std::imag(poles(m));
-        LAMBD(m, m) = x;
-        LAMBD(m + 1, m + 1) = x;
-        LAMBD(m + 1, m) = -y;
-        LAMBD(m, m + 1) = y;
-        SERB(m, 1) = 2.0;
-        SERB(m + 1, 1) = 0.0;
-      }
+      sum = sum * s + t.polys[n * t.Nc + c];
     }
-
-    // Update poles
-    C.reshape({1, N});
-    auto ZER = LAMBD - xt::linalg::dot(SERB, C) / D;
-    poles = xt::linalg::eigvals(ZER);
+    f[n] = sum;
   }
 
-  //============================================================================
-  //  RESIDUE IDENTIFICATION
-  //============================================================================
-  if (!skip_res)
+  // Pole terms
+  for (size_t k0 = 0; k0 < t.K; k0 += block)
   {
-    // Finding out which poles are complex:
-    xt::xtensor<int, 1> cindex({N}, 0); // 0-real, 1-complex, 2-conjugate
-    for (m = 0; m < N; m++)
+    size_t len = std::min(block, t.K - k0);
+    #pragma omp simd aligned(a, b, u, v : 64)
+    for (size_t k = 0; k < len; k++)
+    {
+      double d = s - a[k0 + k];
+      double inv = 1.0 / (d * d + b[k0 + k] * b[k0 + k]);
+      u[k] = d * inv;
+      v[k] = b[k0 + k] * inv;
+    }
+    for (size_t n = 0; n < t.Nv; n++)
     {
-      if (std::imag(poles(m)) != 0.0)
+      const double *cr = t.cr + n * t.K + k0;
+      const double *ci = t.ci + n * t.K + k0;
+      double sum = 0.0;
+      #pragma omp simd aligned(cr, ci, u, v : 64) reduction(+ : sum)
+      for (size_t k = 0; k < len; k++)
       {
-        if ((m == 0) || ((m > 0) && (cindex(m - 1) == 0 || cindex(m - 1) == 2)))
-        {
-          if (m >= N - 1 || std::conj(poles(m)) != poles(m + 1))
-          {
-            throw std::invalid_argument("Error: complex poles are not conjugate"
-                                        " pairs.");
-          }
-          cindex(m) = 1;
-          cindex(m + 1) = 2;
-          m++;
-        }
+        sum += cr[k] * u[k] - ci[k] * v[k];
       }
+      f[n] += sum;
     }
+  }
+}
 
-    // Calculate the SER for f (new fitting), using the above calculated
-    // zeros as known poles
-    xt::xtensor<std::complex<double>, 2> Dk({Ns, N + Nc}, C_ZERO);
-    for (m = 0; m < N; m++)
-    {
-      auto p = poles(m);
+
+void
+Model::evaluate(double s, double *f) const
+{
+  evaluate_terms(terms(), s, f);
+}
+
+
+void
+Model::evaluate(const double *s, size_t Ns, double *f) const
+{
+  const auto &t = terms();
+  for (size_t i = 0; i < Ns; i++)
+  {
+    evaluate_terms(t, s[i], f + i * t.Nv);
+  }
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Multipole formalism evaluation function
+//!
+//! f(s) = REAL[residues/(s - poles)] + Polynomials(s)
+//! Note the input variable s is real and only the real part of the
+//! result f is returned.
+//!
+//! @param s          array of variables to be evaluated. dimension: (Ns)
+//! @param poles      poles. dimension: (N)
+//! @param residues   residues. dimension: (Nv, N)
+//! @param polys      curvefit (Polynomial) coefficients. dimension: (Nv, Nc)
+//! @return           f. dimension: (Nv, Ns)
+
+xt::pyarray<double>
+evaluate(xt::pyarray<double> s,
+         xt::pyarray<std::complex<double>> poles,
+         xt::pyarray<std::complex<double>> residues,
+         xt::pyarray<double> polys)
+{
+  // Check input arguments
+  if (s.dimension() != 1)
+  {
+    throw std::invalid_argument("Error: input s is not 1-dimensional.");
+  }
+  auto model = make_model(poles, residues, polys);
+
+  // Evaluate the multipole form
+  xt::pyarray<double> f = multipole(s, model.poles, model.residues,
+                                    model.polys);
+
+  // Return
+  return f;
+}
+
+
+#endif
+
+
+//! Find out which poles are complex
+//!
+//! @param poles      poles, real or complex conjugate pairs. dimension: (N)
+//! @return           cindex, 0-real, 1-complex, 2-conjugate. dimension: (N)
+
+template <class E>
+xt::xtensor<int, 1>
+find_cindex(const E &poles)
+{
+  auto N = poles.size();
+  xt::xtensor<int, 1> cindex({N}, 0);
+  for (size_t m = 0; m < N; m++)
+  {
+    if (std::imag(poles(m)) != 0.0)
+    {
+      if ((m == 0) || ((m > 0) && (cindex(m - 1) == 0 || cindex(m - 1) == 2)))
+      {
+        if (m >= N - 1 || std::conj(poles(m)) != poles(m + 1))
+        {
+          throw std::invalid_argument("Error: complex poles are not conjugate"
+                                      " pairs.");
+        }
+        cindex(m) = 1;
+        cindex(m + 1) = 2;
+        m++;
+      }
+    }
+  }
+  return cindex;
+}
+
+
+//! Real-valued basis functions of the pole-residue model
+//!
+//! Since s is real, each basis column is real: 1/(s-p) for a real pole, and
+//! 2(s-a)/|s-p|^2 and 2b/|s-p|^2 (p = a + ib) for the two columns of a
+//! complex pair. This halves the row count of the LS-problems compared with
+//! stacking the real and (identically zero) imaginary parts.
+//!
+//! @param s          vector of sample points. dimension: (Ns)
+//! @param poles      poles. dimension: (N)
+//! @param cindex     pole types from find_cindex. dimension: (N)
+//! @param Nc         number of polynomial columns s^0 ... s^(Nc-1)
+//! @return           Dk. dimension: (Ns, N + Nc)
+
+template <class E1, class E2>
+xt::xtensor<double, 2>
+real_basis(const E1 &s, const E2 &poles, const xt::xtensor<int, 1> &cindex,
+           size_t Nc)
+{
+  auto Ns = s.size();
+  auto N = poles.size();
+  xt::xtensor<double, 2> Dk({Ns, N + Nc}, 0.0);
+  for (size_t m = 0; m < N; m++)
+  {
+    auto a = std::real(poles(m));
+    auto b = std::imag(poles(m));
+    if (cindex(m) == 0) // real pole
+      xt::view(Dk, xt::all(), m) = 1. / (s - a);
+    else if (cindex(m) == 1) // complex pole, 1st
+      xt::view(Dk, xt::all(), m) = 2. * (s - a) / ((s - a) * (s - a) + b * b);
+    else if (cindex(m) == 2) // complex pole, 2nd
+      xt::view(Dk, xt::all(), m) = 2. * b / ((s - a) * (s - a) + b * b);
+    else
+      throw std::runtime_error("Error: unknown cindex value.");
+  }
+  for (size_t m = 0; m < Nc; m++)
+  {
+    xt::view(Dk, xt::all(), N + m) = xt::pow(s, m);
+  }
+  return Dk;
+}
+
+
+//! Samples of the responses to be fitted
+//!
+//! Every row (response) has its own values and weights. The rows either
+//! share a single grid of sample points (s holds one entry) or each have
+//! their own (s holds Nv entries); the basis functions are evaluated once
+//! per grid.
+
+struct Samples
+{
+  std::vector<xt::xtensor<double, 1>> s;      // sample points, 1 or Nv grids
+  std::vector<xt::xtensor<double, 1>> f;      // responses, Nv rows
+  std::vector<xt::xtensor<double, 1>> weight; // weights, Nv rows
+
+  //! Number of rows
+  size_t rows() const { return f.size(); }
+
+  //! Index of the grid of row n
+  size_t grid(size_t n) const { return s.size() == 1 ? 0 : n; }
+
+  //! Total number of samples over all rows
+  size_t total() const
+  {
+    size_t sum = 0;
+    for (const auto &fn : f) sum += fn.size();
+    return sum;
+  }
+};
+
+
+//! Groups of rows sharing both the grid and the weights
+//!
+//! The weighted basis, and so any factorization of it, is the same for all
+//! the rows of a group, e.g. the temperatures of a series fitted as rows.
+//! Rows are hashed by their weights and compared within a hash bucket.
+//!
+//! @param samples    samples to be fitted
+//! @return           rows of each group, in order of their first row
+
+std::vector<std::vector<size_t>>
+group_rows(const Samples &samples)
+{
+  std::vector<std::vector<size_t>> groups;
+  std::unordered_map<size_t, std::vector<size_t>> buckets; // hash -> groups
+  for (size_t n = 0; n < samples.rows(); n++)
+  {
+    const auto &w = samples.weight[n];
+    size_t hash = std::hash<size_t>()(samples.grid(n));
+    for (auto v : w)
+    {
+      hash ^= std::hash<double>()(v) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    auto &bucket = buckets[hash];
+    bool found = false;
+    for (auto g : bucket)
+    {
+      auto first = groups[g][0];
+      if (samples.grid(first) == samples.grid(n) && samples.weight[first] == w)
+      {
+        groups[g].push_back(n);
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+    {
+      bucket.push_back(groups.size());
+      groups.push_back({n});
+    }
+  }
+  return groups;
+}
+
+
+//! Clamp the infinite values of a basis to TOLhigh, counting them
+void
+clamp_inf(xt::xtensor<double, 2> &Dk)
+{
+  long hits = 0;
+  for (auto &v : Dk)
+  {
+    if (std::isinf(v))
+    {
+      v = TOLhigh;
+      hits++;
+    }
+  }
+  if (hits > 0)
+  {
+    counters.inf_clamps += hits;
+  }
+}
+
+
+//! Run body(i) for i in [0, n) over the threads
+//!
+//! The iterations are scheduled dynamically; the first exception thrown
+//! by body is rethrown after the loop.
+
+template <class F>
+void
+parallel_for(size_t n, F body)
+{
+  std::exception_ptr error;
+  #pragma omp parallel for schedule(dynamic) if (n > 1)
+  for (long i = 0; i < (long)n; i++)
+  {
+    try
+    {
+      body((size_t)i);
+    }
+    catch (...)
+    {
+      #pragma omp critical
+      {
+        if (!error) error = std::current_exception();
+      }
+    }
+  }
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+
+//! LS solution of A*x = b, with column scaling
+//!
+//! @param A          system matrix, scaled in place. dimension: (M, K)
+//! @param b          right-hand side. dimension: (M)
+//! @return           x. dimension: (K)
+
+xt::xtensor<double, 1>
+solve_scaled(xt::xtensor<double, 2> &A, const xt::xtensor<double, 1> &b)
+{
+  auto K = A.shape()[1];
+  xt::xtensor<double, 1> Escale({K}, 0.0);
+  for (size_t m = 0; m < K; m++)
+  {
+    Escale(m) = 1.0 / xt::linalg::norm(xt::view(A, xt::all(), m));
+    xt::view(A, xt::all(), m) *= Escale(m);
+  }
+
+  auto results = xt::linalg::lstsq(A, b);
+  if ((size_t)std::get<2>(results) < K)
+  {
+    counters.rank_deficient++;
+  }
+  xt::xtensor<double, 1> x = std::get<0>(results);
+  x *= Escale;
+  return x;
+}
+
+
+//! Poles in canonical order, as exact conjugate pairs
+//!
+//! The eigenvalues of a real matrix are conjugate pairs up to rounding, in
+//! no guaranteed order. The poles with positive and negative imaginary
+//! parts are matched by nearest conjugate (closest pairs first), each pair
+//! is symmetrized to (p, conj(p)) with p the mean of the two, and poles
+//! left without a partner are made real. Real poles and pairs are sorted
+//! by real part, so that the result always passes find_cindex.
+//!
+//! @param poles      poles, in any order. dimension: (N)
+//! @return           canonical poles. dimension: (N)
+
+xt::xtensor<std::complex<double>, 1>
+canonical_poles(const xt::xtensor<std::complex<double>, 1> &poles)
+{
+  std::vector<std::complex<double>> upper, lower, terms;
+  std::vector<bool> paired;
+  for (auto p : poles)
+  {
+    if (std::imag(p) > 0.0)
+      upper.push_back(p);
+    else if (std::imag(p) < 0.0)
+      lower.push_back(std::conj(p));
+    else
+      terms.push_back(p);
+  }
+  paired.assign(terms.size(), false);
+
+  // Match by nearest conjugate, closest pairs first
+  std::vector<std::tuple<double, size_t, size_t>> candidates;
+  for (size_t i = 0; i < upper.size(); i++)
+  {
+    for (size_t j = 0; j < lower.size(); j++)
+    {
+      candidates.emplace_back(std::abs(upper[i] - lower[j]), i, j);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+  std::vector<bool> used_upper(upper.size(), false);
+  std::vector<bool> used_lower(lower.size(), false);
+  for (const auto &c : candidates)
+  {
+    auto i = std::get<1>(c);
+    auto j = std::get<2>(c);
+    if (used_upper[i] || used_lower[j]) continue;
+    used_upper[i] = used_lower[j] = true;
+    terms.push_back(0.5 * (upper[i] + lower[j]));
+    paired.push_back(true);
+  }
+
+  // Poles without a partner become real
+  for (size_t i = 0; i < upper.size(); i++)
+  {
+    if (!used_upper[i])
+    {
+      terms.push_back(std::real(upper[i]));
+      paired.push_back(false);
+    }
+  }
+  for (size_t j = 0; j < lower.size(); j++)
+  {
+    if (!used_lower[j])
+    {
+      terms.push_back(std::real(lower[j]));
+      paired.push_back(false);
+    }
+  }
+
+  // Sort by real part and emit
+  std::vector<size_t> order(terms.size());
+  for (size_t k = 0; k < order.size(); k++) order[k] = k;
+  std::stable_sort(order.begin(), order.end(), [&terms](size_t a, size_t b) {
+    return std::real(terms[a]) < std::real(terms[b]);
+  });
+  xt::xtensor<std::complex<double>, 1> result({poles.size()}, C_ZERO);
+  size_t m = 0;
+  for (auto k : order)
+  {
+    if (paired[k])
+    {
+      result(m++) = terms[k];
+      result(m++) = std::conj(terms[k]);
+    }
+    else
+    {
+      result(m++) = std::complex<double>(std::real(terms[k]), 0.0);
+    }
+  }
+  return result;
+}
+
+
+//! Zeros of sigma, the relocated poles
+//!
+//! @param poles      poles of sigma. dimension: (N)
+//! @param cindex     pole types from find_cindex. dimension: (N)
+//! @param C          real-basis residues of sigma. dimension: (N)
+//! @param D          constant term of sigma
+//! @return           zeros of sigma, canonical_poles ordered. dimension: (N)
+
+xt::xtensor<std::complex<double>, 1>
+sigma_zeros(const xt::xtensor<std::complex<double>, 1> &poles,
+            const xt::xtensor<int, 1> &cindex,
+            const xt::xtensor<double, 1> &C, double D)
+{
+  auto N = poles.size();
+  size_t m;
+
+  // We now calculate the zeros for sigma
+  xt::xtensor<double, 2> LAMBD({N, N}, 0.0);
+  xt::xtensor<double, 2> SERB({N, (size_t)1}, 1.0);
+  for (m = 0; m < N; m++)
+  {
+    if (cindex(m) == 0) // real pole
+    {
+      LAMBD(m, m) = std::real(poles(m));
+    }
+    else if (cindex(m) == 1)
+    {
+      auto x = std::real(poles(m));
+      auto y = std::imag(poles(m));
+      LAMBD(m, m) = x;
+      LAMBD(m + 1, m + 1) = x;
+      LAMBD(m + 1, m) = -y;
+      LAMBD(m, m + 1) = y;
+      SERB(m, 0) = 2.0;
+      SERB(m + 1, 0) = 0.0;
+    }
+  }
+
+  // Update poles
+  xt::xtensor<double, 2> CT({(size_t)1, N}, 0.0);
+  xt::view(CT, 0) = C;
+  auto ZER = LAMBD - xt::linalg::dot(SERB, CT) / D;
+  xt::xtensor<std::complex<double>, 1> new_poles = xt::linalg::eigvals(ZER);
+  return canonical_poles(new_poles);
+}
+
+
+//! Constraint stage of the pole update
+//!
+//! Relocated poles sometimes land far outside the sampled band, or so close
+//! to the real axis, where the samples are, that the next basis is ill
+//! conditioned. With [lo, hi] the range of the sample points and W = hi - lo,
+//! the real part of a pole is clamped to [lo - margin*W, hi + margin*W], the
+//! imaginary part of a pair is lifted to at least min_imag*W, and a real
+//! pole inside [lo, hi] is moved just outside the nearest edge.
+//!
+//! @param samples    samples giving the band
+//! @param poles      relocated poles, canonical_poles ordered. dimension: (N)
+//! @param margin     extension of the band on each side, relative to W
+//! @param min_imag   smallest distance from the axis, relative to W, > 0
+//! @return           constrained poles, canonical_poles ordered. (N)
+
+xt::xtensor<std::complex<double>, 1>
+constrain_poles(const Samples &samples,
+                const xt::xtensor<std::complex<double>, 1> &poles,
+                double margin, double min_imag)
+{
+  double lo = INFINITY;
+  double hi = -INFINITY;
+  for (const auto &s : samples.s)
+  {
+    lo = std::min(lo, xt::amin(s)());
+    hi = std::max(hi, xt::amax(s)());
+  }
+  double width = std::max(hi - lo, std::abs(hi) * 1e-8);
+  double left = lo - margin * width;
+  double right = hi + margin * width;
+  double dist = min_imag * width;
+
+  auto cindex = find_cindex(poles);
+  xt::xtensor<std::complex<double>, 1> result = poles;
+  long lifted = 0, relocated = 0;
+  for (size_t m = 0; m < poles.size(); m++)
+  {
+    auto x = std::real(poles(m));
+    auto y = std::imag(poles(m));
+    if (cindex(m) == 0)
+    {
+      if (x >= lo && x <= hi)
+      {
+        x = x - lo < hi - x ? lo - dist : hi + dist;
+        lifted++;
+      }
+    }
+    else if (cindex(m) == 1)
+    {
+      if (std::abs(y) < dist)
+      {
+        y = y < 0.0 ? -dist : dist;
+        lifted++;
+      }
+    }
+    else
+    {
+      continue;
+    }
+    if (x < left || x > right)
+    {
+      x = std::min(std::max(x, left), right);
+      relocated++;
+    }
+    result(m) = std::complex<double>(x, y);
+    if (cindex(m) == 1) result(m + 1) = std::conj(result(m));
+  }
+  counters.poles_lifted += lifted;
+  counters.poles_relocated += relocated;
+  return lifted + relocated > 0 ? canonical_poles(result) : result;
+}
+
+
+//! Weighted LS solution of Dk*x = f, with column scaling
+//!
+//! @param Dk         basis functions. dimension: (Ns, K)
+//! @param w          weights of the samples. dimension: (Ns)
+//! @param f          samples. dimension: (Ns)
+//! @return           x. dimension: (K)
+
+xt::xtensor<double, 1>
+solve_weighted(const xt::xtensor<double, 2> &Dk,
+               const xt::xtensor<double, 1> &w,
+               const xt::xtensor<double, 1> &f)
+{
+  auto Ns = Dk.shape()[0];
+  auto K = Dk.shape()[1];
+  size_t m;
+
+  xt::xtensor<double, 2> A({Ns, K}, 0.0);
+  for (m = 0; m < K; m++)
+  {
+    xt::view(A, xt::all(), m) = w * xt::view(Dk, xt::all(), m);
+  }
+  xt::xtensor<double, 1> b = w * f;
+  return solve_scaled(A, b);
+}
+
+
+//! Weighted LS solutions of Dk*X = F sharing the weights, with column
+//! scaling and a single factorization for all the right-hand sides
+//!
+//! @param Dk         basis functions. dimension: (Ns, K)
+//! @param w          weights of the samples. dimension: (Ns)
+//! @param F          samples, one column per right-hand side. (Ns, R)
+//! @return           X. dimension: (K, R)
+
+xt::xtensor<double, 2>
+solve_weighted(const xt::xtensor<double, 2> &Dk,
+               const xt::xtensor<double, 1> &w,
+               const xt::xtensor<double, 2> &F)
+{
+  auto Ns = Dk.shape()[0];
+  auto K = Dk.shape()[1];
+  size_t m;
+
+  xt::xtensor<double, 2> A({Ns, K}, 0.0);
+  xt::xtensor<double, 1> Escale({K}, 0.0);
+  for (m = 0; m < K; m++)
+  {
+    xt::view(A, xt::all(), m) = w * xt::view(Dk, xt::all(), m);
+    Escale(m) = 1.0 / xt::linalg::norm(xt::view(A, xt::all(), m));
+    xt::view(A, xt::all(), m) *= Escale(m);
+  }
+  xt::xtensor<double, 2> B = xt::view(w, xt::all(), xt::newaxis()) * F;
+
+  auto results = xt::linalg::lstsq(A, B);
+  if ((size_t)std::get<2>(results) < K)
+  {
+    counters.rank_deficient++;
+  }
+  xt::xtensor<double, 2> X = std::get<0>(results);
+  X *= xt::view(Escale, xt::all(), xt::newaxis());
+  return X;
+}
+
+
+//! Basis functions of the pole identification step, one per grid
+//!
+//! Has N + max(Nc, 1) columns, the constant one being needed by sigma even
+//! without polynomial terms, and its infinite values clamped.
+//!
+//! @param samples    samples to be fitted
+//! @param poles      poles, real or complex conjugate pairs. (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @return           basis of each grid. dimension: (Ns, N + max(Nc, 1))
+
+std::vector<xt::xtensor<double, 2>>
+pole_basis(const Samples &samples,
+           const xt::xtensor<std::complex<double>, 1> &poles,
+           size_t Nc)
+{
+  auto cindex = find_cindex(poles);
+  std::vector<xt::xtensor<double, 2>> Dk;
+  for (const auto &s : samples.s)
+  {
+    Dk.push_back(real_basis(s, poles, cindex, std::max(Nc, (size_t)1)));
+
+    // Check infinite values
+    clamp_inf(Dk.back());
+  }
+  return Dk;
+}
+
+
+//! Pole identification step of vector fitting
+//!
+//! Relocates the poles as the zeros of sigma, which is identified with the
+//! relaxed non-triviality constraint [2] by the QR-based fast solver [3].
+//!
+//! @param samples    samples to be fitted
+//! @param poles      starting poles, real or complex conjugate pairs. (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @param basis      pole_basis of the poles, if already built
+//! @return           relocated poles. dimension: (N)
+
+xt::xtensor<std::complex<double>, 1>
+identify_poles(const Samples &samples,
+               const xt::xtensor<std::complex<double>, 1> &poles,
+               size_t Nc,
+               const std::vector<xt::xtensor<double, 2>> *basis = nullptr)
+{
+  auto Nv = samples.rows();
+  auto N = poles.size();
+  size_t m, n;
+
+  // Finding out which starting poles are complex
+  auto cindex = find_cindex(poles);
+
+  // Building system - matrixes, one per grid
+  std::vector<xt::xtensor<double, 2>> built;
+  if (basis == nullptr)
+  {
+    built = pole_basis(samples, poles, Nc);
+    basis = &built;
+  }
+  const auto &Dk = *basis;
+
+  // Scaling for last row of LS-problem (pole identification)
+  // The integral criterion is appended to the last row, on its own grid
+  double scale = 0.0;
+  for (n = 0; n < Nv; n++)
+  {
+    scale += std::pow(xt::linalg::norm(samples.weight[n] * samples.f[n]), 2);
+  }
+  scale = std::sqrt(scale) / samples.f[Nv - 1].size();
+
+  // Rows sharing the grid and the weights share the weighted left block;
+  // its orthonormal basis Q1 is factored once per group, after which the
+  // right block of each row only needs to be projected out of it
+  auto groups = group_rows(samples);
+  std::vector<xt::xtensor<double, 2>> Q1(groups.size());
+  std::vector<size_t> group_of(Nv);
+  for (size_t g = 0; g < groups.size(); g++)
+  {
+    for (auto r : groups[g]) group_of[r] = g;
+  }
+  parallel_for(groups.size(), [&](size_t g) {
+    const auto &Dn = Dk[samples.grid(groups[g][0])];
+    const auto &w = samples.weight[groups[g][0]];
+    auto Ns = w.size();
+    if (groups[g].size() < 2 || Ns < N + Nc || N + Nc == 0) return;
+    xt::xtensor<double, 2> L({Ns, N + Nc}, 0.0);
+    for (size_t m = 0; m < N + Nc; m++)
+    {
+      xt::view(L, xt::all(), m) = w * xt::view(Dn, xt::all(), m);
+    }
+    Q1[g] = std::get<0>(xt::linalg::qr(L));
+  });
+
+  // A matrix
+  xt::xtensor<double, 2> AA({Nv * (N + 1), N + 1}, 0.0);
+  xt::xtensor<double, 1> bb({Nv * (N + 1)}, 0.0);
+  parallel_for(Nv, [&](size_t n) {
+    size_t m;
+    const auto &Dn = Dk[samples.grid(n)];
+    const auto &w = samples.weight[n];
+    const auto &fn = samples.f[n];
+    auto Ns = fn.size();
+
+    const auto &Q = Q1[group_of[n]];
+    if (Q.size() > 0)
+    {
+      // Right block, with the criterion row, minus its projection on Q1
+      // (twice, to keep the orthogonality); the left block is zero on the
+      // criterion row, so that the projection leaves it alone
+      size_t rows = std::max(Ns + 1, N + 1);
+      xt::xtensor<double, 2> X({rows, N + 1}, 0.0);
+      for (m = 0; m < N + 1; m++)
+      {
+        xt::view(X, xt::range(0, Ns), m) = -w * xt::view(Dn, xt::all(), m) *
+                                           fn;
+        if (n == Nv - 1)
+        {
+          X(Ns, m) = scale * xt::sum(xt::view(Dn, xt::all(), m))();
+        }
+      }
+      for (int pass = 0; pass < 2; pass++)
+      {
+        auto Xs = xt::view(X, xt::range(0, Ns));
+        xt::xtensor<double, 2> P = xt::linalg::dot(xt::transpose(Q), Xs);
+        Xs -= xt::linalg::dot(Q, P);
+      }
+      auto QR_tuple = xt::linalg::qr(X);
+      xt::view(AA, xt::range(n*(N+1), (n+1)*(N+1))) = std::get<1>(QR_tuple);
+      if (n == Nv - 1)
+      {
+        xt::view(bb, xt::range(n*(N+1), (n+1)*(N+1))) = Ns * scale *
+              xt::view(std::get<0>(QR_tuple), Ns);
+      }
+      return;
+    }
+
+    // Row Ns holds the integral criterion for sigma; rows beyond it are zero
+    // padding which keeps R square when Ns is small
+    size_t rows = std::max(Ns + 1, N + Nc + N + 1);
+    xt::xtensor<double, 2> A({rows, N + Nc + N + 1}, 0.0);
+    // left block
+    for (m = 0; m < N + Nc; m++)
+    {
+      xt::view(A, xt::range(0, Ns), m) = w * xt::view(Dn, xt::all(), m);
+    }
+    // right block
+    for (m = 0; m < N + 1; m++)
+    {
+      xt::view(A, xt::range(0, Ns), N + Nc + m) = -w *
+                                              xt::view(Dn, xt::all(), m) * fn;
+    }
+
+    // Integral criterion for sigma
+    if (n == Nv - 1)
+    {
+      for (m = 0; m < N + 1; m++)
+      {
+        A(Ns, N + Nc + m) = scale * xt::sum(xt::view(Dn, xt::all(), m))();
+      }
+    }
+
+    // QR decomposition
+    // Hotspots of the algorithm
+    auto QR_tuple = xt::linalg::qr(A);
+    auto R = std::get<1>(QR_tuple);
+    xt::view(AA, xt::range(n*(N+1), (n+1)*(N+1))) =
+          xt::view(R, xt::range(N+Nc, N+Nc+N+1), xt::range(N+Nc, N+Nc+N+1));
+    if (n == Nv - 1)
+    {
+      auto Q = std::get<0>(QR_tuple);
+      xt::view(bb, xt::range(n*(N+1), (n+1)*(N+1))) = Ns * scale *
+            xt::view(Q, Ns, xt::range(N+Nc, N+Nc+N+1));
+    }
+  });
+
+  auto x = solve_scaled(AA, bb);
+  xt::xtensor<double, 1> C = xt::view(x, xt::range(0, x.size() - 1));
+  auto D = x(x.size() - 1);
+
+  // Situation: produced D of sigma extremely is small or large
+  // Solve again, without relaxation
+  if (std::abs(D) < TOLlow || std::abs(D) > TOLhigh)
+  {
+    counters.tol_fallbacks++;
+    xt::xtensor<double, 2> AA({Nv * N, N}, 0.0);
+    xt::xtensor<double, 1> bb({Nv * N}, 0.0);
+    if (x(x.size() - 1) == 0.0)
+    {
+      D = 1.0;
+    }
+    else if (std::abs(x(x.size() - 1)) < TOLlow)
+    {
+      D = x(x.size() - 1) > 0 ? TOLlow : -TOLlow;
+    }
+    else if (std::abs(x(x.size() - 1)) > TOLhigh)
+    {
+      D = x(x.size() - 1) > 0 ? TOLhigh : -TOLhigh;
+    }
+
+    for (n = 0; n < Nv; n++)
+    {
+      const auto &Dn = Dk[samples.grid(n)];
+      const auto &w = samples.weight[n];
+      const auto &fn = samples.f[n];
+      auto Ns = fn.size();
+
+      size_t rows = std::max(Ns, N + Nc + N);
+      xt::xtensor<double, 2> A({rows, N + Nc + N}, 0.0);
+      for (m = 0; m < N + Nc; m++)
+      {
+        xt::view(A, xt::range(0, Ns), m) = w * xt::view(Dn, xt::all(), m);
+      }
+      for (m = 0; m < N; m++)
+      {
+        xt::view(A, xt::range(0, Ns), N + Nc + m) = -w *
+                                              xt::view(Dn, xt::all(), m) * fn;
+      }
+      xt::xtensor<double, 1> b({rows}, 0.0);
+      xt::view(b, xt::range(0, Ns)) = D * w * fn;
+
+      // QR decomposition
+      auto QR_tuple = xt::linalg::qr(A);
+      auto Q = std::get<0>(QR_tuple);
+      auto R = std::get<1>(QR_tuple);
+      xt::view(AA, xt::range(n*N, (n+1)*N)) =
+          xt::view(R, xt::range(N+Nc, N+Nc+N), xt::range(N+Nc, N+Nc+N));
+      xt::view(bb, xt::range(n*N, (n+1)*N)) = xt::linalg::dot(
+          xt::transpose(xt::view(Q, xt::all(), xt::range(N+Nc, N+Nc+N))), b);
+    }
+
+    C = solve_scaled(AA, bb);
+  }
+
+  return sigma_zeros(poles, cindex, C, D);
+}
+
+
+//! Complex residues from the coefficients of the real-valued basis
+//!
+//! @param Cr         coefficients of the pole columns. dimension: (Nv, N)
+//! @param cindex     pole types from find_cindex. dimension: (N)
+//! @return           residues. dimension: (Nv, N)
+
+xt::xtensor<std::complex<double>, 2>
+complex_residues(const xt::xtensor<double, 2> &Cr,
+                 const xt::xtensor<int, 1> &cindex)
+{
+  auto Nv = Cr.shape()[0];
+  auto N = Cr.shape()[1];
+  xt::xtensor<std::complex<double>, 2> residues({Nv, N}, C_ZERO);
+  for (size_t m = 0; m < N; m++)
+  {
+    if (cindex(m) == 0)
+    {
+      for (size_t n = 0; n < Nv; n++)
+      {
+        residues(n, m) = std::complex<double>(Cr(n, m));
+      }
+    }
+    else if (cindex(m) == 1)
+    {
+      for (size_t n = 0; n < Nv; n++)
+      {
+        auto r1 = Cr(n, m);
+        auto r2 = Cr(n, m + 1);
+        residues(n, m) = r1 + 1i * r2;
+        residues(n, m + 1) = r1 - 1i * r2;
+      }
+    }
+  }
+  return residues;
+}
+
+
+//! Residue identification step of vector fitting
+//!
+//! Calculates the residues and polynomial coefficients of every row with the
+//! poles known, and the fit on the sample points.
+//!
+//! @param samples    samples to be fitted
+//! @param poles      known poles, real or complex conjugate pairs. (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @param residues   [out] residues. dimension: (Nv, N)
+//! @param polys      [out] curvefit (Polynomial) coefficients. (Nv, Nc)
+//! @param fit        [out] fitted signals on the sample points of each row
+//! @param n_minimax  number of Lawson iterations towards the minimax fit
+//! @param basis      pole_basis of the poles, if already built
+//! @return           RMS error between f and fit over all samples
+
+double
+identify_residues(const Samples &samples,
+                  const xt::xtensor<std::complex<double>, 1> &poles,
+                  size_t Nc,
+                  xt::xtensor<std::complex<double>, 2> &residues,
+                  xt::xtensor<double, 2> &polys,
+                  std::vector<xt::xtensor<double, 1>> &fit,
+                  int n_minimax = 0,
+                  const std::vector<xt::xtensor<double, 2>> *basis = nullptr)
+{
+  auto Nv = samples.rows();
+  auto N = poles.size();
+  size_t n;
+
+  // Finding out which poles are complex:
+  auto cindex = find_cindex(poles);
+
+  // Calculate the SER for f (new fitting), using the above calculated
+  // zeros as known poles. The basis of the pole step has a constant column
+  // even without polynomial terms, which is left out.
+  std::vector<xt::xtensor<double, 2>> Dk;
+  for (size_t k = 0; k < samples.s.size(); k++)
+  {
+    if (basis == nullptr)
+    {
+      Dk.push_back(real_basis(samples.s[k], poles, cindex, Nc));
+    }
+    else
+    {
+      Dk.emplace_back(xt::view((*basis)[k], xt::all(), xt::range(0, N + Nc)));
+    }
+  }
+
+  residues = xt::zeros<std::complex<double>>({Nv, N});
+  polys = xt::zeros<double>({Nv, Nc});
+  xt::xtensor<double, 2> Cr({Nv, N}, 0.0);
+
+  // Rows sharing the grid and the weights are solved together from one
+  // factorization, unless the weights are refined row by row
+  if (n_minimax == 0)
+  {
+    auto groups = group_rows(samples);
+    parallel_for(groups.size(), [&](size_t g) {
+      const auto &rows = groups[g];
+      const auto &Dn = Dk[samples.grid(rows[0])];
+      const auto &w = samples.weight[rows[0]];
+      xt::xtensor<double, 2> F({w.size(), rows.size()}, 0.0);
+      for (size_t j = 0; j < rows.size(); j++)
+      {
+        xt::view(F, xt::all(), j) = samples.f[rows[j]];
+      }
+      auto X = solve_weighted(Dn, w, F);
+      for (size_t j = 0; j < rows.size(); j++)
+      {
+        xt::view(Cr, rows[j]) = xt::view(X, xt::range(0, N), j);
+        if (Nc > 0)
+        {
+          xt::view(polys, rows[j]) = xt::view(X, xt::range(N, N + Nc), j);
+        }
+      }
+    });
+  }
+  else
+  {
+    parallel_for(Nv, [&](size_t n) {
+      const auto &Dn = Dk[samples.grid(n)];
+      const auto &w = samples.weight[n];
+      const auto &fn = samples.f[n];
+      auto x = solve_weighted(Dn, w, fn);
+
+      // Minimax refinement by Lawson's iteratively reweighted LS. The poles
+      // are fixed, so the basis is reused and only the sample weights change;
+      // the iterate with the smallest maximum weighted error is kept.
+      if (n_minimax > 0)
+      {
+        xt::xtensor<double, 1> err = xt::abs(w * (xt::linalg::dot(Dn, x) -
+                                                  fn));
+        double best = xt::amax(err)();
+        xt::xtensor<double, 1> lambda = xt::ones<double>({fn.size()});
+        for (int it = 0; it < n_minimax; it++)
+        {
+          lambda *= err;
+          double total = xt::sum(lambda)();
+          if (!(total > 0.0))
+          {
+            break;
+          }
+          lambda /= total;
+          lambda = xt::maximum(lambda, 1e-12 * xt::amax(lambda)());
+          xt::xtensor<double, 1> wl = w * xt::sqrt(lambda);
+          auto y = solve_weighted(Dn, wl, fn);
+          err = xt::abs(w * (xt::linalg::dot(Dn, y) - fn));
+          double e = xt::amax(err)();
+          if (e < best)
+          {
+            best = e;
+            x = y;
+          }
+        }
+      }
+
+      xt::view(Cr, n) = xt::view(x, xt::range(0, N));
+
+      if (Nc > 0)
+      {
+        xt::view(polys, n) = xt::view(x, xt::range(N, N + Nc));
+      }
+    });
+  }
+
+  // Get complex residues
+  residues = complex_residues(Cr, cindex);
+
+  // Calculate fit on s
+  fit.resize(Nv);
+  if (samples.s.size() == 1)
+  {
+    auto fit_all = multipole(samples.s[0], poles, residues, polys);
+    for (n = 0; n < Nv; n++)
+    {
+      fit[n] = xt::view(fit_all, n);
+    }
+  }
+  else
+  {
+    for (n = 0; n < Nv; n++)
+    {
+      fit[n] = xt::view(multipole(samples.s[n], poles,
+                                  xt::view(residues, xt::range(n, n + 1)),
+                                  xt::view(polys, xt::range(n, n + 1))), 0);
+    }
+  }
+
+  // RMS error
+  double sum = 0.0;
+  for (n = 0; n < Nv; n++)
+  {
+    sum += xt::sum(xt::square(fit[n] - samples.f[n]))();
+  }
+  return std::sqrt(sum / samples.total());
+}
+
+
+//! Samples on a common grid from arrays
+//!
+//! @param f          function (vector) to be fitted. dimension: (Nv, Ns)
+//! @param s          vector of sample points. dimension: (Ns)
+//! @param weight     weights of f. dimension: (Nv, Ns)
+//! @return           samples with all the rows on the grid s
+
+template <class E1, class E2>
+Samples
+make_samples(const E1 &f, const E2 &s, const E1 &weight)
+{
+  // Check input arguments
+  if (f.dimension() != 2)
+  {
+    throw std::invalid_argument("Error: input f is not 2-dimensional.");
+  }
+  auto Nv = f.shape()[0];
+  auto Ns = f.shape()[1];
+  if (s.dimension() != 1)
+  {
+    throw std::invalid_argument("Error: input s is not 1-dimensional.");
+  }
+  if (Ns != s.size())
+  {
+    throw std::invalid_argument("Error: 2nd dimension of f does not match the "
+                                "length of s.");
+  }
+  if (f.shape() != weight.shape())
+  {
+    throw std::invalid_argument("Error: shape of weight does not match shape of"
+                                " f.");
+  }
+
+  // All the rows share the grid s
+  Samples samples;
+  samples.s.emplace_back(s);
+  for (size_t n = 0; n < Nv; n++)
+  {
+    samples.f.emplace_back(xt::view(f, n));
+    samples.weight.emplace_back(xt::view(weight, n));
+  }
+  return samples;
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Store relocated poles in the poles argument of vectfit
+//!
+//! The argument is updated in place, except when it is read-only, e.g. the
+//! poles of a Model, in which case it is replaced by a new array.
+//!
+//! @param poles      [in,out] poles argument. dimension: (N)
+//! @param p          relocated poles. dimension: (N)
+
+void
+store_poles(xt::pyarray<std::complex<double>> &poles,
+            const xt::xtensor<std::complex<double>, 1> &p)
+{
+  if (poles.attr("flags").attr("writeable").cast<bool>())
+  {
+    poles = p;
+  }
+  else
+  {
+    poles = xt::pyarray<std::complex<double>>(p);
+  }
+}
+
+
+//! Fast Relaxed Vector Fitting function
+//!
+//! Approximate f(s) with a rational function:
+//!         f(s)=R*(s*I-A)^(-1) + Polynomials*s
+//! where f(s) is a vector of elements.
+//! When f(s) is a vector, all elements become fitted with a common pole set.
+//! The identification is done using the pole relocating method known as Vector
+//! Fitting [1] with relaxed non-triviality constraint for faster convergence
+//! and smaller fitting errors [2], and utilization of matrix structure for fast
+//! solution of the pole identifion step [3].
+//! [1] B. Gustavsen and A. Semlyen, "Rational approximation of frequency
+//!     domain responses by Vector Fitting", IEEE Trans. Power Delivery,
+//!     vol. 14, no. 3, pp. 1052-1061, July 1999.
+//! [2] B. Gustavsen, "Improving the pole relocating properties of vector
+//!     fitting", IEEE Trans. Power Delivery, vol. 21, no. 3, pp. 1587-1592,
+//!     July 2006.
+//! [3] D. Deschrijver, M. Mrozowski, T. Dhaene, and D. De Zutter,
+//!     "Macromodeling of Multiport Systems Using a Fast Implementation of
+//!     the Vector Fitting Method", IEEE Microwave and Wireless Components
+//!     Letters, vol. 18, no. 6, pp. 383-385, June 2008.
+//! All credit goes to Bjorn Gustavsen for his MATLAB implementation.
+//! (http://www.sintef.no/Projectweb/VECTFIT/)
+//!
+//! @param f          function (vector) to be fitted. dimension: (Nv, Ns)
+//! @param s          vector of sample points. dimension: (Ns)
+//! @param poles      vector of initial poles. dimension: (N)
+//! @param weight     the system matrix is weighted using this array
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param skip_pole  if the pole identification part is skipped
+//! @param skip_res   if the residue identification part is skipped
+//! @param n_minimax  number of Lawson iterations towards the minimax fit
+//! @param constrain  if the relocated poles go through constrain_poles
+//! @param margin     band extension of constrain_poles, relative to its width
+//! @param min_imag   distance from the axis of constrain_poles, relative
+//! @return           Tuple(poles, residues, polys, fit, rmserr)
+
+std::tuple<xt::pyarray<std::complex<double>>,
+           xt::pyarray<std::complex<double>>,
+           xt::pyarray<double>,
+           xt::pyarray<double>,
+           double>
+vectfit(xt::pyarray<double> &f,
+        xt::pyarray<double> &s,
+        xt::pyarray<std::complex<double>> &poles,
+        xt::pyarray<double> &weight,
+        int n_polys,
+        bool skip_pole,
+        bool skip_res,
+        int n_minimax,
+        bool constrain,
+        double margin,
+        double min_imag)
+{
+  // Check input arguments
+  auto samples = make_samples(f, s, weight);
+  auto Nv = samples.rows();
+  auto Ns = s.size();
+  auto N = poles.size();
+  size_t Nc = (size_t)n_polys;
+  if (n_polys < 0 || Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_minimax < 0)
+  {
+    throw std::invalid_argument("Error: input n_minimax is negative.");
+  }
+  if (margin < 0.0 || min_imag <= 0.0)
+  {
+    throw std::invalid_argument("Error: input margin is negative or "
+                                "min_imag is not positive.");
+  }
+
+  // Initialize arrays
+  xt::pyarray<std::complex<double>> residues({Nv, N}, C_ZERO); // residues (R)
+  xt::pyarray<double> polys({Nv, Nc}, 0.0); // polynomial coefficients (P)
+  xt::pyarray<double> fit({Nv, Ns}, 0.0); // fitted signals on s
+  double rmserr = 0.0; // RMS error between f and fit
+
+  // If 0 poles and 0 cf order, return
+  if (N == 0 && Nc == 0)
+  {
+    rmserr = xt::linalg::norm(f) / std::sqrt(Nv * Ns);
+    return std::make_tuple(poles, residues, polys, fit, rmserr);
+  }
+
+  xt::xtensor<std::complex<double>, 1> p = poles;
+
+  // Pole identification
+  if (!skip_pole && N > 0)
+  {
+    p = identify_poles(samples, p, Nc);
+    if (constrain) p = constrain_poles(samples, p, margin, min_imag);
+    store_poles(poles, p);
+  }
+
+  // Residue identification
+  if (!skip_res)
+  {
+    xt::xtensor<std::complex<double>, 2> R;
+    xt::xtensor<double, 2> P;
+    std::vector<xt::xtensor<double, 1>> F;
+    rmserr = identify_residues(samples, p, Nc, R, P, F, n_minimax);
+    residues = R;
+    polys = P;
+    for (size_t n = 0; n < Nv; n++)
+    {
+      xt::view(fit, n) = F[n];
+    }
+  }
+
+  // Return a tuple including the updated results
+  return std::make_tuple(poles, residues, polys, fit, rmserr);
+}
+
+
+//! Fast Relaxed Vector Fitting on ragged sample grids
+//!
+//! Same as vectfit, except that every response has its own sample points
+//! and weights, while all of them are fitted with a common pole set. The
+//! LS-problems of each row are built on its own grid.
+//!
+//! @param f          responses to be fitted. Nv arrays of dimension (Ns_n)
+//! @param s          sample points of each response. Nv arrays (Ns_n)
+//! @param poles      vector of initial poles. dimension: (N)
+//! @param weight     weights of each response. Nv arrays (Ns_n)
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param skip_pole  if the pole identification part is skipped
+//! @param skip_res   if the residue identification part is skipped
+//! @param n_minimax  number of Lawson iterations towards the minimax fit
+//! @param constrain  if the relocated poles go through constrain_poles
+//! @param margin     band extension of constrain_poles, relative to its width
+//! @param min_imag   distance from the axis of constrain_poles, relative
+//! @return           Tuple(poles, residues, polys, fit, rmserr)
+
+std::tuple<xt::pyarray<std::complex<double>>,
+           xt::pyarray<std::complex<double>>,
+           xt::pyarray<double>,
+           std::vector<xt::pyarray<double>>,
+           double>
+vectfit_ragged(std::vector<xt::pyarray<double>> &f,
+               std::vector<xt::pyarray<double>> &s,
+               xt::pyarray<std::complex<double>> &poles,
+               std::vector<xt::pyarray<double>> &weight,
+               int n_polys,
+               bool skip_pole,
+               bool skip_res,
+               int n_minimax,
+               bool constrain,
+               double margin,
+               double min_imag)
+{
+  // Check input arguments
+  auto Nv = f.size();
+  if (Nv == 0)
+  {
+    throw std::invalid_argument("Error: input f is empty.");
+  }
+  if (s.size() != Nv || weight.size() != Nv)
+  {
+    throw std::invalid_argument("Error: lengths of f, s and weight do not "
+                                "match.");
+  }
+  for (size_t n = 0; n < Nv; n++)
+  {
+    if (f[n].dimension() != 1 || s[n].dimension() != 1 ||
+        weight[n].dimension() != 1)
+    {
+      throw std::invalid_argument("Error: input f, s or weight is not a list "
+                                  "of 1-dimensional arrays.");
+    }
+    if (f[n].size() != s[n].size() || weight[n].size() != s[n].size())
+    {
+      throw std::invalid_argument("Error: length of f or weight does not "
+                                  "match the length of s.");
+    }
+    if (s[n].size() == 0)
+    {
+      throw std::invalid_argument("Error: input s has an empty grid.");
+    }
+  }
+  auto N = poles.size();
+  size_t Nc = (size_t)n_polys;
+  if (n_polys < 0 || Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_minimax < 0)
+  {
+    throw std::invalid_argument("Error: input n_minimax is negative.");
+  }
+  if (margin < 0.0 || min_imag <= 0.0)
+  {
+    throw std::invalid_argument("Error: input margin is negative or "
+                                "min_imag is not positive.");
+  }
+
+  // Rows on their own grids
+  Samples samples;
+  for (size_t n = 0; n < Nv; n++)
+  {
+    samples.s.emplace_back(s[n]);
+    samples.f.emplace_back(f[n]);
+    samples.weight.emplace_back(weight[n]);
+  }
+  xt::xtensor<std::complex<double>, 1> p = poles;
+
+  // Initialize arrays
+  xt::pyarray<std::complex<double>> residues({Nv, N}, C_ZERO); // residues (R)
+  xt::pyarray<double> polys({Nv, Nc}, 0.0); // polynomial coefficients (P)
+  std::vector<xt::pyarray<double>> fit; // fitted signals on each s
+  for (size_t n = 0; n < Nv; n++)
+  {
+    fit.emplace_back(xt::zeros<double>({s[n].size()}));
+  }
+  double rmserr = 0.0; // RMS error between f and fit
+
+  // If 0 poles and 0 cf order, return
+  if (N == 0 && Nc == 0)
+  {
+    double sum = 0.0;
+    for (size_t n = 0; n < Nv; n++)
+    {
+      sum += xt::sum(xt::square(samples.f[n]))();
+    }
+    rmserr = std::sqrt(sum / samples.total());
+    return std::make_tuple(poles, residues, polys, fit, rmserr);
+  }
+
+  // Pole identification
+  if (!skip_pole && N > 0)
+  {
+    p = identify_poles(samples, p, Nc);
+    if (constrain) p = constrain_poles(samples, p, margin, min_imag);
+    store_poles(poles, p);
+  }
+
+  // Residue identification
+  if (!skip_res)
+  {
+    xt::xtensor<std::complex<double>, 2> R;
+    xt::xtensor<double, 2> P;
+    std::vector<xt::xtensor<double, 1>> F;
+    rmserr = identify_residues(samples, p, Nc, R, P, F, n_minimax);
+    residues = R;
+    polys = P;
+    for (size_t n = 0; n < Nv; n++)
+    {
+      fit[n] = F[n];
+    }
+  }
+
+  // Return a tuple including the updated results
+  return std::make_tuple(poles, residues, polys, fit, rmserr);
+}
+
+
+#endif
+
+
+FitState::FitState(const Model &model, const xt::xtensor<double, 1> &s,
+                   const xt::xtensor<double, 2> &f,
+                   const xt::xtensor<double, 2> &w)
+  : model_(model), s_(s), f_(f), w_(w)
+{
+  auto Nv = model.residues.shape()[0];
+  if (f.shape()[0] != Nv || f.shape()[1] != s.size())
+  {
+    throw std::invalid_argument("Error: shape of f does not match the model "
+                                "and s.");
+  }
+  if (w.shape() != f.shape())
+  {
+    throw std::invalid_argument("Error: shape of weight does not match shape "
+                                "of f.");
+  }
+  find_cindex(model.poles);
+  refresh();
+}
+
+
+void
+FitState::refresh()
+{
+  fit_ = model_.evaluate(s_);
+  sum2_ = xt::sum(xt::square(fit_ - f_))();
+  max_error_ = xt::amax(xt::abs(w_ * (fit_ - f_)))();
+}
+
+
+double
+FitState::rmserr() const
+{
+  return std::sqrt(sum2_ / f_.size());
+}
+
+
+std::pair<size_t, size_t>
+FitState::term(size_t m) const
+{
+  auto N = model_.poles.size();
+  if (m >= N)
+  {
+    throw std::invalid_argument("Error: pole index is out of range.");
+  }
+  auto cindex = find_cindex(model_.poles);
+  if (cindex(m) == 0) return {m, 1};
+  if (cindex(m) == 1) return {m, 2};
+  return {m - 1, 2};
+}
+
+
+void
+FitState::apply(std::complex<double> old_pole,
+                const xt::xtensor<std::complex<double>, 1> &old_residues,
+                double old_factor, std::complex<double> new_pole,
+                const xt::xtensor<std::complex<double>, 1> &new_residues,
+                double new_factor)
+{
+  auto Nv = f_.shape()[0];
+  auto Ns = s_.size();
+  double a0 = std::real(old_pole), b0 = std::imag(old_pole);
+  double a1 = std::real(new_pole), b1 = std::imag(new_pole);
+  double sum2 = 0.0;
+  double max_error = 0.0;
+  for (size_t n = 0; n < Nv; n++)
+  {
+    double r0 = old_factor * std::real(old_residues(n));
+    double i0 = old_factor * std::imag(old_residues(n));
+    double r1 = new_factor * std::real(new_residues(n));
+    double i1 = new_factor * std::imag(new_residues(n));
+    for (size_t k = 0; k < Ns; k++)
+    {
+      // Re[r/(s-p)] = (Re r (s-a) - Im r b) / ((s-a)^2 + b^2)
+      double d0 = s_(k) - a0;
+      double d1 = s_(k) - a1;
+      double old_term = old_factor == 0.0 ? 0.0 :
+                        (r0 * d0 - i0 * b0) / (d0 * d0 + b0 * b0);
+      double new_term = new_factor == 0.0 ? 0.0 :
+                        (r1 * d1 - i1 * b1) / (d1 * d1 + b1 * b1);
+      fit_(n, k) += new_term - old_term;
+      double e = fit_(n, k) - f_(n, k);
+      sum2 += e * e;
+      max_error = std::max(max_error, std::abs(w_(n, k) * e));
+    }
+  }
+  sum2_ = sum2;
+  max_error_ = max_error;
+}
+
+
+//! Replace the real pole or conjugate pair at m
+//!
+//! A real pole must be replaced by a real pole and a pair by a pair, given
+//! by either of its poles; the residues are those of the given pole.
+//!
+//! @param m          index of the pole, or of either pole of the pair
+//! @param pole       new pole
+//! @param residues   residues of the new pole. dimension: (Nv)
+
+void
+FitState::set_pole(size_t m, std::complex<double> pole,
+                   const xt::xtensor<std::complex<double>, 1> &residues)
+{
+  auto Nv = f_.shape()[0];
+  if (residues.size() != Nv)
+  {
+    throw std::invalid_argument("Error: size of residues does not match the "
+                                "number of rows.");
+  }
+  auto t = term(m);
+  if ((t.second == 2) != (std::imag(pole) != 0.0))
+  {
+    throw std::invalid_argument("Error: a real pole must be replaced by a "
+                                "real pole and a pair by a complex pole.");
+  }
+  auto first = t.first;
+  xt::xtensor<std::complex<double>, 1> old_residues =
+                                   xt::view(model_.residues, xt::all(), first);
+  xt::xtensor<std::complex<double>, 1> new_residues = residues;
+  if (t.second == 2 && std::imag(pole) < 0.0)
+  {
+    pole = std::conj(pole);
+    new_residues = xt::conj(residues);
+  }
+  apply(model_.poles(first), old_residues, (double)t.second, pole,
+        new_residues, (double)t.second);
+
+  // A new model, without the single-point layout of the old one
+  Model model;
+  model.poles = model_.poles;
+  model.residues = model_.residues;
+  model.polys = model_.polys;
+  model.poles(first) = pole;
+  xt::view(model.residues, xt::all(), first) = new_residues;
+  if (t.second == 2)
+  {
+    model.poles(first + 1) = std::conj(pole);
+    xt::view(model.residues, xt::all(), first + 1) = xt::conj(new_residues);
+  }
+  model_ = model;
+}
+
+
+//! Append a real pole or conjugate pair
+//!
+//! @param pole       new pole, complex for a pair (p, conj(p))
+//! @param residues   residues of the new pole. dimension: (Nv)
+
+void
+FitState::add_pole(std::complex<double> pole,
+                   const xt::xtensor<std::complex<double>, 1> &residues)
+{
+  auto Nv = f_.shape()[0];
+  auto N = model_.poles.size();
+  if (residues.size() != Nv)
+  {
+    throw std::invalid_argument("Error: size of residues does not match the "
+                                "number of rows.");
+  }
+  bool pair = std::imag(pole) != 0.0;
+  xt::xtensor<std::complex<double>, 1> new_residues = residues;
+  if (pair && std::imag(pole) < 0.0)
+  {
+    pole = std::conj(pole);
+    new_residues = xt::conj(residues);
+  }
+  apply(C_ZERO, new_residues, 0.0, pole, new_residues, pair ? 2.0 : 1.0);
+
+  auto Nt = N + (pair ? 2 : 1);
+  Model model;
+  model.poles = xt::zeros<std::complex<double>>({Nt});
+  model.residues = xt::zeros<std::complex<double>>({Nv, Nt});
+  model.polys = model_.polys;
+  xt::view(model.poles, xt::range(0, N)) = model_.poles;
+  xt::view(model.residues, xt::all(), xt::range(0, N)) = model_.residues;
+  model.poles(N) = pole;
+  xt::view(model.residues, xt::all(), N) = new_residues;
+  if (pair)
+  {
+    model.poles(N + 1) = std::conj(pole);
+    xt::view(model.residues, xt::all(), N + 1) = xt::conj(new_residues);
+  }
+  model_ = model;
+}
+
+
+//! Remove the real pole or conjugate pair at m
+//!
+//! @param m          index of the pole, or of either pole of the pair
+
+void
+FitState::remove_pole(size_t m)
+{
+  auto Nv = f_.shape()[0];
+  auto N = model_.poles.size();
+  auto t = term(m);
+  auto first = t.first;
+  xt::xtensor<std::complex<double>, 1> old_residues =
+                                   xt::view(model_.residues, xt::all(), first);
+  apply(model_.poles(first), old_residues, (double)t.second, C_ZERO,
+        old_residues, 0.0);
+
+  auto Nt = N - t.second;
+  Model model;
+  model.poles = xt::zeros<std::complex<double>>({Nt});
+  model.residues = xt::zeros<std::complex<double>>({Nv, Nt});
+  model.polys = model_.polys;
+  for (size_t i = 0, j = 0; i < N; i++)
+  {
+    if (i >= first && i < first + t.second) continue;
+    model.poles(j) = model_.poles(i);
+    xt::view(model.residues, xt::all(), j) =
+                                        xt::view(model_.residues, xt::all(), i);
+    j++;
+  }
+  model_ = model;
+}
+
+
+//! Add the row x to the upper triangular R by Givens rotations
+//!
+//! @param R          [in/out] upper triangular factor. dimension: (K, K)
+//! @param x          [in/out] new row, destroyed. dimension: (K)
+
+void
+givens_update(xt::xtensor<double, 2> &R, std::vector<double> &x)
+{
+  auto K = R.shape()[0];
+  for (size_t k = 0; k < K; k++)
+  {
+    if (x[k] == 0.0) continue;
+    double r = std::hypot(R(k, k), x[k]);
+    double c = R(k, k) / r;
+    double s = x[k] / r;
+    R(k, k) = r;
+    for (size_t j = k + 1; j < K; j++)
+    {
+      double t = c * R(k, j) + s * x[j];
+      x[j] = c * x[j] - s * R(k, j);
+      R(k, j) = t;
+    }
+  }
+}
+
+
+OnlineFit::OnlineFit(const xt::xtensor<std::complex<double>, 1> &poles,
+                     size_t Nv, size_t Nc, double forgetting, size_t window,
+                     size_t relocate_every)
+  : poles_(poles), cindex_(find_cindex(poles)), Nv_(Nv), Nc_(Nc),
+    forgetting_(forgetting), window_(window), relocate_every_(relocate_every)
+{
+  if (Nv < 1)
+  {
+    throw std::invalid_argument("Error: input Nv is less than 1.");
+  }
+  if (Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (!(forgetting > 0.0 && forgetting <= 1.0))
+  {
+    throw std::invalid_argument("Error: input forgetting is not in (0, 1].");
+  }
+  auto K = 2 * poles.size() + Nc + 1;
+  if (window < K)
+  {
+    throw std::invalid_argument("Error: input window is smaller than the "
+                                "number of unknowns.");
+  }
+  reset();
+}
+
+
+void
+OnlineFit::reset()
+{
+  auto N = poles_.size();
+  auto K = 2 * N + Nc_ + 1;
+  pole_factors_.assign(Nv_, xt::zeros<double>({K + 1, K + 1}));
+  residue_factors_.assign(Nv_, xt::zeros<double>({N + Nc_ + 1, N + Nc_ + 1}));
+  colsum_.assign(N + 1, 0.0);
+  weight_sum_ = 0.0;
+  norm2_ = 0.0;
+}
+
+
+void
+OnlineFit::add(const Sample &sample)
+{
+  auto N = poles_.size();
+  auto K = 2 * N + Nc_ + 1;
+  double lambda = forgetting_;
+  double decay = std::sqrt(lambda);
+
+  // Basis at s, with the constant column of sigma
+  xt::xtensor<double, 1> s({1}, sample.s);
+  auto Dk = real_basis(s, poles_, cindex_, std::max(Nc_, (size_t)1));
+  clamp_inf(Dk);
+
+  // Integral criterion sums
+  for (size_t m = 0; m < N + 1; m++)
+  {
+    colsum_[m] = lambda * colsum_[m] + Dk(0, m);
+  }
+  weight_sum_ = lambda * weight_sum_ + 1.0;
+  norm2_ *= lambda;
+
+  std::vector<double> x;
+  for (size_t n = 0; n < Nv_; n++)
+  {
+    double w = sample.w[n];
+    double f = sample.f[n];
+    norm2_ += (w * f) * (w * f);
+
+    // Pole identification: [w Dk | -w Dk f | 0]
+    pole_factors_[n] *= decay;
+    x.assign(K + 1, 0.0);
+    for (size_t m = 0; m < N + Nc_; m++) x[m] = w * Dk(0, m);
+    for (size_t m = 0; m < N + 1; m++) x[N + Nc_ + m] = -w * Dk(0, m) * f;
+    givens_update(pole_factors_[n], x);
+
+    // Residue identification: [w Dk | w f]
+    residue_factors_[n] *= decay;
+    x.assign(N + Nc_ + 1, 0.0);
+    for (size_t m = 0; m < N + Nc_; m++) x[m] = w * Dk(0, m);
+    x[N + Nc_] = w * f;
+    givens_update(residue_factors_[n], x);
+  }
+}
+
+
+//! Add a sample of all the rows
+//!
+//! @param s          sample point
+//! @param f          samples of the rows. dimension: (Nv)
+//! @param w          weights of the samples. dimension: (Nv)
+
+void
+OnlineFit::update(double s, const double *f, const double *w)
+{
+  Sample sample {s, std::vector<double>(f, f + Nv_),
+                 std::vector<double>(w, w + Nv_)};
+  add(sample);
+  buffer_.push_back(std::move(sample));
+  if (buffer_.size() > window_)
+  {
+    buffer_.pop_front();
+  }
+  count_++;
+
+  if (relocate_every_ > 0 && ++since_ >= relocate_every_)
+  {
+    relocate();
+  }
+}
+
+
+//! Relocate the poles from the factors
+//!
+//! Solves the system of identify_poles from the triangular factors, the
+//! integral criterion row being rotated into a copy of the last row's
+//! factor. The non-relaxed fallback moves the constant column of sigma to
+//! the right-hand side within the same factors. The factors are then
+//! rebuilt on the new poles from the buffered samples.
+//!
+//! @return           false if fewer samples than unknowns are buffered
+
+bool
+OnlineFit::relocate()
+{
+  auto N = poles_.size();
+  auto Nc = Nc_;
+  auto K = 2 * N + Nc + 1;
+  since_ = 0;
+  if (N == 0 || buffer_.size() < K)
+  {
+    return false;
+  }
+
+  // Factor of the last row with the integral criterion
+  double scale = std::sqrt(norm2_) / weight_sum_;
+  xt::xtensor<double, 2> last = pole_factors_[Nv_ - 1];
+  std::vector<double> x(K + 1, 0.0);
+  for (size_t m = 0; m < N + 1; m++) x[N + Nc + m] = scale * colsum_[m];
+  x[K] = weight_sum_ * scale;
+  givens_update(last, x);
+
+  xt::xtensor<double, 2> AA({Nv_ * (N + 1), N + 1}, 0.0);
+  xt::xtensor<double, 1> bb({Nv_ * (N + 1)}, 0.0);
+  for (size_t n = 0; n < Nv_; n++)
+  {
+    const auto &R = n == Nv_ - 1 ? last : pole_factors_[n];
+    xt::view(AA, xt::range(n*(N+1), (n+1)*(N+1))) =
+                         xt::view(R, xt::range(N+Nc, K), xt::range(N+Nc, K));
+  }
+  xt::view(bb, xt::range((Nv_-1)*(N+1), Nv_*(N+1))) =
+                         xt::view(last, xt::range(N+Nc, K), K);
+  auto sol = solve_scaled(AA, bb);
+  xt::xtensor<double, 1> C = xt::view(sol, xt::range(0, N));
+  double D = sol(N);
+
+  // Situation: produced D of sigma extremely is small or large
+  // Solve again, without relaxation
+  if (std::abs(D) < TOLlow || std::abs(D) > TOLhigh)
+  {
+    counters.tol_fallbacks++;
+    if (D == 0.0)
+      D = 1.0;
+    else if (std::abs(D) < TOLlow)
+      D = D > 0 ? TOLlow : -TOLlow;
+    else
+      D = D > 0 ? TOLhigh : -TOLhigh;
+
+    xt::xtensor<double, 2> AA({Nv_ * N, N}, 0.0);
+    xt::xtensor<double, 1> bb({Nv_ * N}, 0.0);
+    for (size_t n = 0; n < Nv_; n++)
+    {
+      const auto &R = pole_factors_[n];
+      xt::view(AA, xt::range(n*N, (n+1)*N)) =
+                     xt::view(R, xt::range(N+Nc, K-1), xt::range(N+Nc, K-1));
+      xt::view(bb, xt::range(n*N, (n+1)*N)) =
+                     -D * xt::view(R, xt::range(N+Nc, K-1), K-1);
+    }
+    C = solve_scaled(AA, bb);
+  }
+
+  poles_ = sigma_zeros(poles_, cindex_, C, D);
+  cindex_ = find_cindex(poles_);
+
+  // Rebuild the factors on the new poles
+  reset();
+  for (const auto &sample : buffer_)
+  {
+    add(sample);
+  }
+  return true;
+}
+
+
+//! Current model, the residues solved from the factors
+Model
+OnlineFit::model() const
+{
+  auto N = poles_.size();
+  auto K = N + Nc_;
+  xt::xtensor<double, 2> X({Nv_, K}, 0.0);
+  for (size_t n = 0; n < Nv_; n++)
+  {
+    const auto &R = residue_factors_[n];
+    xt::xtensor<double, 2> RR = xt::view(R, xt::range(0, K), xt::range(0, K));
+    xt::xtensor<double, 1> b = xt::view(R, xt::range(0, K), K);
+    auto results = xt::linalg::lstsq(RR, b);
+    xt::view(X, n) = std::get<0>(results);
+  }
+
+  Model model;
+  model.poles = poles_;
+  xt::xtensor<double, 2> Cr = xt::view(X, xt::all(), xt::range(0, N));
+  model.residues = complex_residues(Cr, cindex_);
+  model.polys = xt::view(X, xt::all(), xt::range(N, K));
+  return model;
+}
+
+
+//! Vector fitting iterations on samples sharing one grid
+//!
+//! Relocates the poles n_iter times and identifies the residues on the final
+//! poles, which is what n_iter successive vectfit calls return.
+//!
+//! With rtol, the iterations stop early once the RMS error changes by less
+//! than rtol (relative) from one set of poles to the next. The residue step
+//! of the poles of an iteration and the pole step which relocates them both
+//! depend only on these poles, so they share one basis. Outside of parallel
+//! regions they run concurrently, in two OpenMP sections splitting the
+//! threads between their nested row loops, and the relocated poles are
+//! discarded when the residue step tells that the iterations have
+//! converged; in a parallel region, where the threads are all busy, the pole
+//! step only runs if they have not. The first iteration has nothing to
+//! compare with, so at least one relocation is done.
+//!
+//! @param samples    samples to be fitted, on a common grid
+//! @param poles      initial poles. dimension: (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @param n_iter     (maximum) number of pole relocations
+//! @param rtol       relative change of the RMS error to stop at, 0 for none
+//! @return           fitted model, fit and RMS error
+
+FitResult
+fit_samples(const Samples &samples,
+            const xt::xtensor<std::complex<double>, 1> &poles,
+            size_t Nc,
+            int n_iter,
+            double rtol = 0.0)
+{
+  auto Nv = samples.rows();
+  auto Ns = samples.s[0].size();
+  auto N = poles.size();
+
+  FitResult result;
+  result.model.poles = poles;
+  result.model.residues = xt::zeros<std::complex<double>>({Nv, N});
+  result.model.polys = xt::zeros<double>({Nv, Nc});
+  result.fit = xt::zeros<double>({Nv, Ns});
+
+  // If 0 poles and 0 cf order, return
+  if (N == 0 && Nc == 0)
+  {
+    double sum = 0.0;
+    for (const auto &fn : samples.f)
+    {
+      sum += xt::sum(xt::square(fn))();
+    }
+    result.rmserr = std::sqrt(sum / samples.total());
+    return result;
+  }
+
+  // Residue step of the result poles, on their basis if given
+  auto residue_step = [&samples, Nc, Nv](
+      FitResult &r, const std::vector<xt::xtensor<double, 2>> *basis) {
+    std::vector<xt::xtensor<double, 1>> F;
+    r.rmserr = identify_residues(samples, r.model.poles, Nc, r.model.residues,
+                                 r.model.polys, F, 0, basis);
+    for (size_t n = 0; n < Nv; n++)
+    {
+      xt::view(r.fit, n) = F[n];
+    }
+  };
+
+  // The residue step runs beside the pole step only with threads to spare:
+  // in the parallel loop of a batch, every thread already fits a problem.
+  // The two steps then get one nested level and half of the threads each,
+  // so that their row loops still use all the threads
+#ifdef _OPENMP
+  bool overlap = !omp_in_parallel() && omp_get_max_threads() > 1;
+  int threads = omp_get_max_threads();
+  int levels = omp_get_max_active_levels();
+#else
+  bool overlap = false;
+#endif
+  double previous = INFINITY;
+  for (int it = 0; it < n_iter && N > 0; it++)
+  {
+    if (rtol <= 0.0)
+    {
+      result.model.poles = identify_poles(samples, result.model.poles, Nc);
+      continue;
+    }
+    auto basis = pole_basis(samples, result.model.poles, Nc);
+    xt::xtensor<std::complex<double>, 1> relocated;
+    if (overlap)
+    {
+      std::exception_ptr error;
+#ifdef _OPENMP
+      omp_set_max_active_levels(std::max(levels, 2));
+#endif
+      #pragma omp parallel sections num_threads(2)
+      {
+        #pragma omp section
+        {
+#ifdef _OPENMP
+          omp_set_num_threads(threads / 2);
+#endif
+          try
+          {
+            residue_step(result, &basis);
+          }
+          catch (...)
+          {
+            #pragma omp critical
+            {
+              if (!error) error = std::current_exception();
+            }
+          }
+        }
+        #pragma omp section
+        {
+#ifdef _OPENMP
+          omp_set_num_threads(threads - threads / 2);
+#endif
+          try
+          {
+            relocated = identify_poles(samples, result.model.poles, Nc,
+                                       &basis);
+          }
+          catch (...)
+          {
+            #pragma omp critical
+            {
+              if (!error) error = std::current_exception();
+            }
+          }
+        }
+      }
+#ifdef _OPENMP
+      omp_set_max_active_levels(levels);
+#endif
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+    }
+    else
+    {
+      residue_step(result, &basis);
+    }
+    if (it > 0 && std::abs(previous - result.rmserr) <= rtol * previous)
+    {
+      return result;
+    }
+    previous = result.rmserr;
+    result.model.poles = overlap ? relocated :
+        identify_poles(samples, result.model.poles, Nc, &basis);
+  }
+
+  residue_step(result, nullptr);
+  return result;
+}
+
+
+//! Number of threads of the parallel regions
+int
+num_threads()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+
+//! Check the options of the multi-iteration fits
+//!
+//! @param n_polys    number of curvefit (Polynomial) coefficients
+//! @param n_iter     (maximum) number of pole relocations
+//! @param rtol       relative change of the RMS error to stop at
+
+void
+check_options(int n_polys, int n_iter, double rtol)
+{
+  if (n_polys < 0 || n_polys > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_iter < 0)
+  {
+    throw std::invalid_argument("Error: input n_iter is negative.");
+  }
+  if (rtol < 0.0)
+  {
+    throw std::invalid_argument("Error: input rtol is negative.");
+  }
+}
+
+
+//! Fit the problems [first, last) of a batch in parallel
+//!
+//! The problems are scheduled dynamically over the threads since their costs
+//! differ widely. The message of the first failure is kept in error. Once
+//! *stop is set, the problems not started yet are skipped.
+
+void
+fit_range(const std::vector<Samples> &samples,
+          const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+          size_t Nc,
+          int n_iter,
+          double rtol,
+          long first,
+          long last,
+          std::vector<FitResult> &results,
+          std::vector<char> &done,
+          std::string &error,
+          const std::atomic<bool> *stop = nullptr)
+{
+  #pragma omp parallel for schedule(dynamic)
+  for (long i = first; i < last; i++)
+  {
+    if (stop != nullptr && stop->load(std::memory_order_relaxed))
+    {
+      continue;
+    }
+    try
+    {
+      results[i] = fit_samples(samples[i], poles[i], Nc, n_iter, rtol);
+      done[i] = 1;
+    }
+    catch (const std::exception &e)
+    {
+      #pragma omp critical
+      {
+        if (error.empty())
+        {
+          error = std::string(e.what()) + " (problem " + std::to_string(i) +
+                  ")";
+        }
+      }
+    }
+  }
+}
+
+
+#ifdef VECTFIT_MPI
+//! Number of MPI ranks, initializing MPI unless the application already did
+int
+mpi_size()
+{
+  int initialized, provided;
+  MPI_Initialized(&initialized);
+  if (!initialized)
+  {
+    MPI_Init_thread(nullptr, nullptr, MPI_THREAD_FUNNELED, &provided);
+    std::atexit([]() {
+      int finalized;
+      MPI_Finalized(&finalized);
+      if (!finalized) MPI_Finalize();
+    });
+  }
+  else
+  {
+    MPI_Query_thread(&provided);
+  }
+
+  // MPI is called from the main thread, with OpenMP threads running
+  if (provided < MPI_THREAD_FUNNELED)
+  {
+    throw std::runtime_error("Error: the MPI library does not support "
+                             "MPI_THREAD_FUNNELED.");
+  }
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  return size;
+}
+
+
+//! Fit a batch of problems over the MPI ranks
+//!
+//! Every rank holds all the inputs. Chunks of problems are claimed through a
+//! counter of problems on rank 0 incremented by one-sided fetch-and-add, so
+//! that faster ranks take more chunks, and each chunk is fitted by the
+//! threads of the claiming rank, the chunk size being its number of threads.
+//! The results are gathered on rank 0, in rounds bounded by the int counts
+//! of MPI_Gatherv.
+//!
+//! The inputs of the whole batch are thus in the memory of every node and
+//! its models in that of rank 0: a library larger than one node is fitted in
+//! several batches, each balanced over all the ranks.
+
+void
+fit_batch_mpi(const std::vector<Samples> &samples,
+              const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+              size_t Nc,
+              int n_iter,
+              double rtol,
+              std::vector<FitResult> &results,
+              std::vector<char> &done,
+              std::string &error)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  long Np = samples.size();
+  long chunk = num_threads();
+
+  // Shared counter of the claimed problems
+  long *counter = nullptr;
+  MPI_Win win;
+  MPI_Win_allocate(rank == 0 ? sizeof(long) : 0, sizeof(long), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &counter, &win);
+  if (rank == 0)
+  {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+    *counter = 0;
+    MPI_Win_unlock(0, win);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // Claim and fit chunks until none is left; the ranks may have different
+  // chunk sizes, so that the counter counts problems
+  std::vector<long> mine;
+  while (true)
+  {
+    long first;
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+    MPI_Fetch_and_op(&chunk, &first, MPI_LONG, 0, 0, MPI_SUM, win);
+    MPI_Win_unlock(0, win);
+    if (first >= Np) break;
+    long last = std::min(Np, first + chunk);
+    fit_range(samples, poles, Nc, n_iter, rtol, first, last, results, done,
+              error);
+    for (long i = first; i < last; i++)
+    {
+      if (done[i]) mine.push_back(i);
+    }
+  }
+  MPI_Win_free(&win);
+
+  // A failure on any rank fails the batch on all of them
+  int failed = error.empty() ? 0 : 1;
+  MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (failed)
+  {
+    if (error.empty()) error = "Error: fitting failed on another MPI rank.";
+    return;
+  }
+
+  // Pack the results of this rank; the shapes are known from the inputs
+  std::vector<double> buffer;
+  for (auto i : mine)
+  {
+    const auto &r = results[i];
+    for (auto p : r.model.poles)
+    {
+      buffer.push_back(std::real(p));
+      buffer.push_back(std::imag(p));
+    }
+    for (auto c : r.model.residues)
+    {
+      buffer.push_back(std::real(c));
+      buffer.push_back(std::imag(c));
+    }
+    buffer.insert(buffer.end(), r.model.polys.begin(), r.model.polys.end());
+    buffer.insert(buffer.end(), r.fit.begin(), r.fit.end());
+    buffer.push_back(r.rmserr);
+  }
+
+  // Gather on rank 0. The packed fits of a large batch can exceed the int
+  // counts of MPI_Gatherv, so they are gathered in rounds of at most block
+  // values per rank, each round fitting in int counts and displacements
+  int count = mine.size();
+  long length = buffer.size();
+  std::vector<int> counts(size);
+  std::vector<long> lengths(size);
+  MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gather(&length, 1, MPI_LONG, lengths.data(), 1, MPI_LONG, 0,
+             MPI_COMM_WORLD);
+  std::vector<int> count_displs(size, 0);
+  std::vector<long> length_displs(size, 0);
+  for (int r = 1; r < size; r++)
+  {
+    count_displs[r] = count_displs[r - 1] + counts[r - 1];
+    length_displs[r] = length_displs[r - 1] + lengths[r - 1];
+  }
+  std::vector<long> all_mine;
+  std::vector<double> all_buffer;
+  if (rank == 0)
+  {
+    all_mine.resize(count_displs[size - 1] + counts[size - 1]);
+    all_buffer.resize(length_displs[size - 1] + lengths[size - 1]);
+  }
+  MPI_Gatherv(mine.data(), count, MPI_LONG, all_mine.data(), counts.data(),
+              count_displs.data(), MPI_LONG, 0, MPI_COMM_WORLD);
+
+  const long block = INT_MAX / size;
+  long rounds = (length + block - 1) / block;
+  MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+  std::vector<int> round_lengths(size, 0), round_displs(size, 0);
+  std::vector<double> round_buffer;
+  for (long k = 0; k < rounds; k++)
+  {
+    long first = std::min(length, k * block);
+    int n = (int)(std::min(length, first + block) - first);
+    if (rank == 0)
+    {
+      for (int r = 0; r < size; r++)
+      {
+        long left = std::max(0L, lengths[r] - k * block);
+        round_lengths[r] = (int)std::min(left, block);
+        if (r > 0)
+        {
+          round_displs[r] = round_displs[r - 1] + round_lengths[r - 1];
+        }
+      }
+      round_buffer.resize(round_displs[size - 1] + round_lengths[size - 1]);
+    }
+    MPI_Gatherv(buffer.data() + first, n, MPI_DOUBLE, round_buffer.data(),
+                round_lengths.data(), round_displs.data(), MPI_DOUBLE, 0,
+                MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+      for (int r = 0; r < size; r++)
+      {
+        std::copy(round_buffer.begin() + round_displs[r],
+                  round_buffer.begin() + round_displs[r] + round_lengths[r],
+                  all_buffer.begin() + length_displs[r] + k * block);
+      }
+    }
+  }
+
+  // Unpack on rank 0
+  if (rank == 0)
+  {
+    auto it = all_buffer.begin();
+    for (auto i : all_mine)
+    {
+      auto Nv = samples[i].rows();
+      auto Ns = samples[i].s[0].size();
+      auto N = poles[i].size();
+      auto &r = results[i];
+      r.model.poles = xt::zeros<std::complex<double>>({N});
+      r.model.residues = xt::zeros<std::complex<double>>({Nv, N});
+      r.model.polys = xt::zeros<double>({Nv, Nc});
+      r.fit = xt::zeros<double>({Nv, Ns});
+      for (auto &p : r.model.poles)
+      {
+        p = std::complex<double>(*it, *(it + 1));
+        it += 2;
+      }
+      for (auto &c : r.model.residues)
+      {
+        c = std::complex<double>(*it, *(it + 1));
+        it += 2;
+      }
+      for (auto &c : r.model.polys) c = *it++;
+      for (auto &c : r.fit) c = *it++;
+      r.rmserr = *it++;
+      done[i] = 1;
+    }
+  }
+}
+#endif
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Fast Relaxed Vector Fitting of a batch of independent problems
+//!
+//! Every problem (e.g. an energy window) has its own samples, grid and
+//! initial poles, and is fitted with n_iter pole relocations followed by
+//! the residue identification. The problems are fitted in parallel by the
+//! threads of the process, and, when built with MPI and run on several
+//! ranks, distributed over the ranks with dynamic load balancing.
+//!
+//! @param f          functions to be fitted. Np arrays (Nv_i, Ns_i)
+//! @param s          sample points of each problem. Np arrays (Ns_i)
+//! @param poles      initial poles of each problem. Np arrays (N_i)
+//! @param weight     weights of each problem. Np arrays (Nv_i, Ns_i)
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param n_iter     (maximum) number of pole relocations of each problem
+//! @param rtol       relative change of the RMS error at which a problem
+//!                   stops iterating, 0 to always relocate n_iter times
+//! @return           list of Tuple(poles, residues, polys, fit, rmserr), with
+//!                   None for the problems fitted on other MPI ranks
+
+py::list
+vectfit_batch(std::vector<xt::pyarray<double>> &f,
+              std::vector<xt::pyarray<double>> &s,
+              std::vector<xt::pyarray<std::complex<double>>> &poles,
+              std::vector<xt::pyarray<double>> &weight,
+              int n_polys,
+              int n_iter,
+              double rtol)
+{
+  // Check input arguments
+  auto Np = f.size();
+  if (s.size() != Np || poles.size() != Np || weight.size() != Np)
+  {
+    throw std::invalid_argument("Error: lengths of f, s, poles and weight do "
+                                "not match.");
+  }
+  check_options(n_polys, n_iter, rtol);
+  size_t Nc = (size_t)n_polys;
+
+  // Convert the inputs while holding the GIL
+  std::vector<Samples> samples;
+  std::vector<xt::xtensor<std::complex<double>, 1>> p;
+  for (size_t i = 0; i < Np; i++)
+  {
+    samples.push_back(make_samples(f[i], s[i], weight[i]));
+    p.emplace_back(poles[i]);
+  }
+
+  // Fit
+  std::vector<FitResult> results(Np);
+  std::vector<char> done(Np, 0);
+  std::string error;
+  {
+    py::gil_scoped_release release;
+#ifdef VECTFIT_MPI
+    if (mpi_size() > 1)
+    {
+      fit_batch_mpi(samples, p, Nc, n_iter, rtol, results, done, error);
+    }
+    else
+#endif
+    {
+      fit_range(samples, p, Nc, n_iter, rtol, 0, Np, results, done, error);
+    }
+  }
+  if (!error.empty())
+  {
+    throw std::runtime_error(error);
+  }
+
+  // Return the results
+  py::list out;
+  for (size_t i = 0; i < Np; i++)
+  {
+    if (done[i])
+    {
+      const auto &r = results[i];
+      out.append(py::make_tuple(
+          xt::pyarray<std::complex<double>>(r.model.poles),
+          xt::pyarray<std::complex<double>>(r.model.residues),
+          xt::pyarray<double>(r.model.polys),
+          xt::pyarray<double>(r.fit),
+          r.rmserr));
+    }
+    else
+    {
+      out.append(py::none());
+    }
+  }
+  return out;
+}
+
+
+#endif
+
+
+//! Vector fitting of one problem, from C++
+//!
+//! The fit vectfit_batch returns for one problem, on xtensor arguments so
+//! that C++ applications run it without Python objects nor the GIL.
+//!
+//! @param f          function (vector) to be fitted. dimension: (Nv, Ns)
+//! @param s          vector of sample points. dimension: (Ns)
+//! @param poles      initial poles. dimension: (N)
+//! @param weight     weights of f. dimension: (Nv, Ns)
+//! @param n_polys    number of curvefit (Polynomial) coefficients
+//! @param n_iter     (maximum) number of pole relocations
+//! @param rtol       relative change of the RMS error to stop at, 0 for none
+//! @return           fitted model, fit and RMS error
+
+FitResult
+fit(const xt::xtensor<double, 2> &f,
+    const xt::xtensor<double, 1> &s,
+    const xt::xtensor<std::complex<double>, 1> &poles,
+    const xt::xtensor<double, 2> &weight,
+    int n_polys,
+    int n_iter,
+    double rtol)
+{
+  check_options(n_polys, n_iter, rtol);
+  return fit_samples(make_samples(f, s, weight), poles, (size_t)n_polys,
+                     n_iter, rtol);
+}
+
+
+//! Vector fitting of a batch of independent problems, from C++
+//!
+//! The fits of vectfit_batch, on xtensor arguments and on the threads of
+//! this process only. Setting *stop, from any thread, cancels the problems
+//! not started yet, whose results are left default-constructed.
+//!
+//! @param f          functions to be fitted, (Nv, Ns) each. (Np)
+//! @param s          sample points, (Ns) each. (Np)
+//! @param poles      initial poles, (N) each. (Np)
+//! @param weight     weights of f, (Nv, Ns) each. (Np)
+//! @param n_polys    number of curvefit (Polynomial) coefficients
+//! @param n_iter     (maximum) number of pole relocations
+//! @param rtol       relative change of the RMS error to stop at, 0 for none
+//! @param stop       cancellation flag, or nullptr
+//! @return           fitted model, fit and RMS error of each problem
+
+std::vector<FitResult>
+fit_batch(const std::vector<xt::xtensor<double, 2>> &f,
+          const std::vector<xt::xtensor<double, 1>> &s,
+          const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+          const std::vector<xt::xtensor<double, 2>> &weight,
+          int n_polys,
+          int n_iter,
+          double rtol,
+          const std::atomic<bool> *stop)
+{
+  // Check input arguments
+  auto Np = f.size();
+  if (s.size() != Np || poles.size() != Np || weight.size() != Np)
+  {
+    throw std::invalid_argument("Error: lengths of f, s, poles and weight do "
+                                "not match.");
+  }
+  check_options(n_polys, n_iter, rtol);
+
+  std::vector<Samples> samples;
+  for (size_t i = 0; i < Np; i++)
+  {
+    samples.push_back(make_samples(f[i], s[i], weight[i]));
+  }
+  std::vector<FitResult> results(Np);
+  std::vector<char> done(Np, 0);
+  std::string error;
+  fit_range(samples, poles, (size_t)n_polys, n_iter, rtol, 0, Np, results,
+            done, error, stop);
+  if (!error.empty())
+  {
+    throw std::runtime_error(error);
+  }
+  return results;
+}
+
+
+// Number of tiny problems fitted side by side, one per SIMD lane
+constexpr size_t LANES = 8;
+
+
+//! Householder QR of the (M, C) matrices of all the lanes, in place
+//!
+//! The matrices are stored as A(i, j, lane), so that every step is a loop
+//! over the lanes. R is left in the upper triangle of A, zeros below it,
+//! and the reflections are applied to the R columns of B as well, giving
+//! Q^T B.
+//!
+//! @param A          matrices, row-major. dimension: (M, C, LANES)
+//! @param M          number of rows, at least C
+//! @param C          number of columns
+//! @param B          right-hand sides. dimension: (M, R, LANES)
+//! @param R          number of right-hand sides
+
+void
+lane_qr(std::vector<double> &A, size_t M, size_t C,
+        std::vector<double> &B, size_t R)
+{
+  const size_t L = LANES;
+  std::vector<double> v(M * L);
+  alignas(64) double norm2[L], alpha[L], tau[L], dot[L];
+  for (size_t j = 0; j < C; j++)
+  {
+    // Reflection v = a - alpha e_j, with |alpha| = |a|
+    std::fill(norm2, norm2 + L, 0.0);
+    for (size_t i = j; i < M; i++)
+    {
+      const double *a = &A[(i * C + j) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) norm2[l] += a[l] * a[l];
+    }
+    const double *d = &A[(j * C + j) * L];
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++)
+    {
+      double norm = std::sqrt(norm2[l]);
+      alpha[l] = d[l] > 0.0 ? -norm : norm;
+      double vv = 2.0 * (norm2[l] - d[l] * alpha[l]);
+      tau[l] = vv > 0.0 ? 2.0 / vv : 0.0;
+    }
+    for (size_t i = j; i < M; i++)
+    {
+      const double *a = &A[(i * C + j) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) v[i * L + l] = a[l];
+    }
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++) v[j * L + l] -= alpha[l];
+
+    // Apply it to the remaining columns and to B
+    auto reflect = [&](double *X, size_t stride, size_t k) {
+      std::fill(dot, dot + L, 0.0);
+      for (size_t i = j; i < M; i++)
+      {
+        const double *x = X + (i * stride + k) * L;
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) dot[l] += v[i * L + l] * x[l];
+      }
+      for (size_t i = j; i < M; i++)
+      {
+        double *x = X + (i * stride + k) * L;
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) x[l] -= tau[l] * dot[l] * v[i * L + l];
+      }
+    };
+    for (size_t k = j + 1; k < C; k++) reflect(A.data(), C, k);
+    for (size_t k = 0; k < R; k++) reflect(B.data(), R, k);
+
+    double *a = &A[(j * C + j) * L];
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++) a[l] = alpha[l];
+    for (size_t i = j + 1; i < M; i++)
+    {
+      std::fill(&A[(i * C + j) * L], &A[(i * C + j) * L] + L, 0.0);
+    }
+  }
+}
+
+
+//! Column-scaled LS solutions of the (M, C) problems of all the lanes
+//!
+//! The lane counterpart of solve_scaled. A lane fails when its triangular
+//! factor is numerically singular or its solution is not finite.
+//!
+//! @param A          matrices, destroyed. dimension: (M, C, LANES)
+//! @param M          number of rows, at least C
+//! @param C          number of columns
+//! @param b          right-hand sides, destroyed. dimension: (M, LANES)
+//! @param x          [out] solutions. dimension: (C, LANES)
+//! @param failed     [in,out] failed lanes
+
+void
+lane_solve(std::vector<double> &A, size_t M, size_t C,
+           std::vector<double> &b, std::vector<double> &x, bool *failed)
+{
+  const size_t L = LANES;
+  std::vector<double> escale(C * L, 0.0);
+  for (size_t k = 0; k < C; k++)
+  {
+    double *e = &escale[k * L];
+    for (size_t i = 0; i < M; i++)
+    {
+      const double *a = &A[(i * C + k) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) e[l] += a[l] * a[l];
+    }
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++) e[l] = e[l] > 0.0 ? 1.0 / std::sqrt(e[l])
+                                                     : 1.0;
+    for (size_t i = 0; i < M; i++)
+    {
+      double *a = &A[(i * C + k) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) a[l] *= e[l];
+    }
+  }
+
+  lane_qr(A, M, C, b, 1);
+
+  // Rank check, as lstsq would have reported
+  for (size_t l = 0; l < L; l++)
+  {
+    double largest = 0.0;
+    for (size_t k = 0; k < C; k++)
+    {
+      largest = std::max(largest, std::abs(A[(k * C + k) * L + l]));
+    }
+    for (size_t k = 0; k < C; k++)
+    {
+      if (!(std::abs(A[(k * C + k) * L + l]) > 1e-13 * largest))
+      {
+        failed[l] = true;
+      }
+    }
+  }
+
+  // Back substitution
+  x.assign(C * L, 0.0);
+  for (size_t j = C; j-- > 0;)
+  {
+    double *xj = &x[j * L];
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++) xj[l] = b[j * L + l];
+    for (size_t k = j + 1; k < C; k++)
+    {
+      const double *a = &A[(j * C + k) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) xj[l] -= a[l] * x[k * L + l];
+    }
+    const double *a = &A[(j * C + j) * L];
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++) xj[l] /= a[l];
+  }
+  for (size_t k = 0; k < C; k++)
+  {
+    for (size_t l = 0; l < L; l++)
+    {
+      x[k * L + l] *= escale[k * L + l];
+      if (!std::isfinite(x[k * L + l])) failed[l] = true;
+    }
+  }
+}
+
+
+//! Tiny vector fitting problems of one shape, fitted side by side
+//!
+//! Problems with the same numbers of rows, samples and poles are laid out
+//! in struct-of-arrays form, value (..., lane), with one problem per SIMD
+//! lane. The basis, the QR factorizations of the pole and residue steps and
+//! the sigma solve then run as loops over the lanes, which vectorize however
+//! small the problems are. The zeros of sigma are found lane-parallel too,
+//! by Weierstrass (Durand-Kerner) iterations on the numerator of sigma kept
+//! in product form. A lane whose problem diverges (infinite basis values,
+//! an extreme D of sigma, a singular factor, zeros not converging) is marked
+//! failed, to be fitted again by the scalar path with its safeguards.
+class TinyBlock
+{
+public:
+  //! Load up to LANES problems; missing lanes repeat the last problem
+  TinyBlock(const std::vector<const Samples *> &samples,
+            const std::vector<const xt::xtensor<std::complex<double>, 1> *>
+                &poles,
+            size_t Nc)
+    : Nv_(samples[0]->rows()), Ns_(samples[0]->s[0].size()),
+      N_(poles[0]->size()), Nc_(Nc)
+  {
+    const size_t L = LANES;
+    s_.resize(Ns_ * L);
+    f_.resize(Nv_ * Ns_ * L);
+    w_.resize(Nv_ * Ns_ * L);
+    pr_.resize(N_ * L);
+    pi_.resize(N_ * L);
+    type_.resize(N_ * L);
+    for (size_t l = 0; l < L; l++)
+    {
+      auto k = std::min(l, samples.size() - 1);
+      const auto &x = *samples[k];
+      for (size_t i = 0; i < Ns_; i++)
+      {
+        s_[i * L + l] = x.s[0](i);
+        for (size_t n = 0; n < Nv_; n++)
+        {
+          f_[(n * Ns_ + i) * L + l] = x.f[n](i);
+          w_[(n * Ns_ + i) * L + l] = x.weight[n](i);
+        }
+      }
+      set_poles(l, *poles[k]);
+      failed_[l] = false;
+    }
+  }
+
+  //! Pole identification step of all the lanes
+  void relocate();
+
+  //! Residue identification step of lane l, if it has not failed
+  FitResult result(size_t l) const;
+
+  //! Residue identification step of all the lanes
+  void identify();
+
+  bool failed(size_t l) const { return failed_[l]; }
+
+private:
+  void set_poles(size_t l, const xt::xtensor<std::complex<double>, 1> &p)
+  {
+    auto cindex = find_cindex(p);
+    for (size_t m = 0; m < N_; m++)
+    {
+      pr_[m * LANES + l] = std::real(p(m));
+      pi_[m * LANES + l] = std::imag(p(m));
+      type_[m * LANES + l] = cindex(m);
+    }
+  }
+
+  //! Real basis (see real_basis) with Np polynomial columns. (Ns, N+Np, L)
+  void basis(size_t Np, std::vector<double> &Dk);
+
+  size_t Nv_, Ns_, N_, Nc_;
+  std::vector<double> s_, f_, w_; // samples. (Ns, L) and (Nv, Ns, L)
+  std::vector<double> pr_, pi_;   // poles. (N, L)
+  std::vector<int> type_;         // cindex of the poles. (N, L)
+  bool failed_[LANES];
+
+  // Results of identify
+  std::vector<double> x_;         // basis coefficients. (Nv, N + Nc, L)
+  std::vector<double> fit_;       // fit. (Nv, Ns, L)
+  double rmserr_[LANES];
+};
+
+
+void
+TinyBlock::basis(size_t Np, std::vector<double> &Dk)
+{
+  const size_t L = LANES;
+  auto K = N_ + Np;
+  Dk.assign(Ns_ * K * L, 0.0);
+  for (size_t i = 0; i < Ns_; i++)
+  {
+    const double *s = &s_[i * L];
+    for (size_t m = 0; m < N_; m++)
+    {
+      const double *a = &pr_[m * L];
+      const double *b = &pi_[m * L];
+      const int *t = &type_[m * L];
+      double *D = &Dk[(i * K + m) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++)
+      {
+        double d = s[l] - a[l];
+        double den = d * d + b[l] * b[l];
+        D[l] = t[l] == 0 ? 1.0 / d : (t[l] == 1 ? 2.0 * d : 2.0 * b[l]) / den;
+      }
+    }
+    for (size_t m = 0; m < Np; m++)
+    {
+      double *D = &Dk[(i * K + N_ + m) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) D[l] = std::pow(s[l], (double)m);
+    }
+  }
+  for (size_t l = 0; l < L; l++)
+  {
+    for (size_t j = l; j < Dk.size(); j += L)
+    {
+      if (!std::isfinite(Dk[j]))
+      {
+        failed_[l] = true;
+        break;
+      }
+    }
+  }
+}
+
+
+void
+TinyBlock::relocate()
+{
+  const size_t L = LANES;
+  auto Nv = Nv_, Ns = Ns_, N = N_, Nc = Nc_;
+  auto Np = std::max(Nc, (size_t)1);
+  auto K = N + Np;
+  std::vector<double> Dk;
+  basis(Np, Dk);
+
+  // Scaling of the integral criterion
+  alignas(64) double scale[L] = {0.0};
+  for (size_t j = 0; j < Nv * Ns; j++)
+  {
+    #pragma omp simd
+    for (size_t l = 0; l < L; l++)
+    {
+      double wf = w_[j * L + l] * f_[j * L + l];
+      scale[l] += wf * wf;
+    }
+  }
+  for (size_t l = 0; l < L; l++) scale[l] = std::sqrt(scale[l]) / Ns;
+
+  // R22 blocks of the rows, as in identify_poles
+  size_t C = N + Nc + N + 1;
+  size_t M = std::max(Ns + 1, C);
+  size_t MA = Nv * (N + 1);
+  std::vector<double> AA(MA * (N + 1) * L, 0.0);
+  std::vector<double> bb(MA * L, 0.0);
+  std::vector<double> A(M * C * L), B(M * L);
+  for (size_t n = 0; n < Nv; n++)
+  {
+    std::fill(A.begin(), A.end(), 0.0);
+    std::fill(B.begin(), B.end(), 0.0);
+    for (size_t i = 0; i < Ns; i++)
+    {
+      const double *w = &w_[(n * Ns + i) * L];
+      const double *f = &f_[(n * Ns + i) * L];
+      for (size_t m = 0; m < N + Nc; m++)
+      {
+        const double *D = &Dk[(i * K + m) * L];
+        double *a = &A[(i * C + m) * L];
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) a[l] = w[l] * D[l];
+      }
+      for (size_t m = 0; m < N + 1; m++)
+      {
+        const double *D = &Dk[(i * K + m) * L];
+        double *a = &A[(i * C + N + Nc + m) * L];
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) a[l] = -w[l] * D[l] * f[l];
+      }
+    }
+    if (n == Nv - 1)
+    {
+      for (size_t m = 0; m < N + 1; m++)
+      {
+        double *a = &A[(Ns * C + N + Nc + m) * L];
+        for (size_t i = 0; i < Ns; i++)
+        {
+          const double *D = &Dk[(i * K + m) * L];
+          #pragma omp simd
+          for (size_t l = 0; l < L; l++) a[l] += D[l];
+        }
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) a[l] *= scale[l];
+      }
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) B[Ns * L + l] = Ns * scale[l];
+    }
+
+    lane_qr(A, M, C, B, 1);
+    for (size_t r = 0; r < N + 1; r++)
+    {
+      for (size_t c = 0; c < N + 1; c++)
+      {
+        const double *a = &A[((N + Nc + r) * C + N + Nc + c) * L];
+        double *aa = &AA[((n * (N + 1) + r) * (N + 1) + c) * L];
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) aa[l] = a[l];
+      }
+      if (n == Nv - 1)
+      {
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++)
+        {
+          bb[(n * (N + 1) + r) * L + l] = B[(N + Nc + r) * L + l];
+        }
+      }
+    }
+  }
+
+  // Sigma, with an extreme D left to the non-relaxed scalar path
+  std::vector<double> x;
+  lane_solve(AA, MA, N + 1, bb, x, failed_);
+  const double *D = &x[N * L];
+  for (size_t l = 0; l < L; l++)
+  {
+    if (!(std::abs(D[l]) >= TOLlow && std::abs(D[l]) <= TOLhigh))
+    {
+      failed_[l] = true;
+    }
+  }
+
+  // Residues of sigma in complex form, sigma(z) = D + sum c/(z - p)
+  std::vector<double> cr(N * L), ci(N * L);
+  for (size_t m = 0; m < N; m++)
+  {
+    for (size_t l = 0; l < L; l++)
+    {
+      auto t = type_[m * L + l];
+      cr[m * L + l] = t == 2 ? x[(m - 1) * L + l] : x[m * L + l];
+      ci[m * L + l] = t == 0 ? 0.0 : (t == 1 ? x[(m + 1) * L + l]
+                                             : -x[m * L + l]);
+    }
+  }
+
+  // Zeros of the numerator P(z) = D prod(z - p) + sum c prod'(z - p) by
+  // Weierstrass iterations, starting next to the poles
+  std::vector<double> zr(N * L), zi(N * L);
+  alignas(64) double radius[L];
+  for (size_t l = 0; l < L; l++)
+  {
+    radius[l] = 0.0;
+    for (size_t m = 0; m < N; m++)
+    {
+      radius[l] = std::max(radius[l], std::abs(std::complex<double>(
+          pr_[m * L + l], pi_[m * L + l])));
+    }
+    radius[l] = radius[l] > 0.0 ? 1e-3 * radius[l] : 1e-3;
+  }
+  for (size_t m = 0; m < N; m++)
+  {
+    double angle = 0.4 + 8.0 * std::atan(1.0) * m / N;
+    for (size_t l = 0; l < L; l++)
+    {
+      zr[m * L + l] = pr_[m * L + l] + radius[l] * std::cos(angle);
+      zi[m * L + l] = pi_[m * L + l] + radius[l] * std::sin(angle);
+    }
+  }
+  std::vector<double> pre_r((N + 1) * L), pre_i((N + 1) * L);
+  std::vector<double> suf_r((N + 1) * L), suf_i((N + 1) * L);
+  bool converged[L];
+  std::fill(converged, converged + L, false);
+  for (int sweep = 0; sweep < 200; sweep++)
+  {
+    alignas(64) double change[L] = {0.0};
+    for (size_t k = 0; k < N; k++)
+    {
+      double *z_r = &zr[k * L];
+      double *z_i = &zi[k * L];
+
+      // Prefix and suffix products of (z - p)
+      std::fill(&pre_r[0], &pre_r[0] + L, 1.0);
+      std::fill(&pre_i[0], &pre_i[0] + L, 0.0);
+      std::fill(&suf_r[N * L], &suf_r[N * L] + L, 1.0);
+      std::fill(&suf_i[N * L], &suf_i[N * L] + L, 0.0);
+      for (size_t j = 0; j < N; j++)
+      {
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++)
+        {
+          double a = z_r[l] - pr_[j * L + l];
+          double b = z_i[l] - pi_[j * L + l];
+          double u = pre_r[j * L + l], v = pre_i[j * L + l];
+          pre_r[(j + 1) * L + l] = u * a - v * b;
+          pre_i[(j + 1) * L + l] = u * b + v * a;
+        }
+      }
+      for (size_t j = N; j-- > 0;)
+      {
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++)
+        {
+          double a = z_r[l] - pr_[j * L + l];
+          double b = z_i[l] - pi_[j * L + l];
+          double u = suf_r[(j + 1) * L + l], v = suf_i[(j + 1) * L + l];
+          suf_r[j * L + l] = u * a - v * b;
+          suf_i[j * L + l] = u * b + v * a;
+        }
+      }
+
+      // P(z) and D prod(z - z_j), j != k
+      alignas(64) double Pr[L], Pi[L], Qr[L], Qi[L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++)
+      {
+        Pr[l] = D[l] * pre_r[N * L + l];
+        Pi[l] = D[l] * pre_i[N * L + l];
+        Qr[l] = D[l];
+        Qi[l] = 0.0;
+      }
+      for (size_t j = 0; j < N; j++)
+      {
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++)
+        {
+          double u = pre_r[j * L + l], v = pre_i[j * L + l];
+          double g = suf_r[(j + 1) * L + l], h = suf_i[(j + 1) * L + l];
+          double tr = u * g - v * h;
+          double ti = u * h + v * g;
+          double c = cr[j * L + l], d = ci[j * L + l];
+          Pr[l] += c * tr - d * ti;
+          Pi[l] += c * ti + d * tr;
+        }
+        if (j == k) continue;
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++)
+        {
+          double a = z_r[l] - zr[j * L + l];
+          double b = z_i[l] - zi[j * L + l];
+          double u = Qr[l], v = Qi[l];
+          Qr[l] = u * a - v * b;
+          Qi[l] = u * b + v * a;
+        }
+      }
+
+      // z -= P / Q
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++)
+      {
+        double den = Qr[l] * Qr[l] + Qi[l] * Qi[l];
+        double dr = (Pr[l] * Qr[l] + Pi[l] * Qi[l]) / den;
+        double di = (Pi[l] * Qr[l] - Pr[l] * Qi[l]) / den;
+        z_r[l] -= dr;
+        z_i[l] -= di;
+        double size = std::sqrt(z_r[l] * z_r[l] + z_i[l] * z_i[l]) +
+                      radius[l];
+        double rel = std::sqrt(dr * dr + di * di) / size;
+        change[l] = rel > change[l] || rel != rel ? rel : change[l];
+      }
+    }
+    bool done = true;
+    for (size_t l = 0; l < L; l++)
+    {
+      converged[l] = change[l] <= 1e-12;
+      done = done && (converged[l] || failed_[l]);
+    }
+    if (done) break;
+  }
+
+  // Canonical poles, with the rounding of real zeros removed
+  for (size_t l = 0; l < L; l++)
+  {
+    if (!converged[l]) failed_[l] = true;
+    if (failed_[l]) continue;
+    xt::xtensor<std::complex<double>, 1> zeros({N}, C_ZERO);
+    for (size_t m = 0; m < N; m++)
+    {
+      double a = zr[m * L + l], b = zi[m * L + l];
+      if (std::abs(b) <= 1e-10 * std::abs(std::complex<double>(a, b)))
+      {
+        b = 0.0;
+      }
+      zeros(m) = std::complex<double>(a, b);
+    }
+    set_poles(l, canonical_poles(zeros));
+  }
+}
+
+
+void
+TinyBlock::identify()
+{
+  const size_t L = LANES;
+  auto Nv = Nv_, Ns = Ns_, N = N_, Nc = Nc_;
+  auto K = N + Nc;
+  std::vector<double> Dk;
+  basis(Nc, Dk);
+
+  x_.assign(Nv * K * L, 0.0);
+  fit_.assign(Nv * Ns * L, 0.0);
+  std::fill(rmserr_, rmserr_ + L, 0.0);
+  size_t M = std::max(Ns, K);
+  std::vector<double> A(M * K * L), b(M * L), x;
+  for (size_t n = 0; n < Nv; n++)
+  {
+    std::fill(A.begin(), A.end(), 0.0);
+    std::fill(b.begin(), b.end(), 0.0);
+    for (size_t i = 0; i < Ns; i++)
+    {
+      const double *w = &w_[(n * Ns + i) * L];
+      const double *f = &f_[(n * Ns + i) * L];
+      for (size_t m = 0; m < K; m++)
+      {
+        const double *D = &Dk[(i * K + m) * L];
+        double *a = &A[(i * K + m) * L];
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) a[l] = w[l] * D[l];
+      }
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++) b[i * L + l] = w[l] * f[l];
+    }
+    lane_solve(A, M, K, b, x, failed_);
+    std::copy(x.begin(), x.end(), x_.begin() + n * K * L);
+
+    // Fit on the samples and its error
+    for (size_t i = 0; i < Ns; i++)
+    {
+      double *fit = &fit_[(n * Ns + i) * L];
+      for (size_t m = 0; m < K; m++)
+      {
+        const double *D = &Dk[(i * K + m) * L];
+        #pragma omp simd
+        for (size_t l = 0; l < L; l++) fit[l] += D[l] * x[m * L + l];
+      }
+      const double *f = &f_[(n * Ns + i) * L];
+      #pragma omp simd
+      for (size_t l = 0; l < L; l++)
+      {
+        double e = fit[l] - f[l];
+        rmserr_[l] += e * e;
+      }
+    }
+  }
+  for (size_t l = 0; l < L; l++)
+  {
+    rmserr_[l] = std::sqrt(rmserr_[l] / (Nv * Ns));
+  }
+}
+
+
+FitResult
+TinyBlock::result(size_t l) const
+{
+  const size_t L = LANES;
+  auto Nv = Nv_, Ns = Ns_, N = N_, Nc = Nc_;
+  auto K = N + Nc;
+  FitResult r;
+  r.model.poles = xt::zeros<std::complex<double>>({N});
+  xt::xtensor<int, 1> cindex({N}, 0);
+  for (size_t m = 0; m < N; m++)
+  {
+    r.model.poles(m) = std::complex<double>(pr_[m * L + l], pi_[m * L + l]);
+    cindex(m) = type_[m * L + l];
+  }
+  xt::xtensor<double, 2> Cr({Nv, N}, 0.0);
+  r.model.polys = xt::zeros<double>({Nv, Nc});
+  r.fit = xt::zeros<double>({Nv, Ns});
+  for (size_t n = 0; n < Nv; n++)
+  {
+    for (size_t m = 0; m < N; m++) Cr(n, m) = x_[(n * K + m) * L + l];
+    for (size_t m = 0; m < Nc; m++)
+    {
+      r.model.polys(n, m) = x_[(n * K + N + m) * L + l];
+    }
+    for (size_t i = 0; i < Ns; i++) r.fit(n, i) = fit_[(n * Ns + i) * L + l];
+  }
+  r.model.residues = complex_residues(Cr, cindex);
+  r.rmserr = rmserr_[l];
+  return r;
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Fast Relaxed Vector Fitting of a batch of tiny problems
+//!
+//! Same as vectfit_batch, for many small problems (e.g. N <= 8, Ns <= 100)
+//! for which neither vectorization within a problem nor a thread per
+//! problem uses the SIMD registers. The problems are grouped by shape (rows,
+//! samples, poles), fitted LANES at a time by TinyBlock, and the blocks are
+//! spread over the threads. The problems which fail in their lane are
+//! fitted again by the scalar path from their initial poles.
+//!
+//! @param f          functions to be fitted. Np arrays (Nv_i, Ns_i)
+//! @param s          sample points of each problem. Np arrays (Ns_i)
+//! @param poles      initial poles of each problem. Np arrays (N_i)
+//! @param weight     weights of each problem. Np arrays (Nv_i, Ns_i)
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param n_iter     number of pole relocations of each problem
+//! @return           list of Tuple(poles, residues, polys, fit, rmserr)
+
+py::list
+vectfit_tiny(std::vector<xt::pyarray<double>> &f,
+             std::vector<xt::pyarray<double>> &s,
+             std::vector<xt::pyarray<std::complex<double>>> &poles,
+             std::vector<xt::pyarray<double>> &weight,
+             int n_polys,
+             int n_iter)
+{
+  // Check input arguments
+  auto Np = f.size();
+  if (s.size() != Np || poles.size() != Np || weight.size() != Np)
+  {
+    throw std::invalid_argument("Error: lengths of f, s, poles and weight do "
+                                "not match.");
+  }
+  size_t Nc = (size_t)n_polys;
+  if (n_polys < 0 || Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_iter < 0)
+  {
+    throw std::invalid_argument("Error: input n_iter is negative.");
+  }
+
+  // Convert the inputs while holding the GIL
+  std::vector<Samples> samples;
+  std::vector<xt::xtensor<std::complex<double>, 1>> p;
+  for (size_t i = 0; i < Np; i++)
+  {
+    samples.push_back(make_samples(f[i], s[i], weight[i]));
+    p.emplace_back(poles[i]);
+    if (samples[i].rows() == 0 || s[i].size() == 0)
+    {
+      throw std::invalid_argument("Error: problem " + std::to_string(i) +
+                                  " has no samples.");
+    }
+    find_cindex(p[i]);
+  }
+
+  std::vector<FitResult> results(Np);
+  {
+    py::gil_scoped_release release;
+
+    // Blocks of problems of the same shape; problems without poles are left
+    // to the scalar path
+    std::map<std::tuple<size_t, size_t, size_t>, std::vector<size_t>> shapes;
+    std::vector<size_t> scalar;
+    for (size_t i = 0; i < Np; i++)
+    {
+      if (p[i].size() == 0)
+      {
+        scalar.push_back(i);
+        continue;
+      }
+      shapes[std::make_tuple(samples[i].rows(), samples[i].s[0].size(),
+                             p[i].size())].push_back(i);
+    }
+    std::vector<std::vector<size_t>> blocks;
+    for (const auto &shape : shapes)
+    {
+      const auto &ids = shape.second;
+      for (size_t first = 0; first < ids.size(); first += LANES)
+      {
+        auto last = std::min(first + LANES, ids.size());
+        blocks.emplace_back(ids.begin() + first, ids.begin() + last);
+      }
+    }
+
+    std::vector<char> failed(Np, 0);
+    parallel_for(blocks.size(), [&](size_t b) {
+      const auto &ids = blocks[b];
+      std::vector<const Samples *> x;
+      std::vector<const xt::xtensor<std::complex<double>, 1> *> q;
+      for (auto i : ids)
+      {
+        x.push_back(&samples[i]);
+        q.push_back(&p[i]);
+      }
+      TinyBlock block(x, q, Nc);
+      for (int it = 0; it < n_iter; it++)
+      {
+        block.relocate();
+      }
+      block.identify();
+      for (size_t l = 0; l < ids.size(); l++)
+      {
+        if (block.failed(l))
+        {
+          failed[ids[l]] = 1;
+        }
+        else
+        {
+          results[ids[l]] = block.result(l);
+        }
+      }
+    });
+
+    // Scalar fallback
+    for (size_t i = 0; i < Np; i++)
+    {
+      if (failed[i])
+      {
+        scalar.push_back(i);
+        counters.tiny_fallbacks++;
+      }
+    }
+    parallel_for(scalar.size(), [&](size_t k) {
+      auto i = scalar[k];
+      results[i] = fit_samples(samples[i], p[i], Nc, n_iter);
+    });
+  }
+
+  // Return the results
+  py::list out;
+  for (const auto &r : results)
+  {
+    out.append(py::make_tuple(
+        xt::pyarray<std::complex<double>>(r.model.poles),
+        xt::pyarray<std::complex<double>>(r.model.residues),
+        xt::pyarray<double>(r.model.polys),
+        xt::pyarray<double>(r.fit),
+        r.rmserr));
+  }
+  return out;
+}
+
+
+//! Fast Relaxed Vector Fitting of a temperature series
+//!
+//! The same window at several temperatures has the same resonances, only
+//! broadened differently. All the temperatures are first fitted as the rows
+//! of one problem with a shared pole set; the rows share the grid, so the
+//! factorizations of their weighted basis are shared too wherever their
+//! weights coincide (see group_rows). A temperature whose shared fit misses
+//! tol is then refitted on its own, warm-started from the poles of the
+//! previous temperature, and keeps the better of the two fits.
+//!
+//! @param f          functions to be fitted. Nt arrays (Nv, Ns)
+//! @param s          vector of sample points. dimension: (Ns)
+//! @param poles      vector of initial poles. dimension: (N)
+//! @param weight     weights of each temperature. Nt arrays (Nv, Ns)
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param n_iter     number of pole relocations of each fit
+//! @param tol        RMS error accepted for the shared poles, relative to the
+//!                   RMS of f of the temperature
+//! @return           list of Tuple(poles, residues, polys, fit, rmserr,
+//!                   shared) of each temperature
+
+py::list
+vectfit_series(std::vector<xt::pyarray<double>> &f,
+               xt::pyarray<double> &s,
+               xt::pyarray<std::complex<double>> &poles,
+               std::vector<xt::pyarray<double>> &weight,
+               int n_polys,
+               int n_iter,
+               double tol)
+{
+  // Check input arguments
+  auto Nt = f.size();
+  if (Nt == 0)
+  {
+    throw std::invalid_argument("Error: input f is empty.");
+  }
+  if (weight.size() != Nt)
+  {
+    throw std::invalid_argument("Error: lengths of f and weight do not "
+                                "match.");
+  }
+  size_t Nc = (size_t)n_polys;
+  if (n_polys < 0 || Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_iter < 0)
+  {
+    throw std::invalid_argument("Error: input n_iter is negative.");
+  }
+  if (tol < 0.0)
+  {
+    throw std::invalid_argument("Error: input tol is negative.");
+  }
+
+  // Samples of each temperature, and of all of them as rows
+  std::vector<Samples> series;
+  Samples all;
+  for (size_t t = 0; t < Nt; t++)
+  {
+    series.push_back(make_samples(f[t], s, weight[t]));
+    if (t > 0 && series[t].rows() != series[0].rows())
+    {
+      throw std::invalid_argument("Error: temperatures have different "
+                                  "numbers of rows.");
+    }
+    for (size_t n = 0; n < series[t].rows(); n++)
+    {
+      all.f.push_back(series[t].f[n]);
+      all.weight.push_back(series[t].weight[n]);
+    }
+  }
+  all.s = series[0].s;
+  auto Nv = series[0].rows();
+  xt::xtensor<std::complex<double>, 1> p = poles;
+
+  std::vector<FitResult> results(Nt);
+  std::vector<char> shared(Nt, 1);
+  {
+    py::gil_scoped_release release;
+
+    // Shared poles
+    auto joint = fit_samples(all, p, Nc, n_iter);
+    for (size_t t = 0; t < Nt; t++)
+    {
+      auto rows = xt::range(t * Nv, (t + 1) * Nv);
+      auto &r = results[t];
+      r.model.poles = joint.model.poles;
+      r.model.residues = xt::view(joint.model.residues, rows);
+      r.model.polys = xt::view(joint.model.polys, rows);
+      r.fit = xt::view(joint.fit, rows);
+      double sum = 0.0;
+      for (size_t n = 0; n < Nv; n++)
+      {
+        sum += xt::sum(xt::square(xt::view(r.fit, n) - series[t].f[n]))();
+      }
+      r.rmserr = std::sqrt(sum / series[t].total());
+    }
+
+    // Own poles, warm-started from the previous temperature
+    for (size_t t = 0; t < Nt; t++)
+    {
+      double norm2 = 0.0;
+      for (const auto &fn : series[t].f)
+      {
+        norm2 += xt::sum(xt::square(fn))();
+      }
+      if (results[t].rmserr <= tol * std::sqrt(norm2 / series[t].total()))
+      {
+        continue;
+      }
+      const auto &start = t > 0 ? results[t - 1].model.poles
+                                : joint.model.poles;
+      auto own = fit_samples(series[t], start, Nc, n_iter);
+      if (own.rmserr < results[t].rmserr)
+      {
+        results[t] = std::move(own);
+        shared[t] = 0;
+      }
+    }
+  }
+
+  // Return the results
+  py::list out;
+  for (size_t t = 0; t < Nt; t++)
+  {
+    const auto &r = results[t];
+    out.append(py::make_tuple(
+        xt::pyarray<std::complex<double>>(r.model.poles),
+        xt::pyarray<std::complex<double>>(r.model.residues),
+        xt::pyarray<double>(r.model.polys),
+        xt::pyarray<double>(r.fit),
+        r.rmserr,
+        (bool)shared[t]));
+  }
+  return out;
+}
+
+
+#endif
+
+
+//! Rank of this process in the distributed fits (0 without MPI)
+int
+comm_rank()
+{
+#ifdef VECTFIT_MPI
+  mpi_size();
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  return rank;
+#else
+  return 0;
+#endif
+}
+
+
+//! Sum of an array over the ranks, in place
+void
+sum_ranks(double *data, int count)
+{
+#ifdef VECTFIT_MPI
+  MPI_Allreduce(MPI_IN_PLACE, data, count, MPI_DOUBLE, MPI_SUM,
+                MPI_COMM_WORLD);
+#endif
+}
+
+
+//! Broadcast of an array from rank 0
+void
+broadcast(double *data, int count)
+{
+#ifdef VECTFIT_MPI
+  MPI_Bcast(data, count, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#endif
+}
+
+
+//! Tall-skinny QR reduction over the ranks
+//!
+//! Each rank holds the square R factors of its own row blocks of a set of
+//! matrices. The ranks merge their factors pairwise up a binary tree, by the
+//! R factor of the two stacked triangles, which leaves on rank 0 the R
+//! factors of the full matrices (up to the signs of their rows).
+//!
+//! @param R          [in/out] R factors, all square. valid on rank 0 on exit
+
+void
+tsqr(std::vector<xt::xtensor<double, 2>> &R)
+{
+#ifdef VECTFIT_MPI
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  for (int step = 1; step < size; step *= 2)
+  {
+    if (rank % (2 * step) != 0)
+    {
+      for (size_t n = 0; n < R.size(); n++)
+      {
+        MPI_Send(R[n].data(), R[n].size(), MPI_DOUBLE, rank - step, n,
+                 MPI_COMM_WORLD);
+      }
+      break;
+    }
+    if (rank + step < size)
+    {
+      for (size_t n = 0; n < R.size(); n++)
+      {
+        auto K = R[n].shape()[0];
+        xt::xtensor<double, 2> A({2 * K, K}, 0.0);
+        xt::view(A, xt::range(0, K)) = R[n];
+        MPI_Recv(&A(K, 0), K * K, MPI_DOUBLE, rank + step, n, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+        R[n] = std::get<1>(xt::linalg::qr(A));
+      }
+    }
+  }
+#endif
+}
+
+
+//! Pole identification step on samples distributed over the ranks
+//!
+//! Solves the system of identify_poles with the samples of the common grid
+//! split into blocks over the ranks. Each rank reduces its rows of [A | b]
+//! (b: the integral criterion, held by rank 0) to an R factor, the factors
+//! are merged by tsqr, and rank 0 solves the small system for sigma and
+//! computes its zeros, which are broadcast.
+//!
+//! @param samples    local block of the samples, on a common grid
+//! @param poles      starting poles, identical on all ranks. dimension: (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @return           relocated poles, identical on all ranks. dimension: (N)
+
+xt::xtensor<std::complex<double>, 1>
+identify_poles_distributed(const Samples &samples,
+                           const xt::xtensor<std::complex<double>, 1> &poles,
+                           size_t Nc)
+{
+  auto Nv = samples.rows();
+  auto N = poles.size();
+  const auto &s = samples.s[0];
+  auto Ns = s.size();
+  auto K = N + Nc + N + 1;
+  int rank = comm_rank();
+  size_t m, n;
+
+  // Finding out which starting poles are complex
+  auto cindex = find_cindex(poles);
+
+  // Building system - matrix, with infinite values clamped
+  auto Dk = real_basis(s, poles, cindex, std::max(Nc, (size_t)1));
+  clamp_inf(Dk);
+
+  // Global sample count, scaling and column sums of the integral criterion
+  std::vector<double> sums(N + 3, 0.0);
+  sums[0] = Ns;
+  for (n = 0; n < Nv; n++)
+  {
+    sums[1] += std::pow(xt::linalg::norm(samples.weight[n] * samples.f[n]), 2);
+  }
+  for (m = 0; m < N + 1; m++)
+  {
+    sums[2 + m] = xt::sum(xt::view(Dk, xt::all(), m))();
+  }
+  sum_ranks(sums.data(), sums.size());
+  double Ns_total = sums[0];
+  double scale = std::sqrt(sums[1]) / Ns_total;
+
+  // R factors of the local rows of [A | b]
+  std::vector<xt::xtensor<double, 2>> R(Nv);
+  for (n = 0; n < Nv; n++)
+  {
+    const auto &w = samples.weight[n];
+    const auto &fn = samples.f[n];
+    xt::xtensor<double, 2> A({std::max(Ns + 1, K + 1), K + 1}, 0.0);
+    for (m = 0; m < N + Nc; m++)
+    {
+      xt::view(A, xt::range(0, Ns), m) = w * xt::view(Dk, xt::all(), m);
+    }
+    for (m = 0; m < N + 1; m++)
+    {
+      xt::view(A, xt::range(0, Ns), N + Nc + m) = -w *
+                                              xt::view(Dk, xt::all(), m) * fn;
+    }
+    if (n == Nv - 1 && rank == 0)
+    {
+      for (m = 0; m < N + 1; m++)
+      {
+        A(Ns, N + Nc + m) = scale * sums[2 + m];
+      }
+      A(Ns, K) = Ns_total * scale;
+    }
+    R[n] = std::get<1>(xt::linalg::qr(A));
+  }
+  tsqr(R);
+
+  // Relaxed solution for sigma
+  xt::xtensor<double, 1> x({N + 1}, 0.0);
+  if (rank == 0)
+  {
+    xt::xtensor<double, 2> AA({Nv * (N + 1), N + 1}, 0.0);
+    xt::xtensor<double, 1> bb({Nv * (N + 1)}, 0.0);
+    for (n = 0; n < Nv; n++)
+    {
+      xt::view(AA, xt::range(n*(N+1), (n+1)*(N+1))) =
+                      xt::view(R[n], xt::range(N+Nc, K), xt::range(N+Nc, K));
+    }
+    xt::view(bb, xt::range((Nv-1)*(N+1), Nv*(N+1))) =
+                      xt::view(R[Nv - 1], xt::range(N+Nc, K), K);
+    x = solve_scaled(AA, bb);
+  }
+  broadcast(x.data(), N + 1);
+  xt::xtensor<double, 1> C = xt::view(x, xt::range(0, N));
+  double D = x(N);
+
+  // Situation: produced D of sigma extremely is small or large
+  // Solve again, without relaxation
+  if (std::abs(D) < TOLlow || std::abs(D) > TOLhigh)
+  {
+    counters.tol_fallbacks++;
+    if (D == 0.0)
+    {
+      D = 1.0;
+    }
+    else if (std::abs(D) < TOLlow)
+    {
+      D = D > 0 ? TOLlow : -TOLlow;
+    }
+    else
+    {
+      D = D > 0 ? TOLhigh : -TOLhigh;
+    }
+
+    K = N + Nc + N;
+    for (n = 0; n < Nv; n++)
+    {
+      const auto &w = samples.weight[n];
+      const auto &fn = samples.f[n];
+      xt::xtensor<double, 2> A({std::max(Ns, K + 1), K + 1}, 0.0);
+      for (m = 0; m < N + Nc; m++)
+      {
+        xt::view(A, xt::range(0, Ns), m) = w * xt::view(Dk, xt::all(), m);
+      }
+      for (m = 0; m < N; m++)
+      {
+        xt::view(A, xt::range(0, Ns), N + Nc + m) = -w *
+                                              xt::view(Dk, xt::all(), m) * fn;
+      }
+      xt::view(A, xt::range(0, Ns), K) = D * w * fn;
+      R[n] = std::get<1>(xt::linalg::qr(A));
+    }
+    tsqr(R);
+
+    if (rank == 0)
+    {
+      xt::xtensor<double, 2> AA({Nv * N, N}, 0.0);
+      xt::xtensor<double, 1> bb({Nv * N}, 0.0);
+      for (n = 0; n < Nv; n++)
+      {
+        xt::view(AA, xt::range(n*N, (n+1)*N)) =
+                      xt::view(R[n], xt::range(N+Nc, K), xt::range(N+Nc, K));
+        xt::view(bb, xt::range(n*N, (n+1)*N)) =
+                      xt::view(R[n], xt::range(N+Nc, K), K);
+      }
+      C = solve_scaled(AA, bb);
+    }
+    broadcast(C.data(), N);
+  }
+
+  // Zeros of sigma, computed once so that all ranks hold the same poles
+  xt::xtensor<std::complex<double>, 1> new_poles({N}, C_ZERO);
+  if (rank == 0)
+  {
+    new_poles = sigma_zeros(poles, cindex, C, D);
+  }
+  broadcast(reinterpret_cast<double *>(new_poles.data()), 2 * N);
+  return new_poles;
+}
+
+
+//! Residue identification step on samples distributed over the ranks
+//!
+//! Solves the column-scaled LS-problems of identify_residues by tsqr of the
+//! local rows of [A | b], with the column norms summed over the ranks.
+//!
+//! @param samples    local block of the samples, on a common grid
+//! @param poles      known poles, identical on all ranks. dimension: (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @param residues   [out] residues. dimension: (Nv, N)
+//! @param polys      [out] curvefit (Polynomial) coefficients. (Nv, Nc)
+//! @param fit        [out] fitted signals on the local samples. (Nv, Ns)
+//! @return           RMS error between f and fit over the samples of all ranks
+
+double
+identify_residues_distributed(const Samples &samples,
+                              const xt::xtensor<std::complex<double>, 1> &poles,
+                              size_t Nc,
+                              xt::xtensor<std::complex<double>, 2> &residues,
+                              xt::xtensor<double, 2> &polys,
+                              xt::xtensor<double, 2> &fit)
+{
+  auto Nv = samples.rows();
+  auto N = poles.size();
+  const auto &s = samples.s[0];
+  auto Ns = s.size();
+  auto K = N + Nc;
+  int rank = comm_rank();
+  size_t m, n;
+
+  auto cindex = find_cindex(poles);
+  auto Dk = real_basis(s, poles, cindex, Nc);
+
+  // Column scaling, from the norms over all the samples
+  xt::xtensor<double, 2> Escale({Nv, K}, 0.0);
+  for (n = 0; n < Nv; n++)
+  {
+    for (m = 0; m < K; m++)
+    {
+      Escale(n, m) = xt::sum(xt::square(samples.weight[n] *
+                                        xt::view(Dk, xt::all(), m)))();
+    }
+  }
+  sum_ranks(Escale.data(), Escale.size());
+  Escale = 1.0 / xt::sqrt(Escale);
+
+  // R factors of the local rows of [A | b]
+  std::vector<xt::xtensor<double, 2>> R(Nv);
+  for (n = 0; n < Nv; n++)
+  {
+    const auto &w = samples.weight[n];
+    xt::xtensor<double, 2> A({std::max(Ns, K + 1), K + 1}, 0.0);
+    for (m = 0; m < K; m++)
+    {
+      xt::view(A, xt::range(0, Ns), m) = Escale(n, m) * w *
+                                         xt::view(Dk, xt::all(), m);
+    }
+    xt::view(A, xt::range(0, Ns), K) = w * samples.f[n];
+    R[n] = std::get<1>(xt::linalg::qr(A));
+  }
+  tsqr(R);
+
+  // Solve the triangular systems
+  xt::xtensor<double, 2> X({Nv, K}, 0.0);
+  if (rank == 0)
+  {
+    for (n = 0; n < Nv; n++)
+    {
+      xt::xtensor<double, 2> RR = xt::view(R[n], xt::range(0, K),
+                                           xt::range(0, K));
+      xt::xtensor<double, 1> b = xt::view(R[n], xt::range(0, K), K);
+      auto results = xt::linalg::lstsq(RR, b);
+      xt::view(X, n) = std::get<0>(results) * xt::view(Escale, n);
+    }
+  }
+  broadcast(X.data(), X.size());
+
+  xt::xtensor<double, 2> Cr = xt::view(X, xt::all(), xt::range(0, N));
+  residues = complex_residues(Cr, cindex);
+  polys = xt::view(X, xt::all(), xt::range(N, K));
+
+  // Calculate fit on the local samples, and the RMS error over all ranks
+  fit = multipole(s, poles, residues, polys);
+  double sums[2] = {0.0, (double)(Nv * Ns)};
+  for (n = 0; n < Nv; n++)
+  {
+    sums[0] += xt::sum(xt::square(xt::view(fit, n) - samples.f[n]))();
+  }
+  sum_ranks(sums, 2);
+  return std::sqrt(sums[0] / sums[1]);
+}
+
+
+//! Vector fitting iterations on samples distributed over the ranks
+//!
+//! The distributed counterpart of fit_samples; see vectfit_distributed.
+//!
+//! @param samples    local block of the samples, on a common grid
+//! @param poles      initial poles, identical on all ranks. dimension: (N)
+//! @param Nc         number of curvefit (Polynomial) coefficients
+//! @param n_iter     number of pole relocations
+//! @return           fitted model, local fit and global RMS error
+
+FitResult
+fit_distributed(const Samples &samples,
+                const xt::xtensor<std::complex<double>, 1> &poles,
+                size_t Nc,
+                int n_iter)
+{
+  auto Nv = samples.rows();
+  auto Ns = samples.s[0].size();
+  auto N = poles.size();
+
+  FitResult result;
+  result.model.poles = poles;
+  result.model.residues = xt::zeros<std::complex<double>>({Nv, N});
+  result.model.polys = xt::zeros<double>({Nv, Nc});
+  result.fit = xt::zeros<double>({Nv, Ns});
+
+  // If 0 poles and 0 cf order, return
+  if (N == 0 && Nc == 0)
+  {
+    double sums[2] = {0.0, (double)(Nv * Ns)};
+    for (const auto &fn : samples.f)
+    {
+      sums[0] += xt::sum(xt::square(fn))();
+    }
+    sum_ranks(sums, 2);
+    result.rmserr = std::sqrt(sums[0] / sums[1]);
+    return result;
+  }
+
+  for (int it = 0; it < n_iter && N > 0; it++)
+  {
+    result.model.poles = identify_poles_distributed(samples, result.model.poles,
+                                                    Nc);
+  }
+  result.rmserr = identify_residues_distributed(samples, result.model.poles, Nc,
+                                                result.model.residues,
+                                                result.model.polys, result.fit);
+  return result;
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Fast Relaxed Vector Fitting of one problem with its samples distributed
+//!
+//! Every MPI rank passes its own block of the sample points (with the
+//! matching columns of f and weight), so that no rank holds the full
+//! problem; the other arguments must be identical on all ranks. The
+//! LS-problems are solved by TSQR: the R factors of the local blocks are
+//! merged over the ranks and only the small reduced systems are solved,
+//! which reproduces the serial solution up to rounding. Must be called by
+//! all the ranks; without MPI, or on a single rank, it is equivalent to
+//! n_iter successive vectfit calls.
+//!
+//! @param f          local block of the function to be fitted. (Nv, Ns_r)
+//! @param s          local block of the sample points. dimension: (Ns_r)
+//! @param poles      initial poles. dimension: (N)
+//! @param weight     local block of the weights of f. dimension: (Nv, Ns_r)
+//! @param n_polys    Nc: Number of curvefit (Polynomial) coefficients, [0, 11]
+//! @param n_iter     number of pole relocations
+//! @return           Tuple(poles, residues, polys, fit, rmserr), with the fit
+//!                   on the local samples and rmserr over all of them
+
+std::tuple<xt::pyarray<std::complex<double>>,
+           xt::pyarray<std::complex<double>>,
+           xt::pyarray<double>,
+           xt::pyarray<double>,
+           double>
+vectfit_distributed(xt::pyarray<double> &f,
+                    xt::pyarray<double> &s,
+                    xt::pyarray<std::complex<double>> &poles,
+                    xt::pyarray<double> &weight,
+                    int n_polys,
+                    int n_iter)
+{
+  // Check input arguments
+  auto samples = make_samples(f, s, weight);
+  size_t Nc = (size_t)n_polys;
+  if (n_polys < 0 || Nc > 11)
+  {
+    throw std::invalid_argument("Error: input n_polys is not in range [0, 11].");
+  }
+  if (n_iter < 0)
+  {
+    throw std::invalid_argument("Error: input n_iter is negative.");
+  }
+  if (poles.dimension() != 1)
+  {
+    throw std::invalid_argument("Error: input poles is not 1-dimensional.");
+  }
+  xt::xtensor<std::complex<double>, 1> p = poles;
+
+  // Fit
+  FitResult r;
+  {
+    py::gil_scoped_release release;
+    r = fit_distributed(samples, p, Nc, n_iter);
+  }
+
+  return std::make_tuple(xt::pyarray<std::complex<double>>(r.model.poles),
+                         xt::pyarray<std::complex<double>>(r.model.residues),
+                         xt::pyarray<double>(r.model.polys),
+                         xt::pyarray<double>(r.fit),
+                         r.rmserr);
+}
+
+
+//! Initial poles from resonance parameters
+//!
+//! A resonance at energy E0 with total width G corresponds to the pole pair
+//! E0 -/+ iG/2, or sqrt(E0 -/+ iG/2) if the fitting variable is s = sqrt(E).
+//! The pairs are sorted by real part and emitted as (p, conj(p)) with exact
+//! conjugates so that they can be passed to vectfit directly. Pairs closer
+//! than tol (relative) to an already accepted pair are dropped, and the set
+//! is padded with linearly spaced background pairs over [s_min, s_max].
+//!
+//! @param energies        resonance energies. dimension: (Nr)
+//! @param widths          resonance total widths. dimension: (Nr)
+//! @param s_min           lower bound of the sampled variable
+//! @param s_max           upper bound of the sampled variable
+//! @param n_poles         total number of poles after padding, at least the
+//!                        number of resonance poles (0: no padding)
+//! @param sqrt_transform  if the fitting variable is sqrt(E)
+//! @param tol             relative distance for merging coincident poles
+//! @return                initial poles. dimension: (N)
+
+xt::pyarray<std::complex<double>>
+resonance_poles(xt::pyarray<double> energies,
+                xt::pyarray<double> widths,
+                double s_min,
+                double s_max,
+                int n_poles,
+                bool sqrt_transform,
+                double tol)
+{
+  // Check input arguments
+  if (energies.dimension() != 1 || widths.dimension() != 1)
+  {
+    throw std::invalid_argument("Error: input energies or widths is not "
+                                "1-dimensional.");
+  }
+  auto Nr = energies.size();
+  if (widths.size() != Nr)
+  {
+    throw std::invalid_argument("Error: length of widths does not match the "
+                                "length of energies.");
+  }
+  if (!(s_max > s_min))
+  {
+    throw std::invalid_argument("Error: s_max is not larger than s_min.");
+  }
+  if (n_poles < 0 || n_poles % 2 != 0)
+  {
+    throw std::invalid_argument("Error: input n_poles is not a non-negative "
+                                "even number.");
+  }
+  if (tol < 0.0)
+  {
+    throw std::invalid_argument("Error: input tol is negative.");
+  }
+
+  // Upper half-plane pole of each resonance
+  size_t m, n;
+  std::vector<std::complex<double>> upper;
+  upper.reserve(Nr);
+  for (m = 0; m < Nr; m++)
+  {
+    if (!(widths(m) > 0.0))
+    {
+      throw std::invalid_argument("Error: resonance widths must be positive.");
+    }
+    std::complex<double> p {energies(m), 0.5 * widths(m)};
+    if (sqrt_transform)
+    {
+      p = std::sqrt(p);
+    }
+    upper.push_back(p);
+  }
+  std::sort(upper.begin(), upper.end(),
+            [](const std::complex<double> &a, const std::complex<double> &b)
+            { return std::real(a) < std::real(b); });
+
+  // Drop near-coincident pairs, keeping the first one of each cluster
+  std::vector<std::complex<double>> unique;
+  for (const auto &p : upper)
+  {
+    bool duplicate = false;
+    for (const auto &q : unique)
+    {
+      if (std::abs(p - q) <= tol * std::max(std::abs(p), std::abs(q)))
+      {
+        duplicate = true;
+        break;
+      }
+    }
+    if (!duplicate)
+    {
+      unique.push_back(p);
+    }
+  }
+
+  // Background pairs linearly spaced over the sampled band
+  size_t N = 2 * unique.size();
+  if (n_poles > 0 && N > (size_t)n_poles)
+  {
+    throw std::invalid_argument("Error: the resonances give more poles than "
+                                "input n_poles.");
+  }
+  size_t Nb = (size_t)n_poles > N ? ((size_t)n_poles - N) / 2 : 0;
+  for (n = 0; n < Nb; n++)
+  {
+    double x = Nb == 1 ? 0.5 * (s_min + s_max) :
+               s_min + (s_max - s_min) * n / (Nb - 1);
+    double y = x != 0.0 ? 0.01 * std::abs(x) : 0.01 * (s_max - s_min);
+    unique.push_back({x, y});
+  }
+  std::sort(unique.begin(), unique.end(),
+            [](const std::complex<double> &a, const std::complex<double> &b)
+            { return std::real(a) < std::real(b); });
+
+  // Conjugate pairs in cindex order
+  xt::pyarray<std::complex<double>> poles({2 * unique.size()}, C_ZERO);
+  for (m = 0; m < unique.size(); m++)
+  {
+    poles(2 * m) = unique[m];
+    poles(2 * m + 1) = std::conj(unique[m]);
+  }
+
+  return poles;
+}
+
+
+#endif
+
+
+//! If two poles coincide within the relative distance tol
+bool
+coincident(std::complex<double> p, std::complex<double> q, double tol)
+{
+  return std::abs(p - q) <= tol * std::max(std::abs(p), std::abs(q));
+}
+
+
+//! Linear combination of pole-residue models
+//!
+//! A sum of pole-residue models is itself a pole-residue model on the union
+//! of their poles, so no refitting is needed. Poles within tol (relative) of
+//! each other are merged by adding their residues and keeping the location
+//! of the first one; with tol = 0 only identical poles are merged, which is
+//! exact. Conjugate pairs are merged as pairs.
+//!
+//! @param models     models to be combined, all with the same Nv
+//! @param coefs      coefficient of each model
+//! @param tol        relative distance for merging coincident poles
+//! @return           sum of coefs[i] * models[i]
+
+Model
+combine(const std::vector<Model> &models,
+        const std::vector<double> &coefs,
+        double tol)
+{
+  // Check input arguments
+  if (models.empty())
+  {
+    throw std::invalid_argument("Error: input models is empty.");
+  }
+  if (coefs.size() != models.size())
+  {
+    throw std::invalid_argument("Error: length of coefs does not match the "
+                                "number of models.");
+  }
+  if (tol < 0.0)
+  {
+    throw std::invalid_argument("Error: input tol is negative.");
+  }
+  auto Nv = models[0].residues.shape()[0];
+  size_t Nc = 0;
+  for (const auto &model : models)
+  {
+    if (model.residues.shape()[0] != Nv || model.polys.shape()[0] != Nv)
+    {
+      throw std::invalid_argument("Error: models do not have the same number "
+                                  "of rows.");
+    }
+    Nc = std::max(Nc, model.polys.shape()[1]);
+  }
+
+  // Union of the poles with the residues accumulated on each of them
+  std::vector<std::complex<double>> poles;
+  std::vector<xt::xtensor<std::complex<double>, 1>> residues;
+  std::vector<int> types; // 0-real, 1-complex, 2-conjugate
+  size_t i, j, m;
+  for (i = 0; i < models.size(); i++)
+  {
+    const auto &model = models[i];
+    auto cindex = find_cindex(model.poles);
+    for (m = 0; m < model.poles.size(); m++)
+    {
+      auto p = model.poles(m);
       if (cindex(m) == 0) // real pole
-        xt::view(Dk, xt::all(), m) = 1. / (s - p);
-      else if (cindex(m) == 1) // complex pole, 1st
-        xt::view(Dk, xt::all(), m) = 1. / (s - p) + 1. / (s - std::conj(p));
-      else if (cindex(m) == 2) // complex pole, 2nd
-        xt::view(Dk, xt::all(), m) = 1i / (s - std::conj(p)) - 1i / (s - p);
+      {
+        xt::xtensor<std::complex<double>, 1> r = coefs[i] *
+                                      xt::view(model.residues, xt::all(), m);
+        for (j = 0; j < poles.size(); j++)
+        {
+          if (types[j] == 0 && coincident(p, poles[j], tol)) break;
+        }
+        if (j < poles.size())
+        {
+          residues[j] += r;
+        }
+        else
+        {
+          poles.push_back(p);
+          residues.push_back(r);
+          types.push_back(0);
+        }
+      }
+      else if (cindex(m) == 1) // complex pair
+      {
+        xt::xtensor<std::complex<double>, 1> r1 = coefs[i] *
+                                      xt::view(model.residues, xt::all(), m);
+        xt::xtensor<std::complex<double>, 1> r2 = coefs[i] *
+                                  xt::view(model.residues, xt::all(), m + 1);
+        bool swap = false;
+        for (j = 0; j < poles.size(); j++)
+        {
+          if (types[j] != 1) continue;
+          if (coincident(p, poles[j], tol)) break;
+          // the pair may be stored in the other order
+          if (coincident(std::conj(p), poles[j], tol))
+          {
+            swap = true;
+            break;
+          }
+        }
+        if (j < poles.size())
+        {
+          residues[j] += swap ? r2 : r1;
+          residues[j + 1] += swap ? r1 : r2;
+        }
+        else
+        {
+          poles.push_back(p);
+          poles.push_back(std::conj(p));
+          residues.push_back(r1);
+          residues.push_back(r2);
+          types.push_back(1);
+          types.push_back(2);
+        }
+      }
+    }
+  }
+
+  // Combined model
+  auto N = poles.size();
+  Model result;
+  result.poles = xt::zeros<std::complex<double>>({N});
+  result.residues = xt::zeros<std::complex<double>>({Nv, N});
+  result.polys = xt::zeros<double>({Nv, Nc});
+  for (m = 0; m < N; m++)
+  {
+    result.poles(m) = poles[m];
+    xt::view(result.residues, xt::all(), m) = residues[m];
+  }
+  for (i = 0; i < models.size(); i++)
+  {
+    const auto &polys = models[i].polys;
+    xt::view(result.polys, xt::all(), xt::range(0, polys.shape()[1])) +=
+          coefs[i] * polys;
+  }
+
+  return result;
+}
+
+
+//! Prune a pole-residue model
+//!
+//! Removes the conjugate pairs whose peak contribution on the real axis,
+//! bounded by 2|r|/|Im(p)|, is below tol relative to the largest one. Real
+//! poles are always kept since their terms are unbounded near the pole.
+//!
+//! @param model      model to be pruned
+//! @param tol        relative peak contribution under which pairs are removed
+//! @return           pruned model
+
+Model
+prune(const Model &model, double tol)
+{
+  if (tol < 0.0)
+  {
+    throw std::invalid_argument("Error: input tol is negative.");
+  }
+  auto N = model.poles.size();
+  auto Nv = model.residues.shape()[0];
+  auto cindex = find_cindex(model.poles);
+  size_t m;
+
+  // Peak contribution of each pair
+  std::vector<double> peak(N, 0.0);
+  double peak_max = 0.0;
+  for (m = 0; m < N; m++)
+  {
+    if (cindex(m) == 1)
+    {
+      double r = xt::amax(xt::abs(xt::view(model.residues, xt::all(), m)))();
+      peak[m] = 2.0 * r / std::abs(std::imag(model.poles(m)));
+      peak[m + 1] = peak[m];
+      peak_max = std::max(peak_max, peak[m]);
+    }
+  }
+
+  // Poles to be kept
+  std::vector<size_t> keep;
+  for (m = 0; m < N; m++)
+  {
+    if (cindex(m) == 0 || peak[m] >= tol * peak_max)
+    {
+      keep.push_back(m);
+    }
+  }
+
+  Model result;
+  result.poles = xt::zeros<std::complex<double>>({keep.size()});
+  result.residues = xt::zeros<std::complex<double>>({Nv, keep.size()});
+  result.polys = model.polys;
+  for (m = 0; m < keep.size(); m++)
+  {
+    result.poles(m) = model.poles(keep[m]);
+    xt::view(result.residues, xt::all(), m) =
+          xt::view(model.residues, xt::all(), keep[m]);
+  }
+
+  return result;
+}
+
+
+//! Analytic group integrals of a pole-residue model
+//!
+//! Integrates f(s(E)) w(E) over each group [E_g, E_g+1] in closed form,
+//! with s = E or s = sqrt(E), and w = 1 or w = 1/E. Every pole term reduces
+//! to logarithms, e.g. for s = sqrt(E) and w = 1:
+//!     int r/(s-p) dE = int 2rs/(s-p) ds
+//!                    = 2r(s2 - s1) + 2rp log((s2-p)/(s1-p)),
+//! and so does every polynomial term. The logarithms are taken of the ratio,
+//! which stays in the principal branch since s-p does not cross the real
+//! axis for complex poles, and gives the principal value for real ones.
+//! With w = 1/E the pole terms are divided by the poles, which must not be 0.
+//!
+//! @param model            pole-residue model
+//! @param edges            increasing group boundaries in E. dimension: (G+1)
+//! @param weight_function  "constant" (w = 1) or "1/E" (w = 1/E)
+//! @param sqrt_transform   if the model variable is s = sqrt(E)
+//! @return                 Tuple(integrals, averages). dimension: (Nv, G)
+
+std::tuple<xt::xtensor<double, 2>, xt::xtensor<double, 2>>
+integrate(const Model &model,
+          const xt::xtensor<double, 1> &edges,
+          const std::string &weight_function,
+          bool sqrt_transform)
+{
+  // Check input arguments
+  bool inverse;
+  if (weight_function == "constant")
+  {
+    inverse = false;
+  }
+  else if (weight_function == "1/E")
+  {
+    inverse = true;
+  }
+  else
+  {
+    throw std::invalid_argument("Error: input weight_function is neither "
+                                "\"constant\" nor \"1/E\".");
+  }
+  if (edges.size() < 2)
+  {
+    throw std::invalid_argument("Error: input edges has less than 2 values.");
+  }
+  auto G = edges.size() - 1;
+  for (size_t g = 0; g < G; g++)
+  {
+    if (!(edges(g + 1) > edges(g)))
+    {
+      throw std::invalid_argument("Error: input edges is not increasing.");
+    }
+  }
+  if ((inverse || sqrt_transform) && !(edges(0) > 0.0))
+  {
+    throw std::invalid_argument("Error: input edges must be positive for the "
+                                "1/E weighting or the sqrt transform.");
+  }
+  if (inverse && xt::any(xt::equal(model.poles, std::complex<double>(0.0))))
+  {
+    throw std::invalid_argument("Error: input model has a pole at 0, which "
+                                "the 1/E weighting does not support.");
+  }
+  auto N = model.poles.size();
+  auto Nv = model.residues.shape()[0];
+  auto Nc = model.polys.shape()[1];
+
+  // Integrals of the basis functions over each group
+  xt::xtensor<double, 2> Ir({N, G}, 0.0); // REAL[int w/(s-p) dE]
+  xt::xtensor<double, 2> Ii({N, G}, 0.0); // IMAG[int w/(s-p) dE]
+  xt::xtensor<double, 2> Ip({Nc, G}, 0.0); // int w*s^n dE
+  xt::xtensor<double, 1> norm({G}, 0.0); // int w dE
+  #pragma omp parallel for schedule(static)
+  for (long gl = 0; gl < (long)G; gl++)
+  {
+    size_t g = gl;
+    double e1 = edges(g);
+    double e2 = edges(g + 1);
+    double s1 = sqrt_transform ? std::sqrt(e1) : e1;
+    double s2 = sqrt_transform ? std::sqrt(e2) : e2;
+    double ls = std::log(s2 / s1);
+    double jac = sqrt_transform ? 2.0 : 1.0; // dE = 2s ds for sqrt(E)
+
+    // Pole terms
+    for (size_t m = 0; m < N; m++)
+    {
+      auto p = model.poles(m);
+      auto L = std::log((s2 - p) / (s1 - p));
+      std::complex<double> I;
+      if (!inverse && !sqrt_transform)
+        I = L;
+      else if (!inverse)
+        I = 2.0 * (s2 - s1) + 2.0 * p * L;
+      else
+        I = jac * (L - ls) / p;
+      Ir(m, g) = std::real(I);
+      Ii(m, g) = std::imag(I);
+    }
+
+    // Polynomial terms
+    for (size_t n = 0; n < Nc; n++)
+    {
+      // int s^n * s^k ds with k = 1 (sqrt, w = 1), k = -1 (w = 1/E) or 0
+      int k = inverse ? -1 : (sqrt_transform ? 1 : 0);
+      int q = (int)n + k + 1;
+      if (q == 0)
+        Ip(n, g) = jac * ls;
       else
-        throw std::runtime_error("Error: unknown cindex value.");
+        Ip(n, g) = jac * (std::pow(s2, q) - std::pow(s1, q)) / q;
+    }
+
+    // Weight
+    norm(g) = inverse ? std::log(e2 / e1) : e2 - e1;
+  }
+
+  // Sum the terms of each row
+  xt::xtensor<double, 2> integrals({Nv, G}, 0.0);
+  if (N > 0)
+  {
+    xt::xtensor<double, 2> Rr = xt::real(model.residues);
+    xt::xtensor<double, 2> Ri = xt::imag(model.residues);
+    integrals = xt::linalg::dot(Rr, Ir) - xt::linalg::dot(Ri, Ii);
+  }
+  if (Nc > 0)
+  {
+    integrals += xt::linalg::dot(model.polys, Ip);
+  }
+  xt::xtensor<double, 2> averages = integrals / norm;
+
+  return std::make_tuple(integrals, averages);
+}
+
+
+//! Evaluate a batch of (model, point) queries, bucketed by model and point
+//!
+//! The queries come in arbitrary order, e.g. from the particles of an event
+//! based transport step. They are sorted by model (counting sort) and by
+//! point within each model, and the sorted buckets are cut into chunks of
+//! bounded size, each evaluated by the vectorized kernel on contiguous
+//! points while the poles of its model stay in cache. The chunks are spread
+//! over the threads and the results scattered back to the query order.
+//!
+//! @param models     models, all with the same number of rows Nv
+//! @param index      model of each query. dimension: (Nq)
+//! @param s          point of each query. dimension: (Nq)
+//! @return           f of each query. dimension: (Nv, Nq)
+
+xt::xtensor<double, 2>
+lookup(const std::vector<const Model *> &models,
+       const xt::xtensor<long, 1> &index,
+       const xt::xtensor<double, 1> &s)
+{
+  // Check input arguments
+  auto Nm = models.size();
+  auto Nq = s.size();
+  if (index.size() != Nq)
+  {
+    throw std::invalid_argument("Error: sizes of index and s do not match.");
+  }
+  if (Nm == 0)
+  {
+    throw std::invalid_argument("Error: input models is empty.");
+  }
+  auto Nv = models[0]->residues.shape()[0];
+  for (auto model : models)
+  {
+    if (model->residues.shape()[0] != Nv)
+    {
+      throw std::invalid_argument("Error: models have different numbers of "
+                                  "rows.");
+    }
+  }
+  for (auto k : index)
+  {
+    if (k < 0 || k >= (long)Nm)
+    {
+      throw std::invalid_argument("Error: input index is out of range.");
+    }
+  }
+
+  // Counting sort by model, then sort by point within each model
+  std::vector<size_t> start(Nm + 1, 0);
+  for (auto k : index) start[k + 1]++;
+  for (size_t k = 0; k < Nm; k++) start[k + 1] += start[k];
+  std::vector<size_t> order(Nq);
+  {
+    auto next = start;
+    for (size_t q = 0; q < Nq; q++) order[next[index(q)]++] = q;
+  }
+  #pragma omp parallel for schedule(dynamic)
+  for (long k = 0; k < (long)Nm; k++)
+  {
+    std::sort(order.begin() + start[k], order.begin() + start[k + 1],
+              [&s](size_t a, size_t b) { return s(a) < s(b); });
+  }
+
+  // Chunks of the buckets
+  const size_t chunk = 1024;
+  std::vector<std::pair<size_t, size_t>> tasks; // (model, first query)
+  for (size_t k = 0; k < Nm; k++)
+  {
+    for (auto i = start[k]; i < start[k + 1]; i += chunk)
+    {
+      tasks.emplace_back(k, i);
+    }
+  }
+
+  xt::xtensor<double, 2> f({Nv, Nq}, 0.0);
+  #pragma omp parallel for schedule(dynamic)
+  for (long t = 0; t < (long)tasks.size(); t++)
+  {
+    auto k = tasks[t].first;
+    auto first = tasks[t].second;
+    auto last = std::min(first + chunk, start[k + 1]);
+    xt::xtensor<double, 1> points({last - first}, 0.0);
+    for (auto i = first; i < last; i++)
+    {
+      points(i - first) = s(order[i]);
+    }
+    auto fk = models[k]->evaluate(points);
+    for (auto i = first; i < last; i++)
+    {
+      for (size_t n = 0; n < Nv; n++)
+      {
+        f(n, order[i]) = fk(n, i - first);
+      }
+    }
+  }
+  return f;
+}
+
+
+//! Compare models with reference data, window by window
+//!
+//! The reference points of all the windows are packed in one array, window
+//! k owning the points offsets(k) to offsets(k + 1). The windows are cut
+//! into chunks spread over the threads; the points of a chunk are
+//! evaluated by the single-point kernel, with the terms of the model
+//! fetched once per chunk, and compared, so that only the fit of one chunk
+//! per thread is stored. A point fails if |fit - f| > atol + rtol |f| for
+//! any row.
+//!
+//! @param models     model of each window, all with Nv rows. (Nw)
+//! @param offsets    first point of each window, then the total. (Nw + 1)
+//! @param s          reference points. dimension: (Np)
+//! @param f          reference values. dimension: (Nv, Np)
+//! @param rtol       relative tolerance
+//! @param atol       absolute tolerance
+//! @return           Tuple(errors, failures): max absolute, max relative and
+//!                   RMS errors of each window (Nw, 3), and its number of
+//!                   failing points (Nw)
+
+std::tuple<xt::xtensor<double, 2>, xt::xtensor<long, 1>>
+validate(const std::vector<const Model *> &models,
+         const xt::xtensor<long, 1> &offsets,
+         const xt::xtensor<double, 1> &s,
+         const xt::xtensor<double, 2> &f,
+         double rtol, double atol)
+{
+  // Check input arguments
+  auto Nw = models.size();
+  auto Np = s.size();
+  if (offsets.size() != Nw + 1)
+  {
+    throw std::invalid_argument("Error: length of offsets is not the number "
+                                "of models plus one.");
+  }
+  if (offsets(0) != 0 || offsets(Nw) != (long)Np)
+  {
+    throw std::invalid_argument("Error: offsets do not span the points s.");
+  }
+  for (size_t k = 0; k < Nw; k++)
+  {
+    if (offsets(k + 1) < offsets(k))
+    {
+      throw std::invalid_argument("Error: offsets are decreasing.");
+    }
+  }
+  if (f.shape()[1] != Np)
+  {
+    throw std::invalid_argument("Error: 2nd dimension of f does not match the "
+                                "length of s.");
+  }
+  auto Nv = f.shape()[0];
+  for (auto model : models)
+  {
+    if (model->residues.shape()[0] != Nv || model->polys.shape()[0] != Nv)
+    {
+      throw std::invalid_argument("Error: number of rows of a model does not "
+                                  "match f.");
+    }
+  }
+  if (rtol < 0.0 || atol < 0.0)
+  {
+    throw std::invalid_argument("Error: input rtol or atol is negative.");
+  }
+
+  // Chunks of the windows
+  const size_t chunk = 4096;
+  std::vector<std::pair<size_t, size_t>> tasks; // (window, first point)
+  for (size_t k = 0; k < Nw; k++)
+  {
+    for (auto i = (size_t)offsets(k); i < (size_t)offsets(k + 1); i += chunk)
+    {
+      tasks.emplace_back(k, i);
+    }
+  }
+
+  // Partial (max abs, max rel, sum of squares, failures) of each chunk
+  xt::xtensor<double, 2> partial({tasks.size(), (size_t)4}, 0.0);
+  parallel_for(tasks.size(), [&](size_t t) {
+    auto k = tasks[t].first;
+    auto first = tasks[t].second;
+    auto last = std::min(first + chunk, (size_t)offsets(k + 1));
+    std::vector<double> fit((last - first) * Nv);
+    models[k]->evaluate(&s(first), last - first, fit.data());
+    double max_abs = 0.0, max_rel = 0.0, sum2 = 0.0;
+    long fails = 0;
+    for (auto i = first; i < last; i++)
+    {
+      bool fail = false;
+      for (size_t n = 0; n < Nv; n++)
+      {
+        double ref = f(n, i);
+        double err = std::abs(fit[(i - first) * Nv + n] - ref);
+        max_abs = std::max(max_abs, err);
+        if (ref != 0.0) max_rel = std::max(max_rel, err / std::abs(ref));
+        sum2 += err * err;
+        fail |= !(err <= atol + rtol * std::abs(ref));
+      }
+      fails += fail;
+    }
+    partial(t, 0) = max_abs;
+    partial(t, 1) = max_rel;
+    partial(t, 2) = sum2;
+    partial(t, 3) = fails;
+  });
+
+  // Reduce the chunks of each window
+  xt::xtensor<double, 2> errors({Nw, (size_t)3}, 0.0);
+  xt::xtensor<long, 1> failures({Nw}, 0);
+  for (size_t t = 0; t < tasks.size(); t++)
+  {
+    auto k = tasks[t].first;
+    errors(k, 0) = std::max(errors(k, 0), partial(t, 0));
+    errors(k, 1) = std::max(errors(k, 1), partial(t, 1));
+    errors(k, 2) += partial(t, 2);
+    failures(k) += (long)partial(t, 3);
+  }
+  for (size_t k = 0; k < Nw; k++)
+  {
+    auto count = Nv * (size_t)(offsets(k + 1) - offsets(k));
+    errors(k, 2) = count > 0 ? std::sqrt(errors(k, 2) / count) : 0.0;
+  }
+  return std::make_tuple(errors, failures);
+}
+
+
+//! Read-only view of a whole file, memory-mapped where available
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string &path)
+  {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Error: cannot open " + path + ".");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      throw std::runtime_error("Error: cannot stat " + path + ".");
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ > 0)
+    {
+      void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+      {
+        ::close(fd);
+        throw std::runtime_error("Error: cannot map " + path + ".");
+      }
+      ::madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(p);
+    }
+    ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+      throw std::runtime_error("Error: cannot open " + path + ".");
+    }
+    copy_.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+    data_ = copy_.data();
+    size_ = copy_.size();
+#endif
+  }
+
+  ~MappedFile()
+  {
+#ifndef _WIN32
+    if (data_ != nullptr) ::munmap(const_cast<char *>(data_), size_);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  std::string copy_;
+#endif
+};
+
+
+//! Integer of an ENDF field, blank being 0
+//!
+//! @param p          first character of the field
+//! @param n          width of the field
+//! @return           value
+
+long
+endf_int(const char *p, size_t n)
+{
+  size_t i = 0;
+  while (i < n && p[i] == ' ') i++;
+  bool negative = false;
+  if (i < n && (p[i] == '-' || p[i] == '+'))
+  {
+    negative = p[i] == '-';
+    i++;
+  }
+  long v = 0;
+  for (; i < n && p[i] >= '0' && p[i] <= '9'; i++) v = 10 * v + (p[i] - '0');
+  return negative ? -v : v;
+}
+
+
+//! Real number of an ENDF field, blank being 0
+//!
+//! Reads the Fortran forms of ENDF files, with or without the exponent
+//! letter (1.234567+5, -1.2345-10, 1.0E+5, 2.5D0, 12). When the decimal
+//! mantissa fits in 2^53 and the power of ten is exact, i.e. for the at
+//! most 10 significant digits of ENDF fields, the value is a single
+//! correctly rounded multiplication or division; other fields go through
+//! strtod.
+//!
+//! @param p          first character of the field
+//! @param n          width of the field
+//! @return           value
+
+double
+endf_float(const char *p, size_t n)
+{
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  size_t i = 0;
+  while (i < n && p[i] == ' ') i++;
+  if (i == n) return 0.0;
+  bool negative = false;
+  if (p[i] == '-' || p[i] == '+')
+  {
+    negative = p[i] == '-';
+    i++;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool point = false;
+  for (; i < n; i++)
+  {
+    char c = p[i];
+    if (c >= '0' && c <= '9')
+    {
+      if (mantissa == 0 && c == '0')
+      {
+        if (point) exponent--;
+        continue;
+      }
+      if (digits < 19)
+      {
+        mantissa = 10 * mantissa + (c - '0');
+        digits++;
+        if (point) exponent--;
+      }
+      else if (!point)
+      {
+        exponent++;
+      }
+    }
+    else if (c == '.' && !point)
+    {
+      point = true;
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (i < n && (p[i] == 'E' || p[i] == 'e' || p[i] == 'D' || p[i] == 'd'))
+  {
+    i++;
+  }
+  if (i < n && (p[i] == '+' || p[i] == '-'))
+  {
+    bool minus = p[i] == '-';
+    int e = 0;
+    for (i++; i < n && p[i] == ' '; i++) {}
+    for (; i < n && p[i] >= '0' && p[i] <= '9'; i++) e = 10 * e + (p[i] - '0');
+    exponent += minus ? -e : e;
+  }
+  else if (i < n && p[i] >= '0' && p[i] <= '9')
+  {
+    int e = 0;
+    for (; i < n && p[i] >= '0' && p[i] <= '9'; i++) e = 10 * e + (p[i] - '0');
+    exponent += e;
+  }
+
+  double v;
+  if (mantissa == 0)
+  {
+    v = 0.0;
+  }
+  else if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 &&
+           exponent <= 22)
+  {
+    v = exponent < 0 ? mantissa / pow10[-exponent]
+                     : mantissa * pow10[exponent];
+  }
+  else
+  {
+    std::string text = std::to_string(mantissa) + "e" +
+                       std::to_string(exponent);
+    v = std::strtod(text.c_str(), nullptr);
+  }
+  return negative ? -v : v;
+}
+
+
+//! Read the TAB1 sections of file mf of an ENDF file, packed
+//!
+//! The file is memory-mapped and its lines are indexed in one pass by their
+//! MAT, MF and MT numbers (columns 67-75) into sections. The control record
+//! of every TAB1 section gives its number of points, from which the points
+//! of all the sections get their place in the packed arrays; the data lines
+//! are then parsed in parallel chunks, straight into these arrays.
+//!
+//! @param path       path of the ENDF file, e.g. a PENDF tape
+//! @param mf         file number of the sections, e.g. 3 (cross sections)
+//! @param mts        section numbers to read, all of them if empty
+//! @return           packed sections
+
+Tab1Library
+read_tab1(const std::string &path, int mf, const std::vector<int> &mts)
+{
+  MappedFile file(path);
+  const char *data = file.data();
+  size_t size = file.size();
+
+  // Index the lines of the sections of file mf
+  struct Section
+  {
+    int mat, mt;
+    std::vector<const char *> lines;
+  };
+  std::vector<Section> sections;
+  size_t pos = 0;
+  while (pos < size)
+  {
+    const char *line = data + pos;
+    const char *end = static_cast<const char *>(
+        std::memchr(line, '\n', size - pos));
+    size_t length = end ? end - line : size - pos;
+    pos += length + 1;
+    if (length > 0 && line[length - 1] == '\r') length--;
+    if (length < 75) continue;
+    int line_mf = (int)endf_int(line + 70, 2);
+    int line_mt = (int)endf_int(line + 72, 3);
+    if (line_mf != mf || line_mt == 0) continue;
+    if (!mts.empty() &&
+        std::find(mts.begin(), mts.end(), line_mt) == mts.end()) continue;
+    int line_mat = (int)endf_int(line + 66, 4);
+    if (sections.empty() || sections.back().mat != line_mat ||
+        sections.back().mt != line_mt)
+    {
+      sections.push_back({line_mat, line_mt, {}});
+    }
+    sections.back().lines.push_back(line);
+  }
+
+  // Control records and places of the points
+  Tab1Library lib;
+  auto Nsec = sections.size();
+  std::vector<size_t> first_data(Nsec);
+  lib.offsets.assign(Nsec + 1, 0);
+  for (size_t k = 0; k < Nsec; k++)
+  {
+    const auto &lines = sections[k].lines;
+    auto where = " (MAT " + std::to_string(sections[k].mat) + ", MF " +
+                 std::to_string(mf) + ", MT " + std::to_string(sections[k].mt) +
+                 ")";
+    if (lines.size() < 2)
+    {
+      throw std::runtime_error("Error: truncated TAB1 section" + where + ".");
+    }
+    auto NR = endf_int(lines[1] + 44, 11);
+    auto NP = endf_int(lines[1] + 55, 11);
+    if (NR < 0 || NP < 0)
+    {
+      throw std::runtime_error("Error: invalid TAB1 record" + where + ".");
+    }
+    first_data[k] = 2 + (NR + 2) / 3;
+    if (lines.size() < first_data[k] + (NP + 2) / 3)
+    {
+      throw std::runtime_error("Error: truncated TAB1 section" + where + ".");
+    }
+
+    // A single interpolation law, or 0 for several regions
+    long law = 0;
+    for (long r = 0; r < NR; r++)
+    {
+      long code = endf_int(lines[2 + r / 3] + 22 * (r % 3) + 11, 11);
+      law = r == 0 ? code : (law == code ? law : 0);
+    }
+    lib.mat.push_back(sections[k].mat);
+    lib.mt.push_back(sections[k].mt);
+    lib.law.push_back((int)law);
+    lib.za.push_back(endf_float(lines[0], 11));
+    lib.awr.push_back(endf_float(lines[0] + 11, 11));
+    lib.qm.push_back(endf_float(lines[1], 11));
+    lib.qi.push_back(endf_float(lines[1] + 11, 11));
+    lib.offsets[k + 1] = lib.offsets[k] + NP;
+  }
+
+  // Data lines, three pairs each, in parallel chunks
+  lib.x.resize(lib.offsets[Nsec]);
+  lib.y.resize(lib.offsets[Nsec]);
+  const long chunk = 4096; // lines
+  std::vector<std::pair<size_t, long>> tasks; // (section, first line)
+  for (size_t k = 0; k < Nsec; k++)
+  {
+    long NP = lib.offsets[k + 1] - lib.offsets[k];
+    for (long j = 0; j < (NP + 2) / 3; j += chunk) tasks.emplace_back(k, j);
+  }
+  parallel_for(tasks.size(), [&](size_t t) {
+    auto k = tasks[t].first;
+    const auto &lines = sections[k].lines;
+    long NP = lib.offsets[k + 1] - lib.offsets[k];
+    long last = std::min(tasks[t].second + chunk, (NP + 2) / 3);
+    for (long j = tasks[t].second; j < last; j++)
+    {
+      const char *line = lines[first_data[k] + j];
+      for (long q = 0; q < 3 && 3 * j + q < NP; q++)
+      {
+        auto i = lib.offsets[k] + 3 * j + q;
+        lib.x[i] = endf_float(line + 22 * q, 11);
+        lib.y[i] = endf_float(line + 22 * q + 11, 11);
+      }
+    }
+  });
+  return lib;
+}
+
+
+Registry::Registry()
+  : node_(new Node {std::make_shared<const Map>()})
+{
+  readers_[0] = 0;
+  readers_[1] = 0;
+}
+
+
+Registry::~Registry()
+{
+  delete node_.load();
+}
+
+
+//! Current snapshot of the models
+//!
+//! The returned snapshot stays valid and unchanged while it is held, even
+//! if models are published or removed meanwhile. The read-side section
+//! only spans the copy of the reference, and never waits for writers.
+
+std::shared_ptr<const Registry::Map>
+Registry::snapshot() const
+{
+  auto &readers = readers_[epoch_.load() & 1];
+  readers++;
+  auto map = node_.load()->map;
+  readers--;
+  return map;
+}
+
+
+//! Publish map and release the replaced snapshot
+//!
+//! The grace period flips the epoch twice, waiting each time for the
+//! readers of the previous epoch to leave: a lookup which entered its
+//! section before the new node was published has then left it, and a later
+//! one can only load the new node. The replaced node is then deleted, and
+//! its map with it unless lookups still hold it.
+
+void
+Registry::swap_in(std::shared_ptr<const Map> map)
+{
+  auto old = node_.exchange(new Node {std::move(map)});
+  version_++;
+  for (int phase = 0; phase < 2; phase++)
+  {
+    auto &readers = readers_[epoch_.fetch_add(1) & 1];
+    while (readers.load() != 0)
+    {
+      std::this_thread::yield();
+    }
+  }
+  retired_.emplace_back(old->map);
+  delete old;
+  retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+                                [](const std::weak_ptr<const Map> &map) {
+                                  return map.expired();
+                                }),
+                 retired_.end());
+}
+
+
+void
+Registry::publish(const std::map<std::string, Model> &models)
+{
+  std::lock_guard<std::mutex> lock(write_);
+  auto map = std::make_shared<Map>(*node_.load()->map);
+  for (const auto &item : models)
+  {
+    (*map)[item.first] = std::make_shared<const Model>(item.second);
+  }
+  swap_in(std::move(map));
+}
+
+
+bool
+Registry::remove(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(write_);
+  auto current = node_.load()->map;
+  if (current->count(key) == 0)
+  {
+    return false;
+  }
+  auto map = std::make_shared<Map>(*current);
+  map->erase(key);
+  swap_in(std::move(map));
+  return true;
+}
+
+
+xt::xtensor<double, 2>
+Registry::evaluate(const std::string &key,
+                   const xt::xtensor<double, 1> &s) const
+{
+  auto map = snapshot();
+  auto it = map->find(key);
+  if (it == map->end())
+  {
+    throw std::out_of_range("Error: no model named " + key + ".");
+  }
+  return it->second->evaluate(s);
+}
+
+
+size_t
+Registry::retired() const
+{
+  std::lock_guard<std::mutex> lock(write_);
+  return std::count_if(retired_.begin(), retired_.end(),
+                       [](const std::weak_ptr<const Map> &map) {
+                         return !map.expired();
+                       });
+}
+
+
+Coalescer::Coalescer(const Registry &registry,
+                     std::chrono::microseconds window,
+                     size_t max_batch)
+  : registry_(registry), window_(window), max_batch_(max_batch)
+{
+  if (window.count() < 0)
+  {
+    throw std::invalid_argument("Error: input window is negative.");
+  }
+  if (max_batch < 1)
+  {
+    throw std::invalid_argument("Error: input max_batch is less than 1.");
+  }
+}
+
+
+xt::xtensor<double, 2>
+Coalescer::evaluate(const std::string &key, const xt::xtensor<double, 1> &s)
+{
+  Request request;
+  request.key = &key;
+  request.s = &s;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_.push_back(&request);
+  if (queue_.size() >= max_batch_)
+  {
+    cv_.notify_all();
+  }
+
+  if (!leader_)
+  {
+    // Lead the batch: collect requests for the window, then run them while
+    // the next batch forms
+    leader_ = true;
+    cv_.wait_for(lock, window_, [this]() {
+      return queue_.size() >= max_batch_;
+    });
+    std::vector<Request *> batch;
+    batch.swap(queue_);
+    leader_ = false;
+    lock.unlock();
+
+    // A failure is handed to all the requests, so that none of the
+    // callers waits forever
+    std::exception_ptr error;
+    try
+    {
+      run(batch);
     }
-    for (m = 0; m < Nc; m++)
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    batches_++;
+    requests_ += batch.size();
+
+    lock.lock();
+    for (auto r : batch)
+    {
+      r->error = error;
+      r->done = true;
+    }
+    cv_.notify_all();
+  }
+  else
+  {
+    cv_.wait(lock, [&request]() { return request.done; });
+  }
+  lock.unlock();
+
+  if (request.error)
+  {
+    std::rethrow_exception(request.error);
+  }
+  if (request.missing)
+  {
+    throw std::out_of_range("Error: no model named " + key + ".");
+  }
+  return std::move(request.result);
+}
+
+
+void
+Coalescer::run(const std::vector<Request *> &batch) const
+{
+  // Group the requests by model
+  std::map<std::string, std::vector<Request *>> groups;
+  for (auto r : batch)
+  {
+    groups[*r->key].push_back(r);
+  }
+
+  auto map = registry_.snapshot();
+  for (const auto &group : groups)
+  {
+    auto it = map->find(group.first);
+    if (it == map->end())
+    {
+      for (auto r : group.second) r->missing = true;
+      continue;
+    }
+
+    // One evaluation on the concatenated points
+    size_t Ns = 0;
+    for (auto r : group.second) Ns += r->s->size();
+    xt::xtensor<double, 1> s({Ns}, 0.0);
+    size_t offset = 0;
+    for (auto r : group.second)
     {
-      xt::view(Dk, xt::all(), N + m) = xt::pow(s, m) + 0.0i;
+      std::copy(r->s->begin(), r->s->end(), s.begin() + offset);
+      offset += r->s->size();
     }
+    auto f = it->second->evaluate(s);
+
+    offset = 0;
+    for (auto r : group.second)
+    {
+      auto n = r->s->size();
+      r->result = xt::view(f, xt::all(), xt::range(offset, offset + n));
+      offset += n;
+    }
+  }
+}
+
+
+#ifndef VECTFIT_NO_PYTHON
+//! Read-only numpy view of a tensor owned by a Python object
+//!
+//! The view keeps base alive and shares its memory, so that models can be
+//! passed to pickle protocol 5 (out-of-band buffers), DLPack consumers and
+//! the array interface without copying. It is read-only because a model
+//! must not change once its evaluation terms are built; exporting a
+//! read-only array through DLPack needs its versioned protocol, i.e. NumPy
+//! 2.1 or later, older versions raising BufferError.
+//!
+//! @param a          tensor
+//! @param base       Python object owning the tensor
+//! @return           view of a
+
+template<class T, size_t D>
+py::array_t<T>
+readonly_view(const xt::xtensor<T, D> &a, py::handle base)
+{
+  std::vector<py::ssize_t> shape(a.shape().begin(), a.shape().end());
+  std::vector<py::ssize_t> strides(D, sizeof(T));
+  for (size_t d = D; d-- > 1;)
+  {
+    strides[d - 1] = strides[d] * shape[d];
+  }
+  py::array_t<T> view(shape, strides, a.data(), base);
+  view.attr("flags").attr("writeable") = false;
+  return view;
+}
+
+
+//
+// Python Module and Docstrings
+//
+
+PYBIND11_MODULE(vectfit, m)
+{
+    xt::import_numpy();
+
+    m.doc() = R"pbdoc(
+        Vector Fitting Algorithm
+        -------------------------
+        .. currentmodule:: vectfit
+        .. autosummary::
+           :toctree: _generate
+
+           vectfit
+           vectfit_ragged
+           vectfit_batch
+           vectfit_series
+           vectfit_tiny
+           vectfit_distributed
+           evaluate
+           canonical_poles
+           stats
+           reset_stats
+           resonance_poles
+           Model
+           combine
+           integrate
+           lookup
+           validate
+           read_tab1
+           FitState
+           OnlineFit
+           Registry
+           Coalescer
+    )pbdoc";
+
+    m.def("vectfit", &vectfit, R"pbdoc(
+        Fast Relaxed Vector Fitting function
+
+        A robust numerical method for rational approximation. It updates the
+        poles and calculates residues based on guessed poles.
+
+        Parameters
+        ----------
+        f : numpy.ndarray
+            A 2D array of the sample signals to be fitted, (Nv, Ns)
+        s : numpy.ndarray
+            A 1D array of the sample points, (Ns)
+        poles : numpy.ndarray [complex]
+            Initial poles, real or complex conjugate pairs, (N)
+        weight : numpy.ndarray
+            2D array for weighting f, to control the accuracy of the
+            approximation, (Nv, Ns)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        skip_pole : bool
+            Whether or not to skip the calculation of poles
+        skip_res : bool
+            Whether or not to skip the calculation of residues (including the
+            polynomials)
+        n_minimax : int
+            Number of Lawson reweighting iterations applied to the residue
+            identification, which drive the fit towards the smallest maximum
+            weighted error instead of the least squares one
+        constrain : bool
+            Whether or not to constrain the relocated poles: the real parts
+            are clamped to the band of the sample points extended by margin
+            on each side, pairs closer to the real axis than min_imag are
+            lifted, and real poles inside the band are moved out of it. See
+            stats for how often it fires
+        margin : float
+            Extension of the band on each side, relative to its width
+        min_imag : float
+            Smallest distance of the poles from the real axis, relative to
+            the width of the band; positive, so that the real poles inside
+            the band are moved strictly outside of it
+
+        Returns
+        -------
+        Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float)
+            The updated poles, residues, polynomial coefficients,
+            fitted signals on the sample points, root mean square error
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("skip_pole") = false,
+    py::arg("skip_res") = false, py::arg("n_minimax") = 0,
+    py::arg("constrain") = false, py::arg("margin") = 0.5,
+    py::arg("min_imag") = 1e-6);
+
+    m.def("vectfit_ragged", &vectfit_ragged, R"pbdoc(
+        Fast Relaxed Vector Fitting on ragged sample grids
+
+        Same as vectfit, except that every response is sampled on its own
+        grid. All the responses are fitted with a common pole set.
+
+        Parameters
+        ----------
+        f : list of numpy.ndarray
+            Nv 1D arrays of the sample signals to be fitted, (Ns_n)
+        s : list of numpy.ndarray
+            Nv 1D arrays of the sample points of each signal, (Ns_n)
+        poles : numpy.ndarray [complex]
+            Initial poles, real or complex conjugate pairs, (N)
+        weight : list of numpy.ndarray
+            Nv 1D arrays for weighting each signal, (Ns_n)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        skip_pole : bool
+            Whether or not to skip the calculation of poles
+        skip_res : bool
+            Whether or not to skip the calculation of residues (including the
+            polynomials)
+        n_minimax : int
+            Number of Lawson reweighting iterations applied to the residue
+            identification, which drive the fit towards the smallest maximum
+            weighted error instead of the least squares one
+        constrain : bool
+            Whether or not to constrain the relocated poles: the real parts
+            are clamped to the band of the sample points extended by margin
+            on each side, pairs closer to the real axis than min_imag are
+            lifted, and real poles inside the band are moved out of it. See
+            stats for how often it fires
+        margin : float
+            Extension of the band on each side, relative to its width
+        min_imag : float
+            Smallest distance of the poles from the real axis, relative to
+            the width of the band; positive, so that the real poles inside
+            the band are moved strictly outside of it
+
+        Returns
+        -------
+        Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, list of numpy.ndarray, float)
+            The updated poles, residues, polynomial coefficients,
+            fitted signals on the sample points of each signal, root mean
+            square error over all the samples
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("skip_pole") = false,
+    py::arg("skip_res") = false, py::arg("n_minimax") = 0,
+    py::arg("constrain") = false, py::arg("margin") = 0.5,
+    py::arg("min_imag") = 1e-6);
+
+    m.def("vectfit_batch", &vectfit_batch, R"pbdoc(
+        Fast Relaxed Vector Fitting of a batch of independent problems
+
+        Every problem is fitted with n_iter pole relocations followed by the
+        residue identification, i.e. the results of n_iter successive calls
+        of vectfit, or fewer with rtol. The problems are fitted in parallel
+        by the threads of the process. When the module is built with MPI and
+        run on several ranks (each of them passing all the problems), they
+        are also distributed over the ranks with dynamic load balancing and
+        gathered on rank 0. The batch must then fit in the memory of one
+        node: a larger library is fitted in several batches.
+
+        Parameters
+        ----------
+        f : list of numpy.ndarray
+            2D arrays of the sample signals of each problem, (Nv_i, Ns_i)
+        s : list of numpy.ndarray
+            1D arrays of the sample points of each problem, (Ns_i)
+        poles : list of numpy.ndarray [complex]
+            Initial poles of each problem, (N_i)
+        weight : list of numpy.ndarray
+            2D arrays for weighting f of each problem, (Nv_i, Ns_i)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        n_iter : int
+            (Maximum) number of pole relocations of each problem
+        rtol : float
+            Relative change of the root mean square error from one pole set
+            to the next at which a problem stops iterating, 0 to always
+            relocate n_iter times. The residue identification which gives
+            the error then shares its basis with the next pole relocation
+
+        Returns
+        -------
+        list of Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float)
+            The poles, residues, polynomial coefficients, fitted signals and
+            root mean square error of each problem. With MPI, the entries of
+            the problems fitted on other ranks are None except on rank 0.
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("n_iter") = 1, py::arg("rtol") = 0.0);
+
+    m.def("vectfit_tiny", &vectfit_tiny, R"pbdoc(
+        Fast Relaxed Vector Fitting of a batch of tiny problems
+
+        Same as vectfit_batch without MPI, for many small problems (e.g. up
+        to 8 poles and 100 samples) which leave the SIMD registers mostly
+        empty when fitted one at a time. The problems of the same shape
+        (rows, samples, poles) are fitted side by side, one per SIMD lane,
+        including the QR factorizations, the sigma solve and the zeros of
+        sigma. A problem which diverges in its lane (infinite basis values,
+        an extreme D of sigma, a singular factorization) is fitted again by
+        the scalar path, as counted by stats.
+
+        Parameters
+        ----------
+        f : list of numpy.ndarray
+            2D arrays of the sample signals of each problem, (Nv_i, Ns_i)
+        s : list of numpy.ndarray
+            1D arrays of the sample points of each problem, (Ns_i)
+        poles : list of numpy.ndarray [complex]
+            Initial poles of each problem, (N_i)
+        weight : list of numpy.ndarray
+            2D arrays for weighting f of each problem, (Nv_i, Ns_i)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        n_iter : int
+            Number of pole relocations of each problem
+
+        Returns
+        -------
+        list of Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float)
+            The poles, residues, polynomial coefficients, fitted signals and
+            root mean square error of each problem
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("n_iter") = 1);
+
+    m.def("vectfit_series", &vectfit_series, R"pbdoc(
+        Fast Relaxed Vector Fitting of a temperature series
+
+        The same window at several temperatures is first fitted with a pole
+        set shared by all the temperatures, as the rows of one problem, so
+        that a temperature set costs about one fit; the factorizations of
+        the weighted basis are shared between the rows with the same
+        weights. A temperature whose shared fit misses tol is refitted on
+        its own, warm-started from the poles of the previous temperature,
+        and keeps the better of the two fits.
+
+        Parameters
+        ----------
+        f : list of numpy.ndarray
+            2D arrays of the sample signals of each temperature, ordered by
+            temperature, (Nv, Ns)
+        s : numpy.ndarray
+            A 1D array of the sample points, (Ns)
+        poles : numpy.ndarray [complex]
+            Initial poles, real or complex conjugate pairs, (N)
+        weight : list of numpy.ndarray
+            2D arrays for weighting the signals of each temperature, (Nv, Ns)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        n_iter : int
+            Number of pole relocations of each fit
+        tol : float
+            RMS error accepted for the shared poles, relative to the RMS of
+            the signals of the temperature
+
+        Returns
+        -------
+        list of Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float, bool)
+            For each temperature the poles, residues, polynomial
+            coefficients, fitted signals on the sample points, root mean
+            square error, and whether the poles are the shared ones
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("n_iter") = 1, py::arg("tol") = 1e-3);
+
+    m.def("vectfit_distributed", &vectfit_distributed, R"pbdoc(
+        Fast Relaxed Vector Fitting of one problem with distributed samples
+
+        Every MPI rank passes its own block of the sample points, with the
+        matching columns of f and weight, and the same poles and options. The
+        least squares problems are solved by TSQR: the R factors of the local
+        blocks are merged over the ranks and only the small reduced systems
+        are solved, so no rank holds the full problem. The function must be
+        called by all the ranks. Without MPI, or on a single rank, it returns
+        the results of n_iter successive calls of vectfit.
+
+        Parameters
+        ----------
+        f : numpy.ndarray
+            A 2D array of the local sample signals, (Nv, Ns_r)
+        s : numpy.ndarray
+            A 1D array of the local sample points, (Ns_r)
+        poles : numpy.ndarray [complex]
+            Initial poles, (N)
+        weight : numpy.ndarray
+            A 2D array for weighting the local samples of f, (Nv, Ns_r)
+        n_polys : int
+            Number of polynomial coefficients to be fitted, [0, 11]
+        n_iter : int
+            Number of pole relocations
+
+        Returns
+        -------
+        Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float)
+            The poles, residues and polynomial coefficients, identical on all
+            ranks, the fitted signals on the local sample points, and the
+            root mean square error over the samples of all ranks.
+
+    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
+    py::arg("n_polys") = 0, py::arg("n_iter") = 1);
+
+    m.def("canonical_poles", [](xt::pyarray<std::complex<double>> poles) {
+        if (poles.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input poles is not "
+                                      "1-dimensional.");
+        }
+        return xt::pyarray<std::complex<double>>(canonical_poles(poles));
+    }, R"pbdoc(
+        Poles in canonical order, as exact conjugate pairs
+
+        Matches the poles with positive and negative imaginary parts by
+        nearest conjugate, symmetrizes each pair, makes the poles left
+        without a partner real, and sorts by real part. vectfit returns its
+        relocated poles in this form.
+
+        Parameters
+        ----------
+        poles : numpy.ndarray [complex]
+            A 1D array of poles in any order, (N)
+
+        Returns
+        -------
+        poles : numpy.ndarray [complex]
+            Real poles and (p, conj(p)) pairs sorted by real part, (N)
+
+    )pbdoc", py::arg("poles"));
+
+    m.def("stats", []() {
+        py::dict d;
+        d["inf_clamps"] = counters.inf_clamps.load();
+        d["tol_fallbacks"] = counters.tol_fallbacks.load();
+        d["rank_deficient"] = counters.rank_deficient.load();
+        d["poles_lifted"] = counters.poles_lifted.load();
+        d["poles_relocated"] = counters.poles_relocated.load();
+        d["tiny_fallbacks"] = counters.tiny_fallbacks.load();
+        return d;
+    }, R"pbdoc(
+        Counts of the numerical safeguards triggered since the last reset
+
+        Returns
+        -------
+        dict
+            inf_clamps: infinite basis values clamped in the pole step,
+            tol_fallbacks: non-relaxed re-solves after an extreme D of sigma,
+            rank_deficient: rank deficient least squares problems,
+            poles_lifted: poles moved away from the real axis and
+            poles_relocated: poles moved back into the band by the constraint
+            stage of vectfit, tiny_fallbacks: problems of vectfit_tiny
+            refitted by the scalar path
+
+    )pbdoc");
+
+    m.def("reset_stats", []() {
+        counters.inf_clamps = 0;
+        counters.tol_fallbacks = 0;
+        counters.rank_deficient = 0;
+        counters.poles_lifted = 0;
+        counters.poles_relocated = 0;
+        counters.tiny_fallbacks = 0;
+    }, "Reset the counts of stats");
+
+    m.def("evaluate", &evaluate, R"pbdoc(
+        Multipole formalism evaluation function
+
+        Evaluate the multipole formalism at given points with known poles,
+        residues and polynomial coefficients.
+
+        Parameters
+        ----------
+        s : numpy.ndarray
+            A 1D array of the points, (Ns)
+        poles : numpy.ndarray [complex]
+            A 1D array of the poles, (N)
+        residues : numpy.ndarray [complex]
+            2D array of residues, (Nv, N)
+        polys : numpy.ndarray
+            Polynomial coefficients (0-th to Nc-th order), (Nv, Nc)
+
+        Returns
+        -------
+        f : numpy.ndarray
+            the result array of multipole formalism (real part)
+
+    )pbdoc", py::arg("s"), py::arg("poles"), py::arg("residues"),
+    py::arg("polys") = (xt::pyarray<double>) {});
+
+    m.def("resonance_poles", &resonance_poles, R"pbdoc(
+        Initial poles from resonance parameters
+
+        Convert resonance energies and widths into conjugate pole pairs in
+        the fitting variable, ready to be used as the initial poles of
+        vectfit. Near-coincident pairs are merged and the set is padded with
+        background pairs spread over the sampled band.
+
+        Parameters
+        ----------
+        energies : numpy.ndarray
+            A 1D array of the resonance energies, (Nr)
+        widths : numpy.ndarray
+            A 1D array of the resonance total widths, (Nr)
+        s_min : float
+            Lower bound of the sample points
+        s_max : float
+            Upper bound of the sample points
+        n_poles : int
+            Total number of poles after padding with background poles, or 0
+            for no padding. Raises ValueError if the distinct resonances
+            give more poles than n_poles
+        sqrt_transform : bool
+            Whether the sample points are the square root of energy
+        tol : float
+            Relative distance under which two pole pairs are merged
+
+        Returns
+        -------
+        poles : numpy.ndarray [complex]
+            Conjugate pole pairs sorted by real part, (N)
+
+    )pbdoc", py::arg("energies"), py::arg("widths"), py::arg("s_min"),
+    py::arg("s_max"), py::arg("n_poles") = 0, py::arg("sqrt_transform") = false,
+    py::arg("tol") = 1e-3);
+
+    py::class_<Model>(m, "Model", R"pbdoc(
+        Pole-residue model
+
+        f(s) = REAL[residues/(s - poles)] + Polynomials(s), e.g. built from
+        the results of vectfit. Models support linear combinations with
+        +, - and scalar *, which merge identical poles. The poles, residues
+        and polys are read-only views of the model, which can be handed to
+        other array libraries (DLPack, array interface) and pickled out of
+        band (protocol 5) without copies. DLPack export of read-only arrays
+        requires NumPy 2.1 or later (versioned DLPack); older versions, and
+        consumers of unversioned DLPack, raise BufferError.
+
+        Parameters
+        ----------
+        poles : numpy.ndarray [complex]
+            A 1D array of the poles, real or complex conjugate pairs, (N)
+        residues : numpy.ndarray [complex]
+            2D array of residues, (Nv, N)
+        polys : numpy.ndarray
+            Polynomial coefficients (0-th to Nc-th order), (Nv, Nc)
+
+    )pbdoc")
+    .def(py::init(&make_model), py::arg("poles"), py::arg("residues"),
+         py::arg("polys") = (xt::pyarray<double>) {})
+    .def_property_readonly("poles", [](py::object self) {
+        return readonly_view(self.cast<const Model &>().poles, self);
+    }, "Poles, (N), a read-only view of the model")
+    .def_property_readonly("residues", [](py::object self) {
+        return readonly_view(self.cast<const Model &>().residues, self);
+    }, "Residues, (Nv, N), a read-only view of the model")
+    .def_property_readonly("polys", [](py::object self) {
+        return readonly_view(self.cast<const Model &>().polys, self);
+    }, "Polynomial coefficients, (Nv, Nc), a read-only view of the model")
+    .def("__reduce_ex__", [](py::object self, int protocol) {
+        return py::make_tuple(self.attr("__class__"),
+                              py::make_tuple(self.attr("poles"),
+                                             self.attr("residues"),
+                                             self.attr("polys")));
+    }, R"pbdoc(
+        Pickle support
+
+        The model is pickled as its three arrays, which are views of the
+        model; with protocol 5 and a buffer_callback they are passed out of
+        band without being copied.
+
+    )pbdoc", py::arg("protocol"))
+    .def("evaluate", [](const Model &self, xt::pyarray<double> s) {
+        if (s.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input s is not 1-dimensional.");
+        }
+        return xt::pyarray<double>(multipole(s, self.poles, self.residues,
+                                             self.polys));
+    }, R"pbdoc(
+        Evaluate the model
+
+        Parameters
+        ----------
+        s : numpy.ndarray
+            A 1D array of the points, (Ns)
 
-    xt::xtensor<double, 2> Cr({Nv, N}, 0.0);
-    for (n = 0; n < Nv; n++)
-    {
-      xt::xtensor<std::complex<double>, 2> A1({Ns, N + Nc}, C_ZERO);
-      for (m = 0; m < N + Nc; m++)
-      {
-        xt::view(A1, xt::all(), m) = xt::view(weight, n) *
-                                     xt::view(Dk, xt::all(), m);
-      }
-      auto A = xt::xtensor<double, 2>(xt::concatenate(xt::xtuple(xt::real(A1),
-                                                      xt::imag(A1))));
-      auto b1 = xt::view(weight, n) * xt::view(f, n);
-      auto b = xt::xtensor<double, 1>(xt::concatenate(xt::xtuple(xt::real(b1),
-                                                      xt::imag(b1))));
+        Returns
+        -------
+        f : numpy.ndarray
+            the result array of multipole formalism (real part), (Nv, Ns)
 
-      xt::xtensor<double, 1> Escale({N + Nc}, 0.0);
-      for (m = 0; m < N + Nc; m++)
-      {
-        xt::view(Escale, m) = 1.0 / xt::linalg::norm(xt::view(A, xt::all(), m));
-        xt::view(A, xt::all(), m) *= Escale(m);
-      }
+    )pbdoc", py::arg("s"))
+    .def("evaluate_point", [](const Model &self, double s) {
+        xt::pyarray<double> f = xt::zeros<double>({self.residues.shape()[0]});
+        self.evaluate(s, f.data());
+        return f;
+    }, R"pbdoc(
+        Evaluate the model at a single point
 
-      auto results = xt::linalg::lstsq(A, b);
-      auto x = std::get<0>(results);
-      x *= Escale;
+        A latency-oriented path for one point at a time, vectorized across
+        the poles instead of the points.
 
-      xt::view(Cr, n) = xt::view(x, xt::range(0, N));
+        Parameters
+        ----------
+        s : float
+            The point
 
-      if (Nc > 0)
-      {
-        xt::view(polys, n) = xt::view(x, xt::range(N, N + Nc));
-      }
-    }
+        Returns
+        -------
+        f : numpy.ndarray
+            the result array of multipole formalism (real part), (Nv)
 
-    // Get complex residues
-    for (m = 0; m < N; m++)
-    {
-      if (cindex(m) == 0)
-      {
-        for (n = 0; n < Nv; n++)
+    )pbdoc", py::arg("s"))
+    .def("prune", &prune, R"pbdoc(
+        Remove the insignificant conjugate pairs
+
+        Parameters
+        ----------
+        tol : float
+            Peak contribution, relative to the largest one, under which a
+            conjugate pair is removed
+
+        Returns
+        -------
+        Model
+            The pruned model
+
+    )pbdoc", py::arg("tol"))
+    .def("__add__", [](const Model &a, const Model &b) {
+        return combine({a, b}, {1.0, 1.0});
+    })
+    .def("__sub__", [](const Model &a, const Model &b) {
+        return combine({a, b}, {1.0, -1.0});
+    })
+    .def("__mul__", [](const Model &a, double c) {
+        return combine({a}, {c});
+    })
+    .def("__rmul__", [](const Model &a, double c) {
+        return combine({a}, {c});
+    })
+    .def("__neg__", [](const Model &a) {
+        return combine({a}, {-1.0});
+    });
+
+    m.def("combine", &combine, R"pbdoc(
+        Linear combination of pole-residue models
+
+        The sum of pole-residue models is a pole-residue model on the union of
+        their poles, obtained without refitting. Poles closer than tol
+        (relative) are merged by adding their residues.
+
+        Parameters
+        ----------
+        models : list of Model
+            Models to be combined, all with the same number of rows
+        coefs : list of float
+            Coefficient of each model
+        tol : float
+            Relative distance under which two poles are merged
+
+        Returns
+        -------
+        Model
+            The combined model
+
+    )pbdoc", py::arg("models"), py::arg("coefs"), py::arg("tol") = 0.0);
+
+    m.def("integrate", [](const Model &model, xt::pyarray<double> edges,
+                          std::string weight_function, bool sqrt_transform) {
+        if (edges.dimension() != 1)
         {
-          residues(n, m) = std::complex<double>(Cr(n, m));
+          throw std::invalid_argument("Error: input edges is not "
+                                      "1-dimensional.");
         }
-      }
-      else if (cindex(m) == 1)
-      {
-        for (n = 0; n < Nv; n++)
+        auto results = integrate(model, edges, weight_function,
+                                 sqrt_transform);
+        return std::make_tuple(xt::pyarray<double>(std::get<0>(results)),
+                               xt::pyarray<double>(std::get<1>(results)));
+    }, R"pbdoc(
+        Analytic group integrals of a pole-residue model
+
+        Integrates the model over each group [E_g, E_g+1] in closed form,
+        optionally with a 1/E weighting and with the model variable being
+        s = sqrt(E), and computes the weighted group averages.
+
+        Parameters
+        ----------
+        model : Model
+            The pole-residue model
+        edges : numpy.ndarray
+            A 1D array of the increasing group boundaries in E, (G+1)
+        weight_function : str
+            "constant" or "1/E", the latter for models without a pole at 0
+        sqrt_transform : bool
+            Whether the model variable is the square root of E
+
+        Returns
+        -------
+        Tuple : (numpy.ndarray, numpy.ndarray)
+            The group integrals of f(E)w(E) and the group averages of f
+            weighted by w, (Nv, G)
+
+    )pbdoc", py::arg("model"), py::arg("edges"),
+    py::arg("weight_function") = "constant", py::arg("sqrt_transform") = false);
+
+    m.def("lookup", [](py::list models, xt::pyarray<long> index,
+                       xt::pyarray<double> s) {
+        if (index.dimension() != 1 || s.dimension() != 1)
         {
-          auto r1 = Cr(n, m);
-          auto r2 = Cr(n, m + 1);
-          residues(n, m) = r1 + 1i * r2;
-          residues(n, m + 1) = r1 - 1i * r2;
+          throw std::invalid_argument("Error: inputs index and s are not "
+                                      "1-dimensional.");
         }
-      }
-    }
+        std::vector<const Model *> ptrs;
+        for (auto item : models)
+        {
+          ptrs.push_back(&item.cast<const Model &>());
+        }
+        xt::xtensor<long, 1> k = index;
+        xt::xtensor<double, 1> points = s;
+        xt::xtensor<double, 2> f;
+        {
+          py::gil_scoped_release release;
+          f = lookup(ptrs, k, points);
+        }
+        return xt::pyarray<double>(f);
+    }, R"pbdoc(
+        Evaluate a batch of (model, point) queries
 
-    // Calculate fit on s
-    fit = evaluate(s, poles, residues, polys);
+        The queries may come in any order. They are bucketed by model and
+        sorted by point, evaluated in parallel chunks by the vectorized
+        kernel, and the results are returned in the order of the queries.
 
-    // RMS error
-    rmserr = xt::linalg::norm(fit - f) / std::sqrt(Nv * Ns);
-  }
+        Parameters
+        ----------
+        models : list of Model
+            Models, all with the same number of rows
+        index : numpy.ndarray [int]
+            A 1D array of the model index of each query, (Nq)
+        s : numpy.ndarray
+            A 1D array of the point of each query, (Nq)
 
-  // Return a tuple including the updated results
-  return std::make_tuple(poles, residues, polys, fit, rmserr);
-}
+        Returns
+        -------
+        f : numpy.ndarray
+            The model values of each query, (Nv, Nq)
 
+    )pbdoc", py::arg("models"), py::arg("index"), py::arg("s"));
 
-//
-// Python Module and Docstrings
-//
-namespace py = pybind11;
+    m.def("validate", [](py::list models, xt::pyarray<long> offsets,
+                         xt::pyarray<double> s, xt::pyarray<double> f,
+                         double rtol, double atol) {
+        if (offsets.dimension() != 1 || s.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: inputs offsets and s are not "
+                                      "1-dimensional.");
+        }
+        if (f.dimension() != 2)
+        {
+          throw std::invalid_argument("Error: input f is not 2-dimensional.");
+        }
+        std::vector<const Model *> ptrs;
+        for (auto item : models)
+        {
+          ptrs.push_back(&item.cast<const Model &>());
+        }
+        xt::xtensor<long, 1> k = offsets;
+        xt::xtensor<double, 1> points = s;
+        xt::xtensor<double, 2> ref = f;
+        std::tuple<xt::xtensor<double, 2>, xt::xtensor<long, 1>> result;
+        {
+          py::gil_scoped_release release;
+          result = validate(ptrs, k, points, ref, rtol, atol);
+        }
+        const auto &errors = std::get<0>(result);
+        const auto &failures = std::get<1>(result);
+        auto Nw = ptrs.size();
 
-PYBIND11_MODULE(vectfit, m)
-{
-    xt::import_numpy();
+        // Aggregate over the library
+        double max_abs = 0.0, max_rel = 0.0, sum2 = 0.0;
+        long n_failures = 0, n_passed = 0;
+        xt::pyarray<bool> passed = xt::zeros<bool>({Nw});
+        for (size_t w = 0; w < Nw; w++)
+        {
+          auto count = ref.shape()[0] * (size_t)(k(w + 1) - k(w));
+          max_abs = std::max(max_abs, errors(w, 0));
+          max_rel = std::max(max_rel, errors(w, 1));
+          sum2 += errors(w, 2) * errors(w, 2) * count;
+          n_failures += failures(w);
+          passed(w) = failures(w) == 0;
+          n_passed += passed(w);
+        }
+        auto total = ref.size();
 
-    m.doc() = R"pbdoc(
-        Vector Fitting Algorithm
-        -------------------------
-        .. currentmodule:: vectfit
-        .. autosummary::
-           :toctree: _generate
+        py::dict d;
+        d["max_abs"] = xt::pyarray<double>(xt::view(errors, xt::all(), 0));
+        d["max_rel"] = xt::pyarray<double>(xt::view(errors, xt::all(), 1));
+        d["rms"] = xt::pyarray<double>(xt::view(errors, xt::all(), 2));
+        d["failures"] = xt::pyarray<long>(failures);
+        d["passed"] = passed;
+        py::dict all;
+        all["windows"] = Nw;
+        all["passed"] = n_passed;
+        all["points"] = points.size();
+        all["failures"] = n_failures;
+        all["max_abs"] = max_abs;
+        all["max_rel"] = max_rel;
+        all["rms"] = total > 0 ? std::sqrt(sum2 / total) : 0.0;
+        d["aggregate"] = all;
+        return d;
+    }, R"pbdoc(
+        Compare fitted models with reference data, window by window
 
-           vectfit
-           evaluate
-    )pbdoc";
+        The reference points of all the windows are packed in one array,
+        window k owning s[offsets[k]:offsets[k+1]]. The windows are
+        evaluated and compared in parallel, point by point, without storing
+        the fits. A point fails if |fit - f| > atol + rtol |f| for any row.
 
-    m.def("vectfit", &vectfit, R"pbdoc(
-        Fast Relaxed Vector Fitting function
+        Parameters
+        ----------
+        models : list of Model
+            Model of each window, all with the same number of rows, (Nw)
+        offsets : numpy.ndarray [int]
+            First point of each window followed by the number of points,
+            (Nw + 1)
+        s : numpy.ndarray
+            A 1D array of the reference points of all the windows, (Np)
+        f : numpy.ndarray
+            A 2D array of the reference values, (Nv, Np)
+        rtol : float
+            Relative tolerance
+        atol : float
+            Absolute tolerance
 
-        A robust numerical method for rational approximation. It updates the
-        poles and calculates residues based on guessed poles.
+        Returns
+        -------
+        dict
+            Per window arrays max_abs, max_rel (over the nonzero reference
+            values) and rms errors, failures (number of failing points) and
+            passed, and an aggregate dict of the same statistics over the
+            library with the numbers of windows, passed windows and points
+
+    )pbdoc", py::arg("models"), py::arg("offsets"), py::arg("s"),
+    py::arg("f"), py::arg("rtol") = 1e-3, py::arg("atol") = 0.0);
+
+    m.def("read_tab1", [](const std::string &path, int mf,
+                          const std::vector<int> &mt) {
+        auto lib = std::make_shared<Tab1Library>();
+        {
+          py::gil_scoped_release release;
+          *lib = read_tab1(path, mf, mt);
+        }
+
+        // The arrays share the buffers of lib, kept alive by a capsule
+        auto holder = new std::shared_ptr<Tab1Library>(lib);
+        py::capsule base(holder, [](void *p) {
+          delete static_cast<std::shared_ptr<Tab1Library> *>(p);
+        });
+        auto array = [&](auto &v) {
+          using T = typename std::decay_t<decltype(v)>::value_type;
+          return py::array_t<T>(v.size(), v.data(), base);
+        };
+        py::dict d;
+        d["mat"] = array(lib->mat);
+        d["mt"] = array(lib->mt);
+        d["law"] = array(lib->law);
+        d["za"] = array(lib->za);
+        d["awr"] = array(lib->awr);
+        d["qm"] = array(lib->qm);
+        d["qi"] = array(lib->qi);
+        d["offsets"] = array(lib->offsets);
+        d["x"] = array(lib->x);
+        d["y"] = array(lib->y);
+        return d;
+    }, R"pbdoc(
+        Read the tabulated (TAB1) sections of an ENDF file
+
+        Reads pointwise data such as the linearized cross sections of a
+        PENDF tape. The file is memory-mapped, its sections are indexed in
+        one pass and their points are parsed in parallel, without the GIL,
+        into arrays packing the sections one after another: section k owns
+        x[offsets[k]:offsets[k+1]]. np.split(x, offsets[1:-1]) gives views
+        of the sections, ready to be passed as s to vectfit_batch or
+        vectfit_tiny; those of y are 1D, and are passed as f as single-row
+        views y[None, :], since f must be 2D.
 
         Parameters
         ----------
-        f : numpy.ndarray
-            A 2D array of the sample signals to be fitted, (Nv, Ns)
+        path : str
+            Path of the ENDF file
+        mf : int
+            File number of the sections, e.g. 3 for cross sections
+        mt : list of int
+            Section numbers to read, all of them if empty
+
+        Returns
+        -------
+        dict
+            Per section arrays mat, mt, law (interpolation law, 0 if there
+            are several interpolation regions), za, awr, qm and qi, the
+            offsets of the sections (Nsec + 1), and the packed points x and
+            values y
+
+    )pbdoc", py::arg("path"), py::arg("mf") = 3,
+    py::arg("mt") = std::vector<int> {});
+
+    py::class_<FitState>(m, "FitState", R"pbdoc(
+        Fit of a model on samples, updated incrementally by pole edits
+
+        Caches the fit of the model on the sample points with its error
+        metrics. Changing, adding or removing one real pole or conjugate
+        pair updates them by subtracting the old term and adding the new
+        one, at the cost of one term instead of a full evaluation.
+
+        Parameters
+        ----------
+        model : Model
+            The initial model
         s : numpy.ndarray
             A 1D array of the sample points, (Ns)
+        f : numpy.ndarray
+            A 2D array of the sample signals, (Nv, Ns)
+        weight : numpy.ndarray
+            A 2D array of the weights for max_error, (Nv, Ns), or empty for
+            unit weights
+
+    )pbdoc")
+    .def(py::init([](const Model &model, xt::pyarray<double> s,
+                     xt::pyarray<double> f, xt::pyarray<double> weight) {
+        if (s.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input s is not 1-dimensional.");
+        }
+        if (f.dimension() != 2)
+        {
+          throw std::invalid_argument("Error: input f is not 2-dimensional.");
+        }
+        xt::xtensor<double, 2> w = xt::ones<double>({f.shape()[0],
+                                                     f.shape()[1]});
+        if (weight.size() != 0)
+        {
+          if (weight.shape() != f.shape())
+          {
+            throw std::invalid_argument("Error: shape of weight does not "
+                                        "match shape of f.");
+          }
+          w = weight;
+        }
+        return new FitState(model, s, f, w);
+    }), py::arg("model"), py::arg("s"), py::arg("f"),
+    py::arg("weight") = (xt::pyarray<double>) {})
+    .def("set_pole", [](FitState &self, size_t m, std::complex<double> pole,
+                        xt::pyarray<std::complex<double>> residues) {
+        if (residues.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input residues is not "
+                                      "1-dimensional.");
+        }
+        self.set_pole(m, pole, residues);
+    }, R"pbdoc(
+        Replace a real pole or a conjugate pair
+
+        Parameters
+        ----------
+        m : int
+            Index of the pole, or of either pole of the pair
+        pole : complex
+            New pole, real for a real pole and complex for a pair
+        residues : numpy.ndarray [complex]
+            Residues of the new pole, (Nv)
+
+    )pbdoc", py::arg("m"), py::arg("pole"), py::arg("residues"))
+    .def("add_pole", [](FitState &self, std::complex<double> pole,
+                        xt::pyarray<std::complex<double>> residues) {
+        if (residues.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input residues is not "
+                                      "1-dimensional.");
+        }
+        self.add_pole(pole, residues);
+    }, R"pbdoc(
+        Append a real pole or a conjugate pair
+
+        Parameters
+        ----------
+        pole : complex
+            New pole, complex for a pair (pole, conj(pole))
+        residues : numpy.ndarray [complex]
+            Residues of the new pole, (Nv)
+
+    )pbdoc", py::arg("pole"), py::arg("residues"))
+    .def("remove_pole", &FitState::remove_pole, R"pbdoc(
+        Remove a real pole or a conjugate pair
+
+        Parameters
+        ----------
+        m : int
+            Index of the pole, or of either pole of the pair
+
+    )pbdoc", py::arg("m"))
+    .def("refresh", &FitState::refresh,
+         "Recompute the fit from scratch, discarding accumulated rounding")
+    .def_property_readonly("model", [](const FitState &self) {
+        return Model(self.model());
+    }, "Current model")
+    .def_property_readonly("fit", [](const FitState &self) {
+        return xt::pyarray<double>(self.fit());
+    }, "Fitted signals on the sample points, (Nv, Ns)")
+    .def_property_readonly("rmserr", &FitState::rmserr,
+                           "Root mean square error between f and the fit")
+    .def_property_readonly("max_error", &FitState::max_error,
+                           "Maximum weighted error |weight*(fit - f)|");
+
+    py::class_<OnlineFit>(m, "OnlineFit", R"pbdoc(
+        Online vector fitting of streamed samples
+
+        Keeps the least squares problems of vector fitting as triangular
+        factors updated sample by sample, with exponential forgetting of
+        the older samples. The poles are relocated every relocate_every
+        samples (or on request) from the factors, which are then rebuilt
+        from the latest window samples, so that the cost does not grow with
+        the length of the stream.
+
+        Parameters
+        ----------
         poles : numpy.ndarray [complex]
             Initial poles, real or complex conjugate pairs, (N)
-        weight : numpy.ndarray
-            2D array for weighting f, to control the accuracy of the
-            approximation, (Nv, Ns)
+        n_rows : int
+            Number of rows (responses) of every sample, Nv
         n_polys : int
             Number of polynomial coefficients to be fitted, [0, 11]
-        skip_pole : bool
-            Whether or not to skip the calculation of poles
-        skip_res : bool
-            Whether or not to skip the calculation of residues (including the
-            polynomials)
+        forgetting : float
+            Forgetting factor in (0, 1], 1 keeping all the samples
+        window : int
+            Number of latest samples buffered for the relocations
+        relocate_every : int
+            Number of samples between automatic relocations, 0 for none
+
+    )pbdoc")
+    .def(py::init([](xt::pyarray<std::complex<double>> poles, size_t n_rows,
+                     int n_polys, double forgetting, size_t window,
+                     size_t relocate_every) {
+        if (poles.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input poles is not "
+                                      "1-dimensional.");
+        }
+        if (n_polys < 0)
+        {
+          throw std::invalid_argument("Error: input n_polys is not in range "
+                                      "[0, 11].");
+        }
+        return new OnlineFit(poles, n_rows, n_polys, forgetting, window,
+                             relocate_every);
+    }), py::arg("poles"), py::arg("n_rows") = 1, py::arg("n_polys") = 0,
+    py::arg("forgetting") = 1.0, py::arg("window") = 1000,
+    py::arg("relocate_every") = 0)
+    .def("update", [](OnlineFit &self, xt::pyarray<double> s,
+                      xt::pyarray<double> f, xt::pyarray<double> weight) {
+        auto Ns = s.size();
+        auto Nv = self.rows();
+        if (s.dimension() > 1 || f.size() != Nv * Ns ||
+            (weight.size() != 0 && weight.size() != Nv * Ns))
+        {
+          throw std::invalid_argument("Error: shapes of s, f and weight do "
+                                      "not match.");
+        }
+        xt::xarray<double> S = s;
+        xt::xarray<double> F = f;
+        xt::xarray<double> W = xt::ones<double>({Nv, Ns});
+        if (weight.size() != 0)
+        {
+          W = weight;
+        }
+        S.reshape({Ns});
+        F.reshape({Nv, Ns});
+        W.reshape({Nv, Ns});
+        py::gil_scoped_release release;
+        std::vector<double> fk(Nv), wk(Nv);
+        for (size_t k = 0; k < Ns; k++)
+        {
+          for (size_t n = 0; n < Nv; n++)
+          {
+            fk[n] = F(n, k);
+            wk[n] = W(n, k);
+          }
+          self.update(S(k), fk.data(), wk.data());
+        }
+    }, R"pbdoc(
+        Add samples, in order of arrival
+
+        Parameters
+        ----------
+        s : numpy.ndarray
+            Sample points, (Ns)
+        f : numpy.ndarray
+            Samples of every row, (Nv, Ns)
+        weight : numpy.ndarray
+            Weights of the samples, (Nv, Ns), or empty for unit weights
+
+    )pbdoc", py::arg("s"), py::arg("f"),
+    py::arg("weight") = (xt::pyarray<double>) {})
+    .def("relocate", [](OnlineFit &self) {
+        py::gil_scoped_release release;
+        return self.relocate();
+    }, R"pbdoc(
+        Relocate the poles now
 
         Returns
         -------
-        Tuple : (numpy.ndarray [complex], numpy.ndarray [complex], numpy.ndarray, numpy.ndarray, float)
-            The updated poles, residues, polynomial coefficients,
-            fitted signals on the sample points, root mean square error
+        bool
+            False if too few samples were buffered to relocate
 
-    )pbdoc", py::arg("f"), py::arg("s"), py::arg("poles"), py::arg("weight"),
-    py::arg("n_polys") = 0, py::arg("skip_pole") = false,
-    py::arg("skip_res") = false);
+    )pbdoc")
+    .def_property_readonly("model", &OnlineFit::model,
+                           "Current model")
+    .def_property_readonly("poles", [](const OnlineFit &self) {
+        return xt::pyarray<std::complex<double>>(self.poles());
+    }, "Current poles, (N)")
+    .def_property_readonly("count", &OnlineFit::count,
+                           "Number of samples received");
 
-    m.def("evaluate", &evaluate, R"pbdoc(
-        Multipole formalism evaluation function
+    py::class_<Registry>(m, "Registry", R"pbdoc(
+        Registry of named models, hot-swappable under concurrent lookups
 
-        Evaluate the multipole formalism at given points with known poles,
-        residues and polynomial coefficients.
+        Lookups evaluate against an immutable snapshot of the registry
+        without locking, from any number of threads, while refitted models
+        are published. A lookup sees either the old or the new version of a
+        model, never a partial update. Old versions are freed by the update
+        which replaces them, or by the last lookup still using them.
+
+    )pbdoc")
+    .def(py::init<>())
+    .def("publish", [](Registry &self, const std::string &key,
+                       const Model &model) {
+        self.publish({{key, model}});
+    }, R"pbdoc(
+        Add or replace a model
+
+        Parameters
+        ----------
+        key : str
+            Name of the model
+        model : Model
+            The model
+
+    )pbdoc", py::arg("key"), py::arg("model"))
+    .def("update", &Registry::publish, R"pbdoc(
+        Add or replace several models in one atomic update
+
+        Parameters
+        ----------
+        models : dict of str to Model
+            The models by name
+
+    )pbdoc", py::arg("models"))
+    .def("remove", &Registry::remove, R"pbdoc(
+        Remove a model
+
+        Parameters
+        ----------
+        key : str
+            Name of the model
+
+        Returns
+        -------
+        bool
+            Whether the model was present
+
+    )pbdoc", py::arg("key"))
+    .def("evaluate", [](const Registry &self, const std::string &key,
+                        xt::pyarray<double> s) {
+        if (s.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input s is not 1-dimensional.");
+        }
+        auto map = self.snapshot();
+        auto it = map->find(key);
+        if (it == map->end())
+        {
+          throw py::key_error(key);
+        }
+        xt::xtensor<double, 1> points = s;
+        xt::xtensor<double, 2> f;
+        {
+          py::gil_scoped_release release;
+          f = it->second->evaluate(points);
+        }
+        return xt::pyarray<double>(f);
+    }, R"pbdoc(
+        Evaluate a model
 
         Parameters
         ----------
+        key : str
+            Name of the model
         s : numpy.ndarray
             A 1D array of the points, (Ns)
-        poles : numpy.ndarray [complex]
-            A 1D array of the poles, (N)
-        residues : numpy.ndarray [complex]
-            2D array of residues, (Nv, N)
-        polys : numpy.ndarray
-            Polynomial coefficients (0-th to Nc-th order), (Nv, Nc)
 
         Returns
         -------
         f : numpy.ndarray
-            the result array of multipole formalism (real part)
+            the result array of multipole formalism (real part), (Nv, Ns)
 
-    )pbdoc", py::arg("s"), py::arg("poles"), py::arg("residues"),
-    py::arg("polys") = (xt::pyarray<double>) {});
+    )pbdoc", py::arg("key"), py::arg("s"))
+    .def("get", [](const Registry &self, const std::string &key) {
+        auto map = self.snapshot();
+        auto it = map->find(key);
+        if (it == map->end())
+        {
+          throw py::key_error(key);
+        }
+        return Model(*it->second);
+    }, "Copy of the model named key", py::arg("key"))
+    .def("keys", [](const Registry &self) {
+        std::vector<std::string> keys;
+        for (const auto &item : *self.snapshot()) keys.push_back(item.first);
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }, "Sorted names of the models")
+    .def("__len__", [](const Registry &self) {
+        return self.snapshot()->size();
+    })
+    .def("__contains__", [](const Registry &self, const std::string &key) {
+        return self.snapshot()->count(key) > 0;
+    })
+    .def_property_readonly("version", &Registry::version,
+                           "Number of updates published")
+    .def_property_readonly("retired", &Registry::retired,
+                           "Number of old versions still in use by lookups");
+
+    py::class_<Coalescer>(m, "Coalescer", R"pbdoc(
+        Evaluation of registry models coalescing concurrent small requests
+
+        Requests made from several threads within a short window are
+        evaluated together, with one evaluation per model on the
+        concatenated points of its requests. Each call blocks until its
+        batch is done.
+
+        Parameters
+        ----------
+        registry : Registry
+            Registry of the models, kept alive by the coalescer
+        window : float
+            Time in microseconds a batch waits for more requests
+        max_batch : int
+            Number of requests which closes a batch before the window ends
+
+    )pbdoc")
+    .def(py::init([](const Registry &registry, double window,
+                     size_t max_batch) {
+        return new Coalescer(registry,
+                             std::chrono::microseconds((long long)window),
+                             max_batch);
+    }), py::keep_alive<1, 2>(), py::arg("registry"), py::arg("window") = 50.0,
+    py::arg("max_batch") = 64)
+    .def("evaluate", [](Coalescer &self, const std::string &key,
+                        xt::pyarray<double> s) {
+        if (s.dimension() != 1)
+        {
+          throw std::invalid_argument("Error: input s is not 1-dimensional.");
+        }
+        xt::xtensor<double, 1> points = s;
+        xt::xtensor<double, 2> f;
+        bool missing = false;
+        {
+          py::gil_scoped_release release;
+          try
+          {
+            f = self.evaluate(key, points);
+          }
+          catch (const std::out_of_range &)
+          {
+            missing = true;
+          }
+        }
+        if (missing)
+        {
+          throw py::key_error(key);
+        }
+        return xt::pyarray<double>(f);
+    }, R"pbdoc(
+        Evaluate a model, batched with the concurrent requests
+
+        Parameters
+        ----------
+        key : str
+            Name of the model
+        s : numpy.ndarray
+            A 1D array of the points, (Ns)
+
+        Returns
+        -------
+        f : numpy.ndarray
+            the result array of multipole formalism (real part), (Nv, Ns)
+
+    )pbdoc", py::arg("key"), py::arg("s"))
+    .def_property_readonly("requests", &Coalescer::requests,
+                           "Number of requests served")
+    .def_property_readonly("batches", &Coalescer::batches,
+                           "Number of batches evaluated");
+
+#ifdef VECTFIT_MPI
+    m.attr("has_mpi") = true;
+#else
+    m.attr("has_mpi") = false;
+#endif
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -619,3 +6679,4 @@ PYBIND11_MODULE(vectfit, m)
     m.attr("__version__") = "0.1";
 #endif
 }
+#endif
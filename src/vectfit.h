@@ -2,8 +2,10 @@
 #define VECTFIT_H
 
 #include <complex>
-#include "xtensor/xarray.hpp"
+#include <tuple>
+#include <vector>
 #include "xtensor-python/pyarray.hpp" // Numpy bindings
+#include "vectfit_core.h"
 
 //! Fast Relaxed Vector Fitting function
 std::tuple<xt::pyarray<std::complex<double>>,
@@ -17,7 +19,71 @@ vectfit(xt::pyarray<double> &f,
         xt::pyarray<double> &weight,
         int n_polys = 0,
         bool skip_pole = false,
-        bool skip_res = false);
+        bool skip_res = false,
+        int n_minimax = 0,
+        bool constrain = false,
+        double margin = 0.5,
+        double min_imag = 1e-6);
+
+//! Fast Relaxed Vector Fitting on ragged sample grids
+std::tuple<xt::pyarray<std::complex<double>>,
+           xt::pyarray<std::complex<double>>,
+           xt::pyarray<double>,
+           std::vector<xt::pyarray<double>>,
+           double>
+vectfit_ragged(std::vector<xt::pyarray<double>> &f,
+               std::vector<xt::pyarray<double>> &s,
+               xt::pyarray<std::complex<double>> &poles,
+               std::vector<xt::pyarray<double>> &weight,
+               int n_polys = 0,
+               bool skip_pole = false,
+               bool skip_res = false,
+               int n_minimax = 0,
+               bool constrain = false,
+               double margin = 0.5,
+               double min_imag = 1e-6);
+
+//! Fast Relaxed Vector Fitting of a batch of independent problems
+pybind11::list
+vectfit_batch(std::vector<xt::pyarray<double>> &f,
+              std::vector<xt::pyarray<double>> &s,
+              std::vector<xt::pyarray<std::complex<double>>> &poles,
+              std::vector<xt::pyarray<double>> &weight,
+              int n_polys = 0,
+              int n_iter = 1,
+              double rtol = 0.0);
+
+//! Fast Relaxed Vector Fitting of a batch of tiny problems, across SIMD lanes
+pybind11::list
+vectfit_tiny(std::vector<xt::pyarray<double>> &f,
+             std::vector<xt::pyarray<double>> &s,
+             std::vector<xt::pyarray<std::complex<double>>> &poles,
+             std::vector<xt::pyarray<double>> &weight,
+             int n_polys = 0,
+             int n_iter = 1);
+
+//! Fast Relaxed Vector Fitting of a temperature series, sharing the poles
+pybind11::list
+vectfit_series(std::vector<xt::pyarray<double>> &f,
+               xt::pyarray<double> &s,
+               xt::pyarray<std::complex<double>> &poles,
+               std::vector<xt::pyarray<double>> &weight,
+               int n_polys = 0,
+               int n_iter = 1,
+               double tol = 1e-3);
+
+//! Fast Relaxed Vector Fitting of one problem with its samples distributed
+std::tuple<xt::pyarray<std::complex<double>>,
+           xt::pyarray<std::complex<double>>,
+           xt::pyarray<double>,
+           xt::pyarray<double>,
+           double>
+vectfit_distributed(xt::pyarray<double> &f,
+                    xt::pyarray<double> &s,
+                    xt::pyarray<std::complex<double>> &poles,
+                    xt::pyarray<double> &weight,
+                    int n_polys = 0,
+                    int n_iter = 1);
 
 //! Multipole formalism evaluation function
 xt::pyarray<double>
@@ -26,4 +92,14 @@ evaluate(xt::pyarray<double> s,
          xt::pyarray<std::complex<double>> residues,
          xt::pyarray<double> polys = (xt::pyarray<double>) {});
 
+//! Initial poles from resonance parameters
+xt::pyarray<std::complex<double>>
+resonance_poles(xt::pyarray<double> energies,
+                xt::pyarray<double> widths,
+                double s_min,
+                double s_max,
+                int n_poles = 0,
+                bool sqrt_transform = false,
+                double tol = 1e-3);
+
 #endif // VECTFIT_H
@@ -0,0 +1,372 @@
+#ifndef VECTFIT_CORE_H
+#define VECTFIT_CORE_H
+
+// Declarations of the C++ interface, free of Python: what C++ applications
+// use, linking the vectfit_core library
+
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "xtensor/xarray.hpp"
+#include "xtensor/xtensor.hpp"
+
+//! Pole-residue model
+//!
+//! f(s) = REAL[residues/(s - poles)] + Polynomials(s), with the poles real
+//! or in complex conjugate pairs as returned by vectfit.
+struct Model
+{
+  xt::xtensor<std::complex<double>, 1> poles;    // poles. (N)
+  xt::xtensor<std::complex<double>, 2> residues; // residues. (Nv, N)
+  xt::xtensor<double, 2> polys;                  // polynomial coefs. (Nv, Nc)
+
+  //! Evaluate the model on the points s. dimension: (Nv, Ns)
+  xt::xtensor<double, 2> evaluate(const xt::xtensor<double, 1> &s) const;
+
+  //! Evaluate the model at the single point s into f. dimension: (Nv)
+  //!
+  //! Uses a per-pole layout of the model built on the first call, after
+  //! which the poles, residues and polys must not be modified.
+  void evaluate(double s, double *f) const;
+
+  //! Evaluate the model at the Ns points s into f. dimension: (Ns, Nv)
+  //!
+  //! The single-point evaluation of every point, fetching the terms once.
+  void evaluate(const double *s, size_t Ns, double *f) const;
+
+private:
+  struct Terms;
+  static void evaluate_terms(const Terms &t, double s, double *f);
+
+  //! Terms of a model, built once by the first caller and then read
+  //! through a plain acquire load. A copied or assigned model starts
+  //! without terms, since its arrays may then be modified.
+  class TermsCache
+  {
+  public:
+    TermsCache() = default;
+    TermsCache(const TermsCache &) {}
+    TermsCache &operator=(const TermsCache &);
+    ~TermsCache();
+
+    const Terms &get(const Model &model) const;
+
+  private:
+    mutable std::atomic<const Terms *> terms_ {nullptr};
+  };
+
+  const Terms &terms() const { return terms_.get(*this); }
+
+  TermsCache terms_;
+};
+
+//! Result of fitting one problem
+struct FitResult
+{
+  Model model;                // fitted model
+  xt::xtensor<double, 2> fit; // fitted signals on s. dimension: (Nv, Ns)
+  double rmserr = 0.0;        // RMS error between f and fit
+};
+
+//! Vector fitting of one problem, from C++ without Python objects
+FitResult
+fit(const xt::xtensor<double, 2> &f,
+    const xt::xtensor<double, 1> &s,
+    const xt::xtensor<std::complex<double>, 1> &poles,
+    const xt::xtensor<double, 2> &weight,
+    int n_polys = 0,
+    int n_iter = 1,
+    double rtol = 0.0);
+
+//! Vector fitting of a batch of problems, from C++ without Python objects
+std::vector<FitResult>
+fit_batch(const std::vector<xt::xtensor<double, 2>> &f,
+          const std::vector<xt::xtensor<double, 1>> &s,
+          const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+          const std::vector<xt::xtensor<double, 2>> &weight,
+          int n_polys = 0,
+          int n_iter = 1,
+          double rtol = 0.0,
+          const std::atomic<bool> *stop = nullptr);
+
+//! Linear combination of models, merging poles closer than tol (relative)
+Model
+combine(const std::vector<Model> &models,
+        const std::vector<double> &coefs,
+        double tol = 0.0);
+
+//! Remove the pole terms whose peak contribution is below tol (relative)
+Model
+prune(const Model &model, double tol);
+
+//! Analytic group integrals and weighted averages of a model
+std::tuple<xt::xtensor<double, 2>, xt::xtensor<double, 2>>
+integrate(const Model &model,
+          const xt::xtensor<double, 1> &edges,
+          const std::string &weight_function = "constant",
+          bool sqrt_transform = false);
+
+//! Evaluate a batch of (model, point) queries, bucketed by model and point
+xt::xtensor<double, 2>
+lookup(const std::vector<const Model *> &models,
+       const xt::xtensor<long, 1> &index,
+       const xt::xtensor<double, 1> &s);
+
+//! Compare models with packed reference data, window by window
+std::tuple<xt::xtensor<double, 2>, xt::xtensor<long, 1>>
+validate(const std::vector<const Model *> &models,
+         const xt::xtensor<long, 1> &offsets,
+         const xt::xtensor<double, 1> &s,
+         const xt::xtensor<double, 2> &f,
+         double rtol = 1e-3,
+         double atol = 0.0);
+
+//! TAB1 sections of an ENDF file, their points packed one after another
+//!
+//! Section k has the points x(offsets(k)) to x(offsets(k + 1) - 1); law is
+//! its interpolation law, or 0 if it has several interpolation regions.
+struct Tab1Library
+{
+  std::vector<int> mat, mt, law;
+  std::vector<double> za, awr, qm, qi;
+  std::vector<long> offsets;
+  std::vector<double> x, y;
+};
+
+//! Read the TAB1 sections of file mf of an ENDF file, e.g. a PENDF tape
+Tab1Library
+read_tab1(const std::string &path, int mf = 3,
+          const std::vector<int> &mts = {});
+
+//! Fit of a model on samples, updated incrementally by single-pole edits
+//!
+//! Caches the fit of the model on the sample points and its error metrics.
+//! Changing, adding or removing one real pole or conjugate pair updates
+//! the cache by subtracting the old term and adding the new one, in
+//! O(Nv Ns) instead of the O(Nv Ns N) of a full evaluation.
+class FitState
+{
+public:
+  FitState(const Model &model, const xt::xtensor<double, 1> &s,
+           const xt::xtensor<double, 2> &f, const xt::xtensor<double, 2> &w);
+
+  //! Replace the real pole or conjugate pair at m and its residues (Nv)
+  void set_pole(size_t m, std::complex<double> pole,
+                const xt::xtensor<std::complex<double>, 1> &residues);
+
+  //! Append a real pole or conjugate pair with its residues (Nv)
+  void add_pole(std::complex<double> pole,
+                const xt::xtensor<std::complex<double>, 1> &residues);
+
+  //! Remove the real pole or conjugate pair at m
+  void remove_pole(size_t m);
+
+  //! Recompute the fit from scratch, discarding accumulated rounding
+  void refresh();
+
+  const Model &model() const { return model_; }
+  const xt::xtensor<double, 2> &fit() const { return fit_; }
+
+  //! RMS error between f and fit
+  double rmserr() const;
+
+  //! Maximum weighted error |w (fit - f)|
+  double max_error() const { return max_error_; }
+
+private:
+  //! First index and size (1 or 2) of the pole term at m
+  std::pair<size_t, size_t> term(size_t m) const;
+
+  //! Replace a term by another in the fit (factor 0: no term), and update
+  //! the error metrics in the same pass
+  void apply(std::complex<double> old_pole,
+             const xt::xtensor<std::complex<double>, 1> &old_residues,
+             double old_factor, std::complex<double> new_pole,
+             const xt::xtensor<std::complex<double>, 1> &new_residues,
+             double new_factor);
+
+  Model model_;
+  xt::xtensor<double, 1> s_;
+  xt::xtensor<double, 2> f_, w_, fit_;
+  double sum2_ = 0.0;
+  double max_error_ = 0.0;
+};
+
+//! Online vector fitting of streamed samples by QR-based recursive LS
+//!
+//! The LS-problems of the pole and residue identification steps are kept
+//! as upper triangular factors of their augmented matrices [A | b], updated
+//! by Givens rotations as samples arrive, with exponential forgetting. The
+//! poles are relocated from the factors, after which the factors are rebuilt
+//! from a bounded buffer of the latest samples, so that neither step costs
+//! more with the length of the stream.
+class OnlineFit
+{
+public:
+  OnlineFit(const xt::xtensor<std::complex<double>, 1> &poles, size_t Nv,
+            size_t Nc, double forgetting, size_t window,
+            size_t relocate_every);
+
+  //! Add a sample of all the rows, f and w of dimension (Nv)
+  void update(double s, const double *f, const double *w);
+
+  //! Relocate the poles, returning false if too few samples are buffered
+  bool relocate();
+
+  //! Current model, the residues solved from the factors
+  Model model() const;
+
+  //! Current poles. dimension: (N)
+  const xt::xtensor<std::complex<double>, 1> &poles() const { return poles_; }
+
+  //! Number of rows (responses) of every sample
+  size_t rows() const { return Nv_; }
+
+  //! Number of samples received
+  size_t count() const { return count_; }
+
+private:
+  struct Sample
+  {
+    double s;
+    std::vector<double> f;
+    std::vector<double> w;
+  };
+
+  //! Clear the factors and the criterion sums
+  void reset();
+
+  //! Update the factors with a sample
+  void add(const Sample &sample);
+
+  xt::xtensor<std::complex<double>, 1> poles_;
+  xt::xtensor<int, 1> cindex_;
+  size_t Nv_, Nc_;
+  double forgetting_;
+  size_t window_, relocate_every_;
+  std::vector<xt::xtensor<double, 2>> pole_factors_;    // Nv x (K+1, K+1)
+  std::vector<xt::xtensor<double, 2>> residue_factors_; // Nv x (N+Nc+1)^2
+  std::vector<double> colsum_; // decayed column sums of the basis. (N + 1)
+  double weight_sum_ = 0.0;    // decayed number of samples
+  double norm2_ = 0.0;         // decayed sum of (w f)^2
+  std::deque<Sample> buffer_;
+  size_t count_ = 0;
+  size_t since_ = 0;
+};
+
+//! Registry of named models, hot-swappable under concurrent lookups
+//!
+//! Lookups read an immutable snapshot of the name -> model map, published
+//! through an atomic pointer: a lookup only takes a reference to it, within
+//! a read-side section counted by one of two epoch counters, and never
+//! waits. Writers copy the current map, apply their changes and publish the
+//! copy atomically; the replaced snapshot is then released after a grace
+//! period, when every lookup which might still be taking a reference to it
+//! has left its section. It is freed at once by the writer unless lookups
+//! hold it, in which case the last of them frees it.
+class Registry
+{
+public:
+  using Map = std::unordered_map<std::string, std::shared_ptr<const Model>>;
+
+  Registry();
+  ~Registry();
+
+  Registry(const Registry &) = delete;
+  Registry &operator=(const Registry &) = delete;
+
+  //! Current snapshot of the models
+  std::shared_ptr<const Map> snapshot() const;
+
+  //! Add or replace models, all in one atomic update
+  void publish(const std::map<std::string, Model> &models);
+
+  //! Remove a model, returning if it was present
+  bool remove(const std::string &key);
+
+  //! Evaluate the model named key on the points s. dimension: (Nv, Ns)
+  xt::xtensor<double, 2> evaluate(const std::string &key,
+                                  const xt::xtensor<double, 1> &s) const;
+
+  //! Number of updates published
+  size_t version() const { return version_; }
+
+  //! Number of replaced snapshots still held by lookups
+  size_t retired() const;
+
+private:
+  struct Node
+  {
+    std::shared_ptr<const Map> map;
+  };
+
+  //! Publish map and release the replaced snapshot, with write_ held
+  void swap_in(std::shared_ptr<const Map> map);
+
+  std::atomic<Node *> node_;
+  std::atomic<unsigned> epoch_ {0};
+  mutable std::atomic<size_t> readers_[2];
+  std::atomic<size_t> version_ {0};
+  mutable std::mutex write_;
+  std::vector<std::weak_ptr<const Map>> retired_;
+};
+
+//! Evaluation of registry models coalescing concurrent small requests
+//!
+//! The first caller to find no batch forming becomes its leader: it waits
+//! up to window for other callers to queue their requests (or for
+//! max_batch of them), then evaluates each model once on the concatenated
+//! points of all its requests and hands the results back. The other
+//! callers block until their batch is done.
+class Coalescer
+{
+public:
+  Coalescer(const Registry &registry, std::chrono::microseconds window,
+            size_t max_batch);
+
+  //! Evaluate the model named key on the points s. dimension: (Nv, Ns)
+  xt::xtensor<double, 2> evaluate(const std::string &key,
+                                  const xt::xtensor<double, 1> &s);
+
+  //! Number of requests served
+  size_t requests() const { return requests_; }
+
+  //! Number of batches evaluated
+  size_t batches() const { return batches_; }
+
+private:
+  struct Request
+  {
+    const std::string *key;
+    const xt::xtensor<double, 1> *s;
+    xt::xtensor<double, 2> result;
+    std::exception_ptr error; // failure of the batch
+    bool missing = false;
+    bool done = false;
+  };
+
+  //! Evaluate a batch, one model evaluation per distinct key
+  void run(const std::vector<Request *> &batch) const;
+
+  const Registry &registry_;
+  std::chrono::microseconds window_;
+  size_t max_batch_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Request *> queue_;
+  bool leader_ = false;
+  std::atomic<size_t> requests_ {0};
+  std::atomic<size_t> batches_ {0};
+};
+
+#endif // VECTFIT_CORE_H
@@ -0,0 +1,380 @@
+#ifndef VECTFIT_CORO_H
+#define VECTFIT_CORO_H
+
+// Awaitable fits and evaluations for C++20 coroutines
+//
+// The library itself is built as C++14: this header only declares anything
+// when included from a C++20 translation unit with a standard <coroutine>.
+
+#if defined(__has_include)
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define VECTFIT_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef VECTFIT_HAS_COROUTINES
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "vectfit_core.h"
+
+//! Exception of an awaited operation cancelled by its stop token
+class Cancelled : public std::runtime_error
+{
+public:
+  Cancelled() : std::runtime_error("Error: operation cancelled.") {}
+};
+
+//! Threads running the operations awaited by coroutines
+//!
+//! The operations are queued as intrusive nodes, which are the awaiters
+//! themselves and live in the frames of the awaiting coroutines: queueing
+//! one allocates nothing. At most 4 operations run at a time, and the
+//! OpenMP threads are shared between them: each pool thread runs the
+//! parallel regions of its operations on its share of the threads, so that
+//! concurrent operations do not oversubscribe the cores.
+class AsyncPool
+{
+public:
+  //! Queued operation
+  class Job
+  {
+  public:
+    virtual void run() noexcept = 0;
+
+  protected:
+    ~Job() = default;
+
+  private:
+    friend class AsyncPool;
+    Job *next_ = nullptr;
+  };
+
+  //! Pool of all the awaitables, started on first use
+  static AsyncPool &instance()
+  {
+    static AsyncPool pool;
+    return pool;
+  }
+
+  //! Queue job, run by the first idle thread
+  void submit(Job *job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job->next_ = nullptr;
+      if (tail_ != nullptr)
+      {
+        tail_->next_ = job;
+      }
+      else
+      {
+        head_ = job;
+      }
+      tail_ = job;
+    }
+    cv_.notify_one();
+  }
+
+  //! Run the queued jobs, then join the threads
+  ~AsyncPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &thread : threads_)
+    {
+      thread.join();
+    }
+  }
+
+  AsyncPool(const AsyncPool &) = delete;
+  AsyncPool &operator=(const AsyncPool &) = delete;
+
+private:
+  AsyncPool()
+  {
+#ifdef _OPENMP
+    int cores = omp_get_max_threads();
+#else
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+#endif
+    int n = std::min(cores, 4);
+    for (int i = 0; i < n; i++)
+    {
+      // Threads of the OpenMP teams of this pool thread
+      int team = cores / n + (i < cores % n ? 1 : 0);
+      threads_.emplace_back([this, team]() {
+#ifdef _OPENMP
+        omp_set_num_threads(team);
+#else
+        (void)team;
+#endif
+        work();
+      });
+    }
+  }
+
+  void work()
+  {
+    for (;;)
+    {
+      Job *job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stopping_ || head_ != nullptr; });
+        if (head_ == nullptr)
+        {
+          return;
+        }
+        job = head_;
+        head_ = job->next_;
+        if (head_ == nullptr)
+        {
+          tail_ = nullptr;
+        }
+      }
+      job->run();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  Job *head_ = nullptr;
+  Job *tail_ = nullptr;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+//! Awaiter computing Derived::compute() on the pool
+//!
+//! The awaiting coroutine is suspended and then resumed on the pool thread
+//! which completed the operation. An operation whose token is stopped
+//! before it starts is not run and its await throws Cancelled; a running
+//! one is only interrupted where compute() checks the token.
+template <class Derived>
+class PoolAwaiter : private AsyncPool::Job
+{
+public:
+  explicit PoolAwaiter(std::stop_token token) : token_(std::move(token)) {}
+
+  PoolAwaiter(const PoolAwaiter &) = delete;
+  PoolAwaiter &operator=(const PoolAwaiter &) = delete;
+
+  bool await_ready() noexcept
+  {
+    cancelled_ = token_.stop_requested();
+    return cancelled_;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    handle_ = handle;
+    AsyncPool::instance().submit(this);
+  }
+
+protected:
+  ~PoolAwaiter() = default;
+
+  //! Rethrow the exception of the operation, or Cancelled
+  void check() const
+  {
+    if (error_)
+    {
+      std::rethrow_exception(error_);
+    }
+    if (cancelled_)
+    {
+      throw Cancelled();
+    }
+  }
+
+  std::stop_token token_;
+
+private:
+  void run() noexcept override
+  {
+    if (token_.stop_requested())
+    {
+      cancelled_ = true;
+    }
+    else
+    {
+      try
+      {
+        static_cast<Derived *>(this)->compute();
+      }
+      catch (...)
+      {
+        error_ = std::current_exception();
+      }
+    }
+    handle_.resume();
+  }
+
+  std::coroutine_handle<> handle_;
+  std::exception_ptr error_;
+  bool cancelled_ = false;
+};
+
+//! Awaiter of fit(), see fit_async
+class FitAwaiter : public PoolAwaiter<FitAwaiter>
+{
+public:
+  FitAwaiter(const xt::xtensor<double, 2> &f,
+             const xt::xtensor<double, 1> &s,
+             const xt::xtensor<std::complex<double>, 1> &poles,
+             const xt::xtensor<double, 2> &weight,
+             int n_polys, int n_iter, double rtol, std::stop_token token)
+    : PoolAwaiter(std::move(token)), f_(f), s_(s), poles_(poles),
+      weight_(weight), n_polys_(n_polys), n_iter_(n_iter), rtol_(rtol)
+  {}
+
+  FitResult await_resume()
+  {
+    check();
+    return std::move(result_);
+  }
+
+private:
+  friend class PoolAwaiter<FitAwaiter>;
+
+  void compute()
+  {
+    result_ = fit(f_, s_, poles_, weight_, n_polys_, n_iter_, rtol_);
+  }
+
+  const xt::xtensor<double, 2> &f_;
+  const xt::xtensor<double, 1> &s_;
+  const xt::xtensor<std::complex<double>, 1> &poles_;
+  const xt::xtensor<double, 2> &weight_;
+  int n_polys_, n_iter_;
+  double rtol_;
+  FitResult result_;
+};
+
+//! Awaiter of fit_batch(), see fit_batch_async
+class FitBatchAwaiter : public PoolAwaiter<FitBatchAwaiter>
+{
+public:
+  FitBatchAwaiter(const std::vector<xt::xtensor<double, 2>> &f,
+                  const std::vector<xt::xtensor<double, 1>> &s,
+                  const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+                  const std::vector<xt::xtensor<double, 2>> &weight,
+                  int n_polys, int n_iter, double rtol, std::stop_token token)
+    : PoolAwaiter(std::move(token)), f_(f), s_(s), poles_(poles),
+      weight_(weight), n_polys_(n_polys), n_iter_(n_iter), rtol_(rtol)
+  {}
+
+  std::vector<FitResult> await_resume()
+  {
+    check();
+    return std::move(results_);
+  }
+
+private:
+  friend class PoolAwaiter<FitBatchAwaiter>;
+
+  // A stop request skips the problems not started yet
+  void compute()
+  {
+    std::atomic<bool> stop {false};
+    std::stop_callback on_stop(token_, [&stop]() { stop = true; });
+    results_ = fit_batch(f_, s_, poles_, weight_, n_polys_, n_iter_, rtol_,
+                         &stop);
+    if (stop)
+    {
+      throw Cancelled();
+    }
+  }
+
+  const std::vector<xt::xtensor<double, 2>> &f_;
+  const std::vector<xt::xtensor<double, 1>> &s_;
+  const std::vector<xt::xtensor<std::complex<double>, 1>> &poles_;
+  const std::vector<xt::xtensor<double, 2>> &weight_;
+  int n_polys_, n_iter_;
+  double rtol_;
+  std::vector<FitResult> results_;
+};
+
+//! Awaiter of Model::evaluate(), see evaluate_async
+class EvaluateAwaiter : public PoolAwaiter<EvaluateAwaiter>
+{
+public:
+  EvaluateAwaiter(const Model &model, const xt::xtensor<double, 1> &s,
+                  std::stop_token token)
+    : PoolAwaiter(std::move(token)), model_(model), s_(s)
+  {}
+
+  xt::xtensor<double, 2> await_resume()
+  {
+    check();
+    return std::move(result_);
+  }
+
+private:
+  friend class PoolAwaiter<EvaluateAwaiter>;
+
+  void compute() { result_ = model_.evaluate(s_); }
+
+  const Model &model_;
+  const xt::xtensor<double, 1> &s_;
+  xt::xtensor<double, 2> result_;
+};
+
+//! Fit one problem on the pool: co_await fit_async(f, s, poles, weight)
+//!
+//! The arguments are referenced, not copied, until the await completes.
+inline FitAwaiter
+fit_async(const xt::xtensor<double, 2> &f,
+          const xt::xtensor<double, 1> &s,
+          const xt::xtensor<std::complex<double>, 1> &poles,
+          const xt::xtensor<double, 2> &weight,
+          int n_polys = 0,
+          int n_iter = 1,
+          double rtol = 0.0,
+          std::stop_token token = {})
+{
+  return FitAwaiter(f, s, poles, weight, n_polys, n_iter, rtol,
+                    std::move(token));
+}
+
+//! Fit a batch of problems on the pool, stopping between problems
+inline FitBatchAwaiter
+fit_batch_async(const std::vector<xt::xtensor<double, 2>> &f,
+                const std::vector<xt::xtensor<double, 1>> &s,
+                const std::vector<xt::xtensor<std::complex<double>, 1>> &poles,
+                const std::vector<xt::xtensor<double, 2>> &weight,
+                int n_polys = 0,
+                int n_iter = 1,
+                double rtol = 0.0,
+                std::stop_token token = {})
+{
+  return FitBatchAwaiter(f, s, poles, weight, n_polys, n_iter, rtol,
+                         std::move(token));
+}
+
+//! Evaluate a model on the points s on the pool. dimension: (Nv, Ns)
+inline EvaluateAwaiter
+evaluate_async(const Model &model, const xt::xtensor<double, 1> &s,
+               std::stop_token token = {})
+{
+  return EvaluateAwaiter(model, s, std::move(token));
+}
+
+#endif // VECTFIT_HAS_COROUTINES
+
+#endif // VECTFIT_CORO_H
@@ -0,0 +1,129 @@
+// Test of the coroutine interface of the C++ library
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include "xtensor/xbuilder.hpp"
+#include "xtensor/xmath.hpp"
+#include "vectfit_coro.h"
+
+#ifndef VECTFIT_HAS_COROUTINES
+#error "vectfit_coro.h requires C++20 coroutines"
+#endif
+
+using namespace std::complex_literals;
+
+// Coroutine started at once, whose completion is waited for by main
+struct Test
+{
+  struct promise_type
+  {
+    std::promise<void> done;
+
+    Test get_return_object() { return {done.get_future()}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() { done.set_value(); }
+    void unhandled_exception() { done.set_exception(std::current_exception()); }
+  };
+
+  std::future<void> done;
+};
+
+void
+expect(bool condition, const char *what)
+{
+  if (!condition)
+  {
+    throw std::runtime_error(std::string("Failed: ") + what);
+  }
+}
+
+xt::xtensor<std::complex<double>, 1>
+sorted(xt::xtensor<std::complex<double>, 1> p)
+{
+  std::sort(p.begin(), p.end(), [](auto a, auto b) {
+    return a.real() < b.real() || (a.real() == b.real() && a.imag() < b.imag());
+  });
+  return p;
+}
+
+Test
+run()
+{
+  Model model;
+  model.poles = {3.0 + 0.1i, 3.0 - 0.1i, 7.0 + 0.2i, 7.0 - 0.2i};
+  model.residues = {{1.0 - 2.0i, 1.0 + 2.0i, 2.0 + 1.0i, 2.0 - 1.0i}};
+  model.polys = xt::zeros<double>({1, 0});
+  xt::xtensor<double, 1> s = xt::linspace<double>(1.0, 10.0, 300);
+  xt::xtensor<double, 2> f = model.evaluate(s);
+  xt::xtensor<double, 2> weight = xt::ones_like(f);
+  xt::xtensor<std::complex<double>, 1> init = {2.0 + 0.5i, 2.0 - 0.5i,
+                                               8.0 + 0.5i, 8.0 - 0.5i};
+
+  // Fit, resumed with the relocated poles
+  auto r = co_await fit_async(f, s, init, weight, 0, 10);
+  expect(xt::allclose(sorted(r.model.poles), sorted(model.poles), 1e-6),
+         "fit_async poles");
+  expect(r.rmserr < 1e-8, "fit_async error");
+
+  // Evaluation
+  auto g = co_await evaluate_async(r.model, s);
+  expect(xt::allclose(g, r.fit), "evaluate_async");
+
+  // Batch
+  std::vector<xt::xtensor<double, 2>> fs(3, f), ws(3, weight);
+  std::vector<xt::xtensor<double, 1>> ss(3, s);
+  std::vector<xt::xtensor<std::complex<double>, 1>> ps(3, init);
+  auto rs = co_await fit_batch_async(fs, ss, ps, ws, 0, 10);
+  expect(rs.size() == 3, "fit_batch_async size");
+  for (const auto &ri : rs)
+  {
+    expect(ri.rmserr < 1e-8, "fit_batch_async error");
+  }
+
+  // Errors of the operation are rethrown by the await
+  xt::xtensor<double, 1> short_s = xt::linspace<double>(1.0, 10.0, 10);
+  bool thrown = false;
+  try
+  {
+    co_await fit_async(f, short_s, init, weight);
+  }
+  catch (const std::invalid_argument &)
+  {
+    thrown = true;
+  }
+  expect(thrown, "fit_async invalid_argument");
+
+  // Cancelled operations
+  std::stop_source source;
+  source.request_stop();
+  thrown = false;
+  try
+  {
+    co_await fit_batch_async(fs, ss, ps, ws, 0, 10, 0.0, source.get_token());
+  }
+  catch (const Cancelled &)
+  {
+    thrown = true;
+  }
+  expect(thrown, "fit_batch_async cancelled");
+}
+
+int
+main()
+{
+  try
+  {
+    run().done.get();
+  }
+  catch (const std::exception &e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  std::printf("All tests passed.\n");
+  return 0;
+}
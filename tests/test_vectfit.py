@@ -1,6 +1,13 @@
 import vectfit as m
-from unittest import TestCase
+from unittest import TestCase, skipUnless
 import numpy as np
+import os
+import pickle
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
 
 
 class VectfitTest(TestCase):
@@ -170,3 +177,636 @@ class VectfitTest(TestCase):
             f_ref[1, :] += c*np.power(s, n)
         f = m.evaluate(s, poles, residues, polys)
         np.testing.assert_allclose(f_ref, f)
+
+    def test_resonance_poles(self):
+        """Test initial poles from resonance parameters"""
+        energies = np.array([6.67, 20.87, 20.871, 36.68])
+        widths = np.array([0.027, 0.034, 0.034, 0.057])
+        poles = m.resonance_poles(energies, widths, 1.0, 10.0, n_poles=10,
+                                  sqrt_transform=True)
+        self.assertEqual(poles.size, 10)
+        # exact conjugate pairs, sorted by real part
+        np.testing.assert_array_equal(poles[0::2], np.conj(poles[1::2]))
+        self.assertTrue(np.all(np.diff(poles[0::2].real) >= 0.))
+        # the two coincident resonances are merged
+        ref = np.sqrt(energies[[0, 1, 3]] + 0.5j*widths[[0, 1, 3]])
+        for p in ref:
+            self.assertAlmostEqual(np.min(np.abs(poles - p)), 0.)
+        with self.assertRaises(ValueError):
+            m.resonance_poles(energies, widths, 1.0, 10.0, n_poles=4,
+                              sqrt_transform=True)
+
+        # exact resonance poles converge in one iteration
+        Ns = 1001
+        s = np.linspace(2.0, 7.0, Ns)
+        test_poles = m.resonance_poles(energies, widths, 2.0, 7.0,
+                                       sqrt_transform=True)
+        test_residues = np.array([[1.0-20.0j, 1.0+20.0j, 3.0-9.0j, 3.0+9.0j,
+                                   0.5-4.0j, 0.5+4.0j]])
+        f = m.evaluate(s, test_poles, test_residues)
+        weight = 1.0/np.abs(f)
+        init_poles = m.resonance_poles(energies*1.0001, widths, 2.0, 7.0,
+                                       sqrt_transform=True)
+        poles, residues, cf, fit, rms = m.vectfit(f, s, init_poles, weight)
+        np.testing.assert_allclose(test_poles, poles, rtol=1e-7)
+        np.testing.assert_allclose(f, fit, rtol=1e-5)
+
+    def test_ragged(self):
+        """Test vectfit with a different sample grid for each signal"""
+        test_poles = [5.0+0.1j, 5.0-0.1j]
+        test_residues = [[0.5-11.0j, 0.5+11.0j],
+                         [1.5-20.0j, 1.5+20.0j]]
+        s = [np.linspace(3., 7., 101), np.linspace(4., 6.5, 57)]
+        f = [m.evaluate(s[n], test_poles, test_residues[n])[0]
+             for n in range(2)]
+        weight = [1.0/f[n] for n in range(2)]
+        init_poles = [3.5 + 0.035j, 3.5 - 0.035j]
+        poles, residues, cf, fit, rms = m.vectfit_ragged(f, s, init_poles,
+                                                         weight)
+        np.testing.assert_allclose(test_poles, poles, rtol=1e-7)
+        np.testing.assert_allclose(test_residues, residues, rtol=1e-7)
+        for n in range(2):
+            self.assertEqual(fit[n].shape, s[n].shape)
+            np.testing.assert_allclose(f[n], fit[n], rtol=1e-5)
+
+    def test_minimax(self):
+        """Test vectfit with Lawson minimax refinement of the residues"""
+        Ns = 201
+        test_s = np.linspace(0., 5., Ns)
+        test_poles = [-20.0+30.0j, -20.0-30.0j, 2.0+0.5j, 2.0-0.5j]
+        test_residues = [[5.0+10.0j, 5.0-10.0j, 1.0+2.0j, 1.0-2.0j]]
+        f = m.evaluate(test_s, test_poles, test_residues, [[1.0, 2.0, 0.3]])
+        weight = 1.0/f
+        # fit with too few poles, so that the fit is not exact
+        poles = [2.5 + 0.025j, 2.5 - 0.025j]
+        for i in range(5):
+            poles, residues, cf, fit, rms = m.vectfit(f, test_s, poles,
+                                                      weight, n_polys=2)
+        err_l2 = np.max(np.abs((fit - f)*weight))
+        poles, residues, cf, fit, rms = m.vectfit(f, test_s, poles, weight,
+                                                  n_polys=2, skip_pole=True,
+                                                  n_minimax=20)
+        err_minimax = np.max(np.abs((fit - f)*weight))
+        self.assertLess(err_minimax, 0.9*err_l2)
+
+    def test_model_algebra(self):
+        """Test linear combinations of models"""
+        s = np.linspace(3., 7., 101)
+        a = m.Model([5.0+0.1j, 5.0-0.1j], [0.5-11.0j, 0.5+11.0j],
+                    [1.0, 2.0])
+        b = m.Model([5.0-0.1j, 5.0+0.1j, 6.0+0.0j], [1.5+20.0j, 1.5-20.0j, 3.0],
+                    [0.5])
+        c = 2.0*a - b
+        np.testing.assert_allclose(c.evaluate(s),
+                                   2.0*a.evaluate(s) - b.evaluate(s))
+        # the common pair is merged
+        self.assertEqual(c.poles.size, 3)
+        self.assertEqual(c.polys.shape, (1, 2))
+
+        # coincident poles within the tolerance
+        d = m.Model([5.0+0.1000001j, 5.0-0.1000001j], [1.0-1.0j, 1.0+1.0j])
+        self.assertEqual(m.combine([a, d], [1.0, 1.0]).poles.size, 4)
+        self.assertEqual(m.combine([a, d], [1.0, 1.0], tol=1e-6).poles.size, 2)
+
+        # pruning of a negligible pair
+        e = a + m.Model([4.0+1.0j, 4.0-1.0j], [1e-9+0j, 1e-9+0j])
+        np.testing.assert_allclose(e.prune(1e-6).poles, a.poles)
+
+    def test_integrate(self):
+        """Test analytic group integrals against numerical quadrature"""
+        model = m.Model([2.0+0.1j, 2.0-0.1j, -1.0+0j],
+                        [[0.5-1.0j, 0.5+1.0j, 2.0]], [[1.0, 0.5, 0.1]])
+        edges = np.array([1.0, 2.0, 3.5, 4.0, 9.0])
+
+        def trapezoid(y, x):
+            return np.sum((y[1:] + y[:-1])*np.diff(x))/2
+
+        for sqrt_transform in (False, True):
+            for weight_function in ("constant", "1/E"):
+                integrals, averages = m.integrate(model, edges,
+                                                  weight_function,
+                                                  sqrt_transform)
+                self.assertEqual(integrals.shape, (1, 4))
+                for g in range(4):
+                    E = np.linspace(edges[g], edges[g+1], 200001)
+                    s = np.sqrt(E) if sqrt_transform else E
+                    w = 1.0/E if weight_function == "1/E" else np.ones_like(E)
+                    ref = trapezoid(model.evaluate(s)[0]*w, E)
+                    norm = trapezoid(w, E)
+                    np.testing.assert_allclose(integrals[0, g], ref, rtol=1e-6)
+                    np.testing.assert_allclose(averages[0, g], ref/norm,
+                                               rtol=1e-6)
+        with self.assertRaises(ValueError):
+            m.integrate(m.Model([0.0+0j], [[1.0+0j]]), edges, "1/E")
+
+    def test_batch(self):
+        """Test fitting a batch of problems against successive vectfit calls"""
+        f, s, poles, weight = [], [], [], []
+        for k in range(6):
+            Ns = 101 + 10*k
+            test_s = np.linspace(3., 7., Ns)
+            test_poles = [5.0+0.1j*(k+1), 5.0-0.1j*(k+1)]
+            test_residues = [[0.5-11.0j, 0.5+11.0j]]
+            fk = m.evaluate(test_s, test_poles, test_residues, [[1.0, 0.1]])
+            f.append(fk)
+            s.append(test_s)
+            poles.append(np.array([3.5 + 0.035j, 3.5 - 0.035j]))
+            weight.append(1.0/fk)
+        results = m.vectfit_batch(f, s, poles, weight, n_polys=2, n_iter=3)
+        self.assertEqual(len(results), 6)
+        for k in range(6):
+            p = poles[k]
+            for i in range(3):
+                p, r, cf, fit, rms = m.vectfit(f[k], s[k], p, weight[k],
+                                               n_polys=2)
+            np.testing.assert_allclose(results[k][0], p)
+            np.testing.assert_allclose(results[k][1], r)
+            np.testing.assert_allclose(results[k][3], fit)
+            np.testing.assert_allclose(results[k][4], rms)
+
+    def test_batch_rtol(self):
+        """Test the early stop of the overlapped iterations of a batch"""
+        s = np.linspace(3., 7., 201)
+        f = m.evaluate(s, [5.0+0.1j, 5.0-0.1j], [[0.5-11.0j, 0.5+11.0j]],
+                       [[1.0, 0.1]])
+        f *= 1.0 + 1e-3*np.sin(37.0*s)
+        init = np.array([3.5 + 0.035j, 3.5 - 0.035j])
+        rtol = 1e-3
+        results = m.vectfit_batch([f], [s], [init], [1.0/f], n_polys=2,
+                                  n_iter=50, rtol=rtol)
+
+        # Same criterion with separate residue and pole steps
+        p, previous = init, np.inf
+        for i in range(50):
+            _, r, cf, fit, rms = m.vectfit(f, s, p, 1.0/f, n_polys=2,
+                                           skip_pole=True)
+            if i > 0 and abs(previous - rms) <= rtol*previous:
+                break
+            previous = rms
+            p = m.vectfit(f, s, p, 1.0/f, n_polys=2, skip_res=True)[0]
+        self.assertGreater(i, 0)
+        self.assertLess(i, 49)
+        self.assertFalse(np.allclose(results[0][0], init))
+        np.testing.assert_allclose(results[0][0], p)
+        np.testing.assert_allclose(results[0][1], r, rtol=1e-6)
+        np.testing.assert_allclose(results[0][4], rms, rtol=1e-6)
+
+    def test_tiny(self):
+        """Test fitting tiny problems across SIMD lanes against a batch"""
+        rng = np.random.default_rng(3)
+        f, s, poles, weight = [], [], [], []
+        for k in range(21):
+            test_s = np.linspace(3., 7., 60 if k % 3 else 80)
+            a = rng.uniform(3.5, 6.5, 2)
+            test_poles = [a[0]+0.1j, a[0]-0.1j, a[1]+0.2j, a[1]-0.2j]
+            test_residues = [[0.5-1.0j, 0.5+1.0j, 1.0+0.5j, 1.0-0.5j]]
+            fk = m.evaluate(test_s, test_poles, test_residues, [[1.0, 0.1]])
+            f.append(fk)
+            s.append(test_s)
+            poles.append(np.array([4.0+0.04j, 4.0-0.04j, 6.0+0.06j,
+                                   6.0-0.06j]))
+            weight.append(np.ones_like(fk))
+
+        # A real pole on a sample point diverges in its lane
+        poles[5] = np.array([4.0+0.04j, 4.0-0.04j, s[5][30]])
+        m.reset_stats()
+        results = m.vectfit_tiny(f, s, poles, weight, n_polys=2, n_iter=5)
+        reference = m.vectfit_batch(f, s, poles, weight, n_polys=2, n_iter=5)
+        self.assertGreaterEqual(m.stats()['tiny_fallbacks'], 1)
+        self.assertEqual(len(results), 21)
+        for r, ref in zip(results, reference):
+            np.testing.assert_allclose(r[0], ref[0], rtol=1e-8)
+            np.testing.assert_allclose(r[1], ref[1], rtol=1e-6, atol=1e-10)
+            np.testing.assert_allclose(r[3], ref[3], rtol=1e-8, atol=1e-10)
+            np.testing.assert_allclose(r[4], ref[4], rtol=1e-6, atol=1e-12)
+
+    @skipUnless(m.has_mpi and shutil.which('mpirun'), "requires MPI")
+    def test_batch_mpi(self):
+        """Test fitting a batch of problems over 2 MPI ranks"""
+        script = """
+import numpy as np
+import vectfit as m
+s = np.linspace(3., 7., 101)
+f = [m.evaluate(s, [5.0+0.1j*(k+1), 5.0-0.1j*(k+1)], [[0.5-11.0j, 0.5+11.0j]])
+     for k in range(9)]
+poles = [np.array([3.5 + 0.035j, 3.5 - 0.035j])]*9
+results = m.vectfit_batch(f, [s]*9, poles, [1.0/fk for fk in f], n_iter=2)
+assert any(r is not None for r in results)
+for fk, r in zip(f, results):
+    if r is not None:
+        p = poles[0].copy()
+        for i in range(2):
+            p, res, cf, fit, rms = m.vectfit(fk, s, p, 1.0/fk)
+        np.testing.assert_allclose(r[0], p)
+        np.testing.assert_allclose(r[3], fit)
+"""
+        subprocess.check_call(['mpirun', '-np', '2', sys.executable, '-c',
+                               script], env=dict(os.environ, OMP_NUM_THREADS='1'))
+
+    def test_distributed(self):
+        """Test the TSQR fit of a single problem against vectfit"""
+        s = np.linspace(3., 7., 201)
+        poles = [5.0+0.1j, 5.0-0.1j, 4.0+0.2j, 4.0-0.2j]
+        residues = [[0.5-11.0j, 0.5+11.0j, 1.0-2.0j, 1.0+2.0j],
+                    [1.5-1.0j, 1.5+1.0j, 0.5-3.0j, 0.5+3.0j]]
+        f = m.evaluate(s, poles, residues, [[1.0, 0.1], [2.0, 0.0]])
+        weight = 1.0/f
+        init_poles = np.array([3.5+0.035j, 3.5-0.035j, 6.0+0.06j, 6.0-0.06j])
+        p = init_poles.copy()
+        for i in range(2):
+            p, r, cf, fit, rms = m.vectfit(f, s, p, weight, n_polys=2)
+        dp, dr, dcf, dfit, drms = m.vectfit_distributed(
+            f, s, init_poles, weight, n_polys=2, n_iter=2)
+        np.testing.assert_allclose(dp, p, rtol=1e-6)
+        np.testing.assert_allclose(dr, r, rtol=1e-6)
+        np.testing.assert_allclose(dfit, fit, rtol=1e-6)
+        np.testing.assert_allclose(drms, rms, rtol=1e-6, atol=1e-12)
+
+    @skipUnless(m.has_mpi and shutil.which('mpirun'), "requires MPI")
+    def test_distributed_mpi(self):
+        """Test the TSQR fit of a single problem split over 3 MPI ranks"""
+        script = """
+import os
+import numpy as np
+import vectfit as m
+rank = int(os.environ.get('OMPI_COMM_WORLD_RANK', os.environ.get('PMI_RANK')))
+s = np.linspace(3., 7., 301)
+f = m.evaluate(s, [5.0+0.1j, 5.0-0.1j], [[0.5-11.0j, 0.5+11.0j]], [[1.0]])
+poles = np.array([3.5 + 0.035j, 3.5 - 0.035j])
+block = np.array_split(np.arange(s.size), 3)[rank]
+dp, dr, dcf, dfit, drms = m.vectfit_distributed(
+    f[:, block], s[block], poles.copy(), 1.0/f[:, block], n_polys=1, n_iter=2)
+p = poles.copy()
+for i in range(2):
+    p, r, cf, fit, rms = m.vectfit(f, s, p, 1.0/f, n_polys=1)
+np.testing.assert_allclose(dp, p, rtol=1e-6)
+np.testing.assert_allclose(dr, r, rtol=1e-6)
+np.testing.assert_allclose(dfit, fit[:, block], rtol=1e-6)
+np.testing.assert_allclose(drms, rms, rtol=1e-6, atol=1e-12)
+"""
+        subprocess.check_call(['mpirun', '-np', '3', sys.executable, '-c',
+                               script], env=dict(os.environ, OMP_NUM_THREADS='1'))
+
+    def test_registry(self):
+        """Test publishing, replacing and removing models of a registry"""
+        s = np.linspace(3., 7., 51)
+        a = m.Model([5.0+0.1j, 5.0-0.1j], [[0.5-11.0j, 0.5+11.0j]])
+        b = 2.0*a
+        registry = m.Registry()
+        registry.publish('u235', a)
+        self.assertIn('u235', registry)
+        np.testing.assert_allclose(registry.evaluate('u235', s), a.evaluate(s))
+        registry.update({'u235': b, 'u238': a})
+        self.assertEqual(registry.keys(), ['u235', 'u238'])
+        self.assertEqual(registry.version, 2)
+        np.testing.assert_allclose(registry.evaluate('u235', s), b.evaluate(s))
+        self.assertTrue(registry.remove('u235'))
+        self.assertFalse(registry.remove('u235'))
+        self.assertEqual(len(registry), 1)
+        with self.assertRaises(KeyError):
+            registry.evaluate('u235', s)
+
+        # Lookups during updates see either version
+        stop = threading.Event()
+        seen = []
+        def read():
+            while not stop.is_set():
+                seen.append(registry.evaluate('u238', s)[0, 0])
+        reader = threading.Thread(target=read)
+        reader.start()
+        for i in range(200):
+            registry.publish('u238', a if i % 2 else b)
+        stop.set()
+        reader.join()
+        self.assertTrue(np.all(np.isclose(seen, a.evaluate(s)[0, 0]) |
+                               np.isclose(seen, b.evaluate(s)[0, 0])))
+
+    def test_coalescer(self):
+        """Test concurrent requests evaluated in coalesced batches"""
+        a = m.Model([5.0+0.1j, 5.0-0.1j], [[0.5-11.0j, 0.5+11.0j]])
+        registry = m.Registry()
+        registry.update({'a': a, 'b': 2.0*a})
+        coalescer = m.Coalescer(registry, window=100000.0, max_batch=8)
+        points = [np.linspace(3., 7., k + 1) for k in range(16)]
+        results = [None]*16
+        barrier = threading.Barrier(16)
+        def request(k):
+            barrier.wait()
+            results[k] = coalescer.evaluate('ab'[k % 2], points[k])
+        threads = [threading.Thread(target=request, args=(k,))
+                   for k in range(16)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for k in range(16):
+            scale = 1.0 if k % 2 == 0 else 2.0
+            np.testing.assert_allclose(results[k], scale*a.evaluate(points[k]))
+        self.assertEqual(coalescer.requests, 16)
+        self.assertLess(coalescer.batches, coalescer.requests)
+        with self.assertRaises(KeyError):
+            coalescer.evaluate('c', points[0])
+
+    def test_daemon(self):
+        """Test the evaluation daemon through its client"""
+        sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..',
+                                        'tools'))
+        try:
+            import vectfit_daemon
+        finally:
+            sys.path.pop(0)
+        a = m.Model([5.0+0.1j, 5.0-0.1j], [[0.5-11.0j, 0.5+11.0j]])
+        s = np.linspace(3., 7., 9)
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'a.npz')
+            np.savez(path, poles=a.poles, residues=a.residues)
+            daemon = vectfit_daemon.Daemon(os.path.join(tmp, 'socket'))
+            thread = threading.Thread(target=daemon.serve_forever)
+            thread.start()
+            try:
+                with vectfit_daemon.Client(os.path.join(tmp, 'socket')) as c:
+                    c.load('a', path)
+                    np.testing.assert_allclose(c.evaluate('a', s),
+                                               a.evaluate(s))
+                    with self.assertRaises(RuntimeError):
+                        c.evaluate('b', s)
+                    stats = c.stats()
+                    self.assertEqual(stats['models'], 1)
+                    self.assertEqual(stats['requests'], 2)
+            finally:
+                daemon.shutdown()
+                daemon.server_close()
+                thread.join()
+
+    def test_lookup(self):
+        """Test batched lookup of unordered (model, point) queries"""
+        models = [m.Model([4.0+0.1j*k, 4.0-0.1j*k], [[1.0-2.0j, 1.0+2.0j]],
+                          [[0.1*k]]) for k in range(1, 6)]
+        rng = np.random.default_rng(1)
+        index = rng.integers(0, 5, 3000)
+        s = rng.uniform(3.0, 7.0, 3000)
+        f = m.lookup(models, index, s)
+        self.assertEqual(f.shape, (1, 3000))
+        for k in range(5):
+            mask = index == k
+            np.testing.assert_allclose(f[:, mask],
+                                       models[k].evaluate(s[mask]))
+        with self.assertRaises(ValueError):
+            m.lookup(models, np.array([5]), np.array([4.0]))
+
+    def test_evaluate_point(self):
+        """Test single-point evaluation against array evaluation"""
+        rng = np.random.default_rng(2)
+        a = rng.uniform(3.0, 7.0, 30)
+        b = rng.uniform(0.01, 0.1, 30)
+        poles = np.concatenate([np.stack([a + 1j*b, a - 1j*b], axis=1).ravel(),
+                                [2.0, 8.0]])
+        r = rng.normal(size=(2, 30)) + 1j*rng.normal(size=(2, 30))
+        residues = np.concatenate([np.stack([r, r.conj()], axis=2)
+                                   .reshape(2, 60), [[1.0, 2.0], [3.0, 4.0]]],
+                                  axis=1)
+        model = m.Model(poles, residues, [[1.0, 0.5, 0.1], [0.0, 2.0, 0.0]])
+        s = np.linspace(3., 7., 41)
+        f = model.evaluate(s)
+        for k, x in enumerate(s):
+            np.testing.assert_allclose(model.evaluate_point(x), f[:, k],
+                                       rtol=1e-10)
+
+    def test_canonical_poles(self):
+        """Test pairing and ordering of scrambled poles"""
+        poles = np.array([5.0-0.1j+1e-13, 2.0+1e-300j, 3.0+0.2j,
+                          5.0+0.1j, 3.0-0.2j-1e-13j, 1.0+0.5j])
+        p = m.canonical_poles(poles)
+        np.testing.assert_allclose(p, [1.0, 2.0, 3.0+0.2j, 3.0-0.2j,
+                                       5.0+0.1j, 5.0-0.1j], atol=1e-12)
+        self.assertEqual(p[0].imag, 0.0)
+        self.assertEqual(p[1].imag, 0.0)
+        self.assertEqual(p[2], np.conj(p[3]))
+        self.assertEqual(p[4], np.conj(p[5]))
+
+    def test_online(self):
+        """Test streamed fitting against successive vectfit calls"""
+        s = np.linspace(3., 7., 101)
+        test_poles = [5.0+0.1j, 5.0-0.1j]
+        test_residues = [[0.5-11.0j, 0.5+11.0j], [1.5-20.0j, 1.5+20.0j]]
+        f = m.evaluate(s, test_poles, test_residues, [[1.0], [2.0]])
+        weight = 1.0/f
+        init_poles = np.array([3.5 + 0.035j, 3.5 - 0.035j])
+        online = m.OnlineFit(init_poles, n_rows=2, n_polys=1)
+        for k in np.random.default_rng(3).permutation(s.size):
+            online.update(s[k:k+1], f[:, k:k+1], weight[:, k:k+1])
+        self.assertEqual(online.count, s.size)
+        p = init_poles.copy()
+        for i in range(3):
+            self.assertTrue(online.relocate())
+            p, r, cf, fit, rms = m.vectfit(f, s, p, weight, n_polys=1)
+        np.testing.assert_allclose(online.poles, p, rtol=1e-6)
+        np.testing.assert_allclose(online.model.evaluate(s), fit, rtol=1e-5)
+
+        # Tracking a change with forgetting and automatic relocations
+        online = m.OnlineFit(test_poles, n_rows=2, n_polys=1,
+                             forgetting=0.95, window=200, relocate_every=50)
+        g = m.evaluate(s, [5.5+0.2j, 5.5-0.2j], test_residues, [[1.0], [2.0]])
+        for k in range(6):
+            online.update(s, g, 1.0/g)
+        np.testing.assert_allclose(online.poles, [5.5+0.2j, 5.5-0.2j],
+                                   rtol=1e-5)
+
+    def test_fit_state(self):
+        """Test incremental pole edits against full evaluation"""
+        s = np.linspace(3., 7., 101)
+        poles = [4.0, 5.0+0.1j, 5.0-0.1j]
+        residues = [[1.0, 0.5-11.0j, 0.5+11.0j], [2.0, 1.5-2.0j, 1.5+2.0j]]
+        model = m.Model(poles, residues, [[1.0], [0.5]])
+        f = model.evaluate(s) + 0.01*np.sin(s)
+        state = m.FitState(model, s, f)
+
+        def check():
+            ref = state.model.evaluate(s)
+            np.testing.assert_allclose(state.fit, ref, rtol=1e-10)
+            self.assertAlmostEqual(state.rmserr,
+                                   np.sqrt(np.mean((ref - f)**2)))
+            self.assertAlmostEqual(state.max_error, np.abs(ref - f).max())
+
+        check()
+        state.set_pole(2, 5.2-0.2j, [1.0+3.0j, 2.0-1.0j])
+        np.testing.assert_allclose(state.model.poles[1:], [5.2+0.2j, 5.2-0.2j])
+        check()
+        state.add_pole(6.0+0.3j, [0.1+0.2j, 0.3+0.4j])
+        self.assertEqual(state.model.poles.size, 5)
+        check()
+        state.remove_pole(0)
+        np.testing.assert_allclose(state.model.poles,
+                                   [5.2+0.2j, 5.2-0.2j, 6.0+0.3j, 6.0-0.3j])
+        check()
+        with self.assertRaises(ValueError):
+            state.set_pole(0, 4.0, [1.0, 1.0])
+
+    def test_stats(self):
+        """Test the count of basis values clamped for a pole on a sample"""
+        s = np.linspace(1.0, 10.0, 91)
+        f = m.evaluate(s, [3.0+0.1j, 3.0-0.1j], [[1.0-2.0j, 1.0+2.0j]])
+        m.reset_stats()
+        m.vectfit(f, s, np.array([5.0+0.05j, 5.0-0.05j, s[40]]),
+                  np.ones_like(f))
+        stats = m.stats()
+        self.assertGreaterEqual(stats['inf_clamps'], 1)
+        m.reset_stats()
+        self.assertEqual(m.stats()['inf_clamps'], 0)
+
+    def test_constrain(self):
+        """Test the constraint stage of the pole relocation"""
+        s = np.linspace(1.0, 10.0, 200)
+        poles = np.array([3.0+0.1j, 3.0-0.1j, 7.0+0.2j, 7.0-0.2j])
+        residues = np.array([[1.0-2.0j, 1.0+2.0j, 2.0+1.0j, 2.0-1.0j]])
+        f = m.evaluate(s, poles, residues)
+        init = np.array([2.0+1e-9j, 2.0-1e-9j, 500.0+1.0j, 500.0-1.0j])
+        m.reset_stats()
+        p, _, _, _, _ = m.vectfit(f, s, init, np.ones_like(f),
+                                  skip_res=True, constrain=True,
+                                  margin=0.5, min_imag=1e-3)
+        stats = m.stats()
+        self.assertGreater(stats['poles_lifted'] + stats['poles_relocated'], 0)
+        self.assertTrue(np.all(np.abs(p.imag) >= 1e-3*9.0 - 1e-12))
+        self.assertTrue(np.all(p.real >= 1.0 - 4.5 - 1e-12))
+        self.assertTrue(np.all(p.real <= 10.0 + 4.5 + 1e-12))
+        for _ in range(10):
+            p, r, _, fit, _ = m.vectfit(f, s, p, np.ones_like(f),
+                                        constrain=True)
+        np.testing.assert_allclose(np.sort_complex(p), np.sort_complex(poles),
+                                   rtol=1e-6)
+        with self.assertRaises(ValueError):
+            m.vectfit(f, s, p, np.ones_like(f), constrain=True, margin=-1.0)
+        with self.assertRaises(ValueError):
+            m.vectfit(f, s, p, np.ones_like(f), constrain=True, min_imag=0.0)
+
+    def test_validate(self):
+        """Test the validation of models against packed reference data"""
+        poles = np.array([3.0+0.1j, 3.0-0.1j])
+        residues = np.array([[1.0-2.0j, 1.0+2.0j], [2.0+1.0j, 2.0-1.0j]])
+        polys = np.array([[1.0], [0.5]])
+        models = [m.Model(poles, residues, polys),
+                  m.Model(poles + 5.0, residues, polys)]
+        s = [np.linspace(1.0, 5.0, 5000), np.linspace(6.0, 10.0, 3000)]
+        f = [models[k].evaluate(s[k]) for k in range(2)]
+        f[1][0, 100] *= 1.01
+        offsets = np.array([0, 5000, 8000])
+        result = m.validate(models, offsets, np.concatenate(s),
+                            np.concatenate(f, axis=1), rtol=1e-6)
+        self.assertEqual(list(result['failures']), [0, 1])
+        self.assertEqual(list(result['passed']), [True, False])
+        self.assertLess(result['max_abs'][0], 1e-12)
+        self.assertAlmostEqual(result['max_rel'][1], 0.01/1.01, places=6)
+        aggregate = result['aggregate']
+        self.assertEqual(aggregate['windows'], 2)
+        self.assertEqual(aggregate['passed'], 1)
+        self.assertEqual(aggregate['points'], 8000)
+        self.assertEqual(aggregate['failures'], 1)
+        with self.assertRaises(ValueError):
+            m.validate(models, np.array([0, 5000]), np.concatenate(s),
+                       np.concatenate(f, axis=1))
+
+    def test_series(self):
+        """Test fitting a temperature series with shared poles"""
+        s = np.linspace(1.0, 10.0, 300)
+        poles = np.array([3.0+0.1j, 3.0-0.1j, 7.0+0.2j, 7.0-0.2j])
+        f = []
+        for k in range(4):
+            residues = (1.0 + 0.1*k)*np.array([[1.0-2.0j, 1.0+2.0j,
+                                                 2.0+1.0j, 2.0-1.0j]])
+            f.append(m.evaluate(s, poles, residues))
+        weight = [np.ones_like(fk) for fk in f]
+        init = np.array([2.0+0.5j, 2.0-0.5j, 8.0+0.5j, 8.0-0.5j])
+        results = m.vectfit_series(f, s, init, weight, n_iter=10, tol=1e-6)
+        self.assertEqual(len(results), 4)
+        for fk, (p, r, c, fit, rms, shared) in zip(f, results):
+            self.assertTrue(shared)
+            np.testing.assert_allclose(np.sort_complex(p),
+                                       np.sort_complex(poles), rtol=1e-6)
+            np.testing.assert_allclose(fit, fk, rtol=1e-5, atol=1e-8)
+
+        # A temperature with other resonances is refitted on its own
+        f[3] = m.evaluate(s, poles + 1.0, [[1.0-2.0j, 1.0+2.0j,
+                                           2.0+1.0j, 2.0-1.0j]])
+        results = m.vectfit_series(f, s, init, weight, n_iter=10, tol=1e-6)
+        self.assertFalse(results[3][5])
+        self.assertLess(results[3][4], 1e-6)
+
+    def test_model_pickle(self):
+        """Test zero-copy views and out-of-band pickling of a model"""
+        model = m.Model([3.0+0.1j, 3.0-0.1j], [[1.0-2.0j, 1.0+2.0j]],
+                        [[1.0, 0.5]])
+        self.assertFalse(model.residues.flags.writeable)
+        # every access is a new view of the same memory
+        residues = model.residues
+        self.assertIsNot(residues, model.residues)
+        self.assertTrue(np.shares_memory(residues, model.residues))
+        buffers = []
+        data = pickle.dumps(model, protocol=5, buffer_callback=buffers.append)
+        self.assertEqual(len(buffers), 3)
+        self.assertTrue(np.shares_memory(np.asarray(buffers[1]),
+                                         model.residues))
+        copy = pickle.loads(data, buffers=buffers)
+        s = np.linspace(1.0, 5.0, 20)
+        np.testing.assert_array_equal(copy.evaluate(s), model.evaluate(s))
+        copy = pickle.loads(pickle.dumps(model))
+        np.testing.assert_array_equal(copy.poles, model.poles)
+
+        # DLPack export of read-only arrays needs versioned DLPack
+        if np.lib.NumpyVersion(np.__version__) >= '2.1.0':
+            residues = np.from_dlpack(model.residues)
+            self.assertTrue(np.shares_memory(residues, model.residues))
+            self.assertFalse(residues.flags.writeable)
+        else:
+            with self.assertRaises(BufferError):
+                model.residues.__dlpack__()
+
+        # Fitting from the poles of a model leaves the model unchanged
+        f = model.evaluate(s)
+        p, _, _, _, _ = m.vectfit(f, s, model.poles, np.ones_like(f))
+        np.testing.assert_array_equal(model.poles, [3.0+0.1j, 3.0-0.1j])
+
+    def test_read_tab1(self):
+        """Test reading the tabulated sections of an ENDF file"""
+        def line(fields, mat, mf, mt):
+            return ''.join(f'{x:>11}' for x in fields).ljust(66) + \
+                f'{mat:4d}{mf:2d}{mt:3d}{0:5d}\n'
+
+        def tab1(mat, mt, law, x, y):
+            lines = [line(['9.223500+4', '2.330248+2', 0, 0, 0, 0],
+                          mat, 3, mt),
+                     line(['1.000000-5', '-3.0000E+2', 0, 0, 1, len(x)],
+                          mat, 3, mt),
+                     line([len(x), law], mat, 3, mt)]
+            pairs = [v for xy in zip(x, y) for v in xy]
+            for i in range(0, len(pairs), 6):
+                lines.append(line(pairs[i:i+6], mat, 3, mt))
+            return lines + [line([], mat, 3, 0)]
+
+        x1 = ['1.000000-5', '2.530000-2', '1.0000D+0', '2.530000+4',
+              ' 2.0000000']
+        y1 = ['1.234567+3', '-4.56789-1', '7.000000+0', '8.0e-1', '9.0']
+        x2 = ['1.000000+6', '2.000000+7']
+        y2 = ['3.000000+0', '4.000000+0']
+        text = (line(['9.223500+4', '2.330248+2', 1, 0, 0, 0], 9228, 1, 451)
+                + ''.join(tab1(9228, 1, 5, x1, y1) + tab1(9228, 2, 2, x2, y2))
+                + line([], 9228, 0, 0))
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'tape')
+            with open(path, 'w') as f:
+                f.write(text)
+            lib = m.read_tab1(path)
+            np.testing.assert_array_equal(lib['mat'], [9228, 9228])
+            np.testing.assert_array_equal(lib['mt'], [1, 2])
+            np.testing.assert_array_equal(lib['law'], [5, 2])
+            np.testing.assert_array_equal(lib['offsets'], [0, 5, 7])
+            np.testing.assert_array_equal(lib['za'], [92235.0, 92235.0])
+            np.testing.assert_array_equal(lib['qi'], [-300.0, -300.0])
+            np.testing.assert_array_equal(
+                lib['x'], [1e-5, 2.53e-2, 1.0, 2.53e4, 2.0, 1e6, 2e7])
+            np.testing.assert_array_equal(
+                lib['y'], [1234.567, -0.456789, 7.0, 0.8, 9.0, 3.0, 4.0])
+            lib = m.read_tab1(path, mt=[2])
+            np.testing.assert_array_equal(lib['x'], [1e6, 2e7])
+            with self.assertRaises(RuntimeError):
+                m.read_tab1(os.path.join(tmp, 'missing'))
@@ -0,0 +1,200 @@
+"""Local evaluation daemon keeping vectfit models resident
+
+The daemon serves evaluations of pole-residue models over a Unix-domain
+socket, so that short-lived tools skip the model loading. Every connection
+is served by its own thread, and concurrent requests are coalesced into
+batched evaluations by a vectfit.Coalescer. Models are .npz files holding
+the arrays poles, residues and (optionally) polys, and can be replaced
+while the daemon runs.
+
+    python tools/vectfit_daemon.py /tmp/vectfit.sock u235=u235.npz ...
+
+Messages in both directions are a 4-byte little-endian length, a JSON header
+of that length, and the float64 payload announced by the header. Requests:
+
+    {"op": "evaluate", "key": k, "n": Ns} + s       -> {"shape": [Nv, Ns]} + f
+    {"op": "load", "key": k, "path": p}             -> {}
+    {"op": "stats"}                                 -> {"requests": ..., ...}
+
+Errors are returned as {"error": message}.
+
+"""
+import argparse
+import json
+import os
+import signal
+import socket
+import socketserver
+import struct
+import sys
+
+import numpy as np
+import vectfit as m
+
+
+def _recv_exact(sock, n):
+    data = bytearray()
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise EOFError('connection closed')
+        data.extend(chunk)
+    return bytes(data)
+
+
+def send_message(sock, header, payload=None):
+    """Send a JSON header and an optional float64 payload"""
+    data = json.dumps(header).encode()
+    parts = [struct.pack('<I', len(data)), data]
+    if payload is not None:
+        parts.append(np.ascontiguousarray(payload, dtype='<f8').tobytes())
+    sock.sendall(b''.join(parts))
+
+
+def recv_message(sock, payload_size=None):
+    """Receive a JSON header, and its payload as sized by payload_size"""
+    n, = struct.unpack('<I', _recv_exact(sock, 4))
+    header = json.loads(_recv_exact(sock, n).decode())
+    payload = None
+    if payload_size is not None:
+        count = payload_size(header)
+        if count:
+            payload = np.frombuffer(_recv_exact(sock, 8*count), dtype='<f8')
+    return header, payload
+
+
+def load_model(path):
+    """Model from a .npz file with the arrays poles, residues and polys"""
+    with np.load(path) as data:
+        polys = data['polys'] if 'polys' in data else np.zeros((0, 0))
+        return m.Model(data['poles'], data['residues'], polys)
+
+
+class Client:
+    """Connection to a running daemon
+
+    Parameters
+    ----------
+    path : str
+        Path of the Unix-domain socket of the daemon
+
+    """
+    def __init__(self, path):
+        self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._sock.connect(path)
+
+    def _call(self, header, payload=None, payload_size=None):
+        send_message(self._sock, header, payload)
+        reply, data = recv_message(self._sock, payload_size)
+        if 'error' in reply:
+            raise RuntimeError(reply['error'])
+        return reply, data
+
+    def evaluate(self, key, s):
+        """Evaluate the model named key on the points s, (Nv, Ns)"""
+        s = np.asarray(s, dtype=float).ravel()
+        reply, f = self._call(
+            {'op': 'evaluate', 'key': key, 'n': s.size}, s,
+            lambda h: h['shape'][0]*h['shape'][1] if 'shape' in h else 0)
+        return f.reshape(reply['shape'])
+
+    def load(self, key, path):
+        """Load or replace the model named key from a .npz file"""
+        self._call({'op': 'load', 'key': key, 'path': os.path.abspath(path)})
+
+    def stats(self):
+        """Numbers of models, requests served and batches evaluated"""
+        return self._call({'op': 'stats'})[0]
+
+    def close(self):
+        self._sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+class _Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        server = self.server
+        while True:
+            try:
+                header, s = recv_message(
+                    self.request,
+                    lambda h: h.get('n', 0) if h.get('op') == 'evaluate'
+                    else 0)
+            except EOFError:
+                return
+            try:
+                op = header.get('op')
+                if op == 'evaluate':
+                    s = np.empty(0) if s is None else s
+                    f = server.coalescer.evaluate(header['key'], s)
+                    send_message(self.request, {'shape': list(f.shape)}, f)
+                elif op == 'load':
+                    server.registry.publish(header['key'],
+                                            load_model(header['path']))
+                    send_message(self.request, {})
+                elif op == 'stats':
+                    send_message(self.request, {
+                        'models': len(server.registry),
+                        'requests': server.coalescer.requests,
+                        'batches': server.coalescer.batches})
+                else:
+                    send_message(self.request,
+                                 {'error': 'unknown op {!r}'.format(op)})
+            except KeyError as e:
+                send_message(self.request,
+                             {'error': 'no model named {}'.format(e)})
+            except Exception as e:
+                send_message(self.request, {'error': str(e)})
+
+
+class Daemon(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    """Evaluation daemon on a Unix-domain socket
+
+    Parameters
+    ----------
+    path : str
+        Path of the socket, replaced if it exists
+    window : float
+        Coalescing window in microseconds
+    max_batch : int
+        Number of requests which closes a batch before the window ends
+
+    """
+    daemon_threads = True
+
+    def __init__(self, path, window=50.0, max_batch=64):
+        if os.path.exists(path):
+            os.unlink(path)
+        self.registry = m.Registry()
+        self.coalescer = m.Coalescer(self.registry, window, max_batch)
+        super().__init__(path, _Handler)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('socket', help='path of the Unix-domain socket')
+    parser.add_argument('models', nargs='*', metavar='key=path',
+                        help='models to load')
+    parser.add_argument('--window', type=float, default=50.0,
+                        help='coalescing window in microseconds')
+    parser.add_argument('--max-batch', type=int, default=64,
+                        help='requests closing a batch early')
+    args = parser.parse_args()
+
+    daemon = Daemon(args.socket, args.window, args.max_batch)
+    daemon.registry.update({key: load_model(path) for key, path in
+                            (item.split('=', 1) for item in args.models)})
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    try:
+        daemon.serve_forever()
+    finally:
+        os.unlink(args.socket)
+
+
+if __name__ == '__main__':
+    main()